@@ -0,0 +1,299 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE                         /* pthread_setaffinity_np, sched_getaffinity */
+#endif
+
+#include "nes_batch.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+/*
+ * Work-stealing pool: jobs are dealt round-robin into one deque per worker.
+ * A worker pops its own deque from the back and, once it is empty, steals
+ * from the front of the others. Sessions are coarse (thousands of frames),
+ * so a mutex per deque is cheap enough and keeps the code portable.
+ *
+ * On Linux every worker is pinned to one of the CPUs the process may run on
+ * (sched_getaffinity, so taskset and cgroup cpusets are honoured) and allocates
+ * the nes_t of its jobs itself. NUMA placement is first-touch only: instance
+ * memory lands on the worker's node under the default policy, nothing asks
+ * for or checks a node.
+ */
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t* items;
+    size_t head;                            /*  Steal end */
+    size_t tail;                            /*  Owner end */
+} nes_batch_queue_t;
+
+typedef struct {
+    nes_batch_job_t* jobs;
+    nes_batch_queue_t* queues;
+    int workers;
+} nes_batch_pool_t;
+
+typedef struct {
+    nes_batch_pool_t* pool;
+    int id;
+    int cpu;                                /*  CPU the worker pins itself to, -1: not pinned */
+    pthread_t thread;
+} nes_batch_worker_t;
+
+static double nes_batch_clock(void){
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int nes_batch_cpu_count(void){
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) > 0){
+        return CPU_COUNT(&allowed);
+    }
+#endif
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+#if defined(__linux__)
+// The n-th CPU set in `cpus`, -1 if there are not that many
+static int nes_batch_nth_cpu(const cpu_set_t* cpus, int n){
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+        if (CPU_ISSET(cpu, cpus) && n-- == 0){
+            return cpu;
+        }
+    }
+    return -1;
+}
+#endif
+
+// XXH64 (nes_hash64), the same hash as the movie and frame hashes
+uint64_t nes_batch_hash(const void* data, size_t len){
+    return nes_hash64(data, len, 0);
+}
+
+/*
+ * Input script, one change per line, '#' starts a comment:
+ *   <frame> <joypad hex>
+ * joypad uses the nes_joypad_t bit layout, e.g. 0x8000 = A1, 0x1000 = Start1.
+ */
+int nes_batch_load_inputs(const char* path, nes_batch_input_t** inputs, uint32_t* count){
+    FILE* file = fopen(path, "r");
+    if (file == NULL){
+        NES_LOG_ERROR("can not open input script %s\n", path);
+        return NES_ERROR;
+    }
+    uint32_t capacity = 64, size = 0;
+    nes_batch_input_t* list = (nes_batch_input_t*)malloc(capacity * sizeof(nes_batch_input_t));
+    char line[256];
+    while (list && fgets(line, sizeof(line), file)){
+        unsigned long frame, joypad;
+        if (line[0] == '#' || sscanf(line, "%lu %lx", &frame, &joypad) != 2){
+            continue;
+        }
+        if (size && frame < list[size - 1].frame){
+            NES_LOG_ERROR("%s: frame %lu is out of order\n", path, frame);
+            free(list);
+            list = NULL;
+            break;
+        }
+        if (size == capacity){
+            capacity *= 2;
+            nes_batch_input_t* grow = (nes_batch_input_t*)realloc(list, capacity * sizeof(nes_batch_input_t));
+            if (grow == NULL){
+                free(list);
+                list = NULL;
+                break;
+            }
+            list = grow;
+        }
+        list[size].frame = (uint32_t)frame;
+        list[size].joypad = (uint16_t)joypad;
+        size++;
+    }
+    fclose(file);
+    if (list == NULL){
+        return NES_ERROR;
+    }
+    *inputs = list;
+    *count = size;
+    return NES_OK;
+}
+
+static void nes_batch_run_job(nes_batch_job_t* job){
+    const double start = nes_batch_clock();
+    job->status = NES_ERROR;
+    nes_t* nes = nes_init();
+    if (nes == NULL){
+        return;
+    }
+    if (nes_load_file(nes, job->rom_path) == NES_OK){
+        // Pictures are hashed by the core as lines are rendered, no second pass over the frame
+        nes_frame_hash_enable(nes, job->frame_hashes != NULL);
+        nes->nes_hidden = job->hidden;
+        uint32_t input = 0;
+        for (uint32_t frame = 0; frame < job->frames; frame++){
+            while (input < job->input_count && job->inputs[input].frame <= frame){
+                nes->nes_cpu.joypad.joypad = job->inputs[input++].joypad;
+            }
+            nes_step_frame(nes);
+            if (job->frame_hashes){
+                job->frame_hashes[frame] = nes->nes_frame_hash.video;
+            }
+        }
+        job->final_hash = (job->hidden & NES_HIDDEN_VIDEO) ? 0 : nes_batch_hash(nes->nes_draw_data, NES_DRAW_SIZE * sizeof(nes_color_t));
+        job->lag_frames = nes->nes_lag_count;
+        nes_memcpy(job->ram, nes->nes_cpu.cpu_ram, NES_CPU_RAM_SIZE);
+        nes_unload_file(nes);
+        job->status = NES_OK;
+    }
+    nes_deinit(nes);
+    job->seconds = nes_batch_clock() - start;
+}
+
+static int nes_batch_pop(nes_batch_queue_t* queue, size_t* job){
+    int found = 0;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail){
+        *job = queue->items[--queue->tail];
+        found = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static int nes_batch_steal(nes_batch_queue_t* queue, size_t* job){
+    int found = 0;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail){
+        *job = queue->items[queue->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static void* nes_batch_worker(void* arg){
+    nes_batch_worker_t* worker = (nes_batch_worker_t*)arg;
+    nes_batch_pool_t* pool = worker->pool;
+#if defined(__linux__)
+    // Pin the worker so its instances stay on the node they were first touched on
+    if (worker->cpu >= 0){
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(worker->cpu, &cpus);
+        const int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (error){
+            NES_LOG_WARN("worker %d: can not pin to CPU %d (error %d), running unpinned\n", worker->id, worker->cpu, error);
+        }
+    }
+#endif
+    for (;;){
+        size_t job;
+        int found = nes_batch_pop(&pool->queues[worker->id], &job);
+        for (int i = 1; found == 0 && i < pool->workers; i++){
+            found = nes_batch_steal(&pool->queues[(worker->id + i) % pool->workers], &job);
+        }
+        if (found == 0){
+            // Jobs are only queued before the workers start, empty everywhere means done
+            break;
+        }
+        pool->jobs[job].worker = worker->id;
+        nes_batch_run_job(&pool->jobs[job]);
+    }
+    return NULL;
+}
+
+int nes_batch_run(nes_batch_job_t* jobs, size_t count, int threads){
+    if (threads <= 0){
+        threads = nes_batch_cpu_count();
+    }
+    if ((size_t)threads > count){
+        threads = count ? (int)count : 1;
+    }
+    nes_batch_pool_t pool = {
+        .jobs = jobs,
+        .queues = (nes_batch_queue_t*)calloc((size_t)threads, sizeof(nes_batch_queue_t)),
+        .workers = threads,
+    };
+    nes_batch_worker_t* workers = (nes_batch_worker_t*)calloc((size_t)threads, sizeof(nes_batch_worker_t));
+    size_t* items = (size_t*)malloc((count ? count : 1) * sizeof(size_t));
+    if (pool.queues == NULL || workers == NULL || items == NULL){
+        free(pool.queues);
+        free(workers);
+        free(items);
+        return NES_ERROR;
+    }
+    // Deal the jobs round-robin, every queue gets a slice of `items`
+    const size_t per_queue = (count + (size_t)threads - 1) / (size_t)threads;
+    for (int w = 0; w < threads; w++){
+        pthread_mutex_init(&pool.queues[w].lock, NULL);
+        pool.queues[w].items = items + (size_t)w * per_queue;
+    }
+    for (size_t i = 0; i < count; i++){
+        nes_batch_queue_t* queue = &pool.queues[i % (size_t)threads];
+        queue->items[queue->tail++] = i;
+    }
+#if defined(__linux__)
+    // Spread the workers over the CPUs this process is allowed on, not over CPU ids 0..n-1
+    cpu_set_t allowed;
+    const int allowed_count = sched_getaffinity(0, sizeof(allowed), &allowed) == 0 ? CPU_COUNT(&allowed) : 0;
+    if (allowed_count == 0){
+        NES_LOG_WARN("sched_getaffinity failed, workers are not pinned\n");
+    }
+#endif
+    int started = 0;
+    for (int w = 0; w < threads; w++){
+        workers[w].pool = &pool;
+        workers[w].id = w;
+        workers[w].cpu = -1;
+#if defined(__linux__)
+        if (allowed_count){
+            workers[w].cpu = nes_batch_nth_cpu(&allowed, w % allowed_count);
+        }
+#endif
+        if (pthread_create(&workers[w].thread, NULL, nes_batch_worker, &workers[w]) == 0){
+            started++;
+        }else{
+            break;
+        }
+    }
+    if (started == 0){
+        // No threads available: run everything on the caller, left where it is
+        workers[0].pool = &pool;
+        workers[0].cpu = -1;
+        nes_batch_worker(&workers[0]);
+    }
+    for (int w = 0; w < started; w++){
+        pthread_join(workers[w].thread, NULL);
+    }
+    for (int w = 0; w < threads; w++){
+        pthread_mutex_destroy(&pool.queues[w].lock);
+    }
+    free(pool.queues);
+    free(workers);
+    free(items);
+    return NES_OK;
+}
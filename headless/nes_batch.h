@@ -0,0 +1,55 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "nes.h"
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+/* Joypad state (nes_joypad_t.joypad) applied from `frame` on */
+typedef struct {
+    uint32_t frame;
+    uint16_t joypad;
+} nes_batch_input_t;
+
+/* One emulator session: inputs are filled by the caller, results by nes_batch_run() */
+typedef struct {
+    const char* rom_path;
+    uint32_t frames;                        /*  Frames to run */
+    const nes_batch_input_t* inputs;        /*  Sorted by frame, may be shared between jobs */
+    uint32_t input_count;
+    uint64_t* frame_hashes;                 /*  Optional, `frames` entries: hash of every picture */
+    uint8_t hidden;                         /*  NES_HIDDEN_* for the whole run, NES_HIDDEN_VIDEO for RAM-only runs */
+    /* results */
+    int status;                             /*  NES_OK or NES_ERROR */
+    int worker;                             /*  Worker thread that ran the job */
+    uint64_t final_hash;                    /*  Hash of the last picture */
+    uint32_t lag_frames;                    /*  Frames that never read the joypad */
+    double seconds;                         /*  Wall time of the session */
+    uint8_t ram[NES_CPU_RAM_SIZE];          /*  CPU RAM after the last frame */
+} nes_batch_job_t;
+
+/* threads <= 0: one worker per CPU the process may run on */
+int nes_batch_run(nes_batch_job_t* jobs, size_t count, int threads);
+int nes_batch_cpu_count(void);
+uint64_t nes_batch_hash(const void* data, size_t len);
+int nes_batch_load_inputs(const char* path, nes_batch_input_t** inputs, uint32_t* count);
+
+#ifdef __cplusplus
+    }
+#endif
@@ -0,0 +1,139 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes_batch.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Batch runner: every ROM (times -n) is one job on the work-stealing pool.
+ *
+ *   nes_batch_run [-j threads] [-f frames] [-i inputs.txt] [-n repeat] [-r ram_prefix] [-H] [-R] rom...
+ *
+ * Prints one CSV line per job (rom, worker, seconds, fps, lag frames, final frame hash,
+ * RAM hash), with -H the hash of every frame too. -r writes the 2K CPU RAM
+ * of every job to <ram_prefix>_NNNN.bin. -R runs RAM-only: no picture and no sound are produced,
+ * the game runs exactly the same (final_hash is then 0).
+ */
+
+#define NES_BATCH_FRAMES        (600)
+
+static double nes_batch_main_clock(void){
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv){
+    int threads = 0;
+    uint32_t frames = NES_BATCH_FRAMES;
+    uint32_t repeat = 1;
+    int print_hashes = 0;
+    uint8_t hidden = 0;
+    const char* ram_prefix = NULL;
+    nes_batch_input_t* inputs = NULL;
+    uint32_t input_count = 0;
+    int first_rom = argc;
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "-H") == 0){
+            print_hashes = 1;
+        }else if (strcmp(argv[i], "-R") == 0){
+            hidden = NES_HIDDEN_VIDEO | NES_HIDDEN_AUDIO;
+        }else if (argv[i][0] == '-' && argv[i][1] && argv[i][2] == '\0' && i + 1 < argc){
+            const char* value = argv[++i];
+            switch (argv[i - 1][1]){
+            case 'j': threads = atoi(value); break;
+            case 'f': frames = (uint32_t)atoi(value); break;
+            case 'n': repeat = (uint32_t)atoi(value); break;
+            case 'r': ram_prefix = value; break;
+            case 'i':
+                if (nes_batch_load_inputs(value, &inputs, &input_count)){
+                    return -1;
+                }
+                break;
+            default:
+                NES_LOG_ERROR("unknown option %s\n", argv[i - 1]);
+                return -1;
+            }
+        }else{
+            first_rom = i;
+            break;
+        }
+    }
+    if (first_rom >= argc || repeat == 0){
+        printf("usage: %s [-j threads] [-f frames] [-i inputs.txt] [-n repeat] [-r ram_prefix] [-H] [-R] rom...\n", argv[0]);
+        return -1;
+    }
+
+    const size_t count = (size_t)(argc - first_rom) * repeat;
+    nes_batch_job_t* jobs = (nes_batch_job_t*)calloc(count, sizeof(nes_batch_job_t));
+    uint64_t* hashes = print_hashes ? (uint64_t*)calloc(count * frames, sizeof(uint64_t)) : NULL;
+    if (jobs == NULL || (print_hashes && hashes == NULL)){
+        NES_LOG_ERROR("out of memory\n");
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++){
+        jobs[i].rom_path = argv[first_rom + (int)(i % (size_t)(argc - first_rom))];
+        jobs[i].frames = frames;
+        jobs[i].inputs = inputs;
+        jobs[i].input_count = input_count;
+        jobs[i].frame_hashes = hashes ? hashes + i * frames : NULL;
+        jobs[i].hidden = hidden;
+    }
+
+    if (threads <= 0){
+        threads = nes_batch_cpu_count();
+    }
+    const double start = nes_batch_main_clock();
+    nes_batch_run(jobs, count, threads);
+    const double elapsed = nes_batch_main_clock() - start;
+
+    printf("job,rom,worker,status,seconds,fps,lag_frames,final_hash,ram_hash\n");
+    uint64_t total_frames = 0;
+    for (size_t i = 0; i < count; i++){
+        nes_batch_job_t* job = &jobs[i];
+        printf("%zu,%s,%d,%s,%.3f,%.0f,%u,%016llx,%016llx\n", i, job->rom_path, job->worker,
+               job->status == NES_OK ? "ok" : "fail", job->seconds,
+               job->seconds > 0 ? (double)frames / job->seconds : 0.0, (unsigned)job->lag_frames,
+               (unsigned long long)job->final_hash, (unsigned long long)nes_batch_hash(job->ram, NES_CPU_RAM_SIZE));
+        if (job->status != NES_OK){
+            continue;
+        }
+        total_frames += frames;
+        if (hashes){
+            for (uint32_t f = 0; f < frames; f++){
+                printf("  %zu,%u,%016llx\n", i, f, (unsigned long long)job->frame_hashes[f]);
+            }
+        }
+        if (ram_prefix){
+            char ram_path[1024];
+            snprintf(ram_path, sizeof(ram_path), "%s_%04zu.bin", ram_prefix, i);
+            FILE* file = fopen(ram_path, "wb");
+            if (file){
+                fwrite(job->ram, 1, NES_CPU_RAM_SIZE, file);
+                fclose(file);
+            }
+        }
+    }
+    printf("total: %zu jobs, %llu frames in %.3fs on %d threads (%.0f fps)\n", count,
+           (unsigned long long)total_frames, elapsed, threads, elapsed > 0 ? (double)total_frames / elapsed : 0.0);
+
+    free(hashes);
+    free(jobs);
+    free(inputs);
+    return 0;
+}
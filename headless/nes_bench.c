@@ -0,0 +1,161 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Core benchmark: frame time and lag frames, RAM-only frame time, the cost of run-ahead frames, then the cost of rewind capture and stepping back.
+ *
+ *   nes_bench <rom.nes> [-f frames] [-a runahead] [-r rewind_kb] [-i interval]
+ *
+ * The joypad is driven by a fixed pseudo-random pattern so games leave the title screen.
+ */
+
+#define NES_BENCH_FRAMES        (3600)
+#define NES_BENCH_REWIND_KB     (4096)
+
+static double nes_bench_clock(void){
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static inline void nes_bench_input(nes_t* nes, uint32_t frame){
+    nes->nes_cpu.joypad.joypad = (uint16_t)((frame * 0x9E37u) >> 4) & 0xF0F0;
+}
+
+int main(int argc, char** argv){
+    if (argc < 2){
+        printf("usage: %s <rom.nes> [-f frames] [-a runahead] [-r rewind_kb] [-i interval]\n", argv[0]);
+        return -1;
+    }
+    uint32_t frames = NES_BENCH_FRAMES;
+    uint32_t rewind_kb = NES_BENCH_REWIND_KB;
+    uint16_t interval = 1;
+    uint8_t runahead = 1;
+    for (int i = 2; i + 1 < argc; i += 2){
+        if (strcmp(argv[i], "-f") == 0){
+            frames = (uint32_t)atoi(argv[i + 1]);
+        }else if (strcmp(argv[i], "-a") == 0){
+            runahead = (uint8_t)atoi(argv[i + 1]);
+        }else if (strcmp(argv[i], "-r") == 0){
+            rewind_kb = (uint32_t)atoi(argv[i + 1]);
+        }else if (strcmp(argv[i], "-i") == 0){
+            interval = (uint16_t)atoi(argv[i + 1]);
+        }
+    }
+    if (interval == 0){
+        interval = 1;
+    }
+
+    nes_t* nes = nes_init();
+    if (nes == NULL || nes_load_file(nes, argv[1])){
+        NES_LOG_ERROR("nes load file fail\n");
+        return -1;
+    }
+    double start = nes_bench_clock();
+    for (uint32_t frame = 0; frame < frames; frame++){
+        nes_bench_input(nes, frame);
+        nes_step_frame(nes);
+    }
+    const double frame_us = (nes_bench_clock() - start) * 1e6 / frames;
+    printf("frame:   %8.2f us  (%.0f fps, %.1fx realtime)\n", frame_us, 1e6 / frame_us, 16639.0 / frame_us);
+    printf("lag:     %u of %u frames did not read the joypad (%.1f%%)\n", (unsigned)nes->nes_lag_count,
+           (unsigned)nes->nes_frame_count, nes->nes_frame_count ? 100.0 * nes->nes_lag_count / nes->nes_frame_count : 0.0);
+
+    // RAM-only: same emulation, no picture and no sound
+    nes_reset(nes);
+    nes->nes_hidden = NES_HIDDEN_VIDEO | NES_HIDDEN_AUDIO;
+    start = nes_bench_clock();
+    for (uint32_t frame = 0; frame < frames; frame++){
+        nes_bench_input(nes, frame);
+        nes_step_frame(nes);
+    }
+    const double ram_only_us = (nes_bench_clock() - start) * 1e6 / frames;
+    printf("ramonly: %8.2f us  (%.0f fps, %.2fx faster)\n", ram_only_us, 1e6 / ram_only_us, frame_us / ram_only_us);
+    nes->nes_hidden = 0;
+
+    if (runahead){
+        nes_reset(nes);
+        if (nes_runahead_init(nes, runahead)){
+            return -1;
+        }
+        start = nes_bench_clock();
+        for (uint32_t frame = 0; frame < frames; frame++){
+            nes_bench_input(nes, frame);
+            nes_runahead_frame(nes);
+        }
+        const double host_us = (nes_bench_clock() - start) * 1e6 / frames;
+        printf("runahead:%8.2f us  per host frame with %u frames ahead, %.2fx frame time per run-ahead frame\n",
+               host_us, (unsigned)runahead, (host_us - frame_us) / runahead / frame_us);
+        nes_runahead_deinit(nes);
+    }
+
+    // Same run again with rewind, captures timed one by one
+    nes_reset(nes);
+    if (nes_rewind_init(nes, (size_t)rewind_kb * 1024, interval)){
+        return -1;
+    }
+    nes_rewind_pause(nes, 1);
+    double capture_time = 0;
+    uint32_t captures = 0;
+    for (uint32_t frame = 0; frame < frames; frame++){
+        nes_bench_input(nes, frame);
+        nes_step_frame(nes);
+        if (frame % interval == 0){
+            start = nes_bench_clock();
+            nes_rewind_capture(nes);
+            capture_time += nes_bench_clock() - start;
+            captures++;
+        }
+    }
+    const nes_rewind_t* rewind = nes->nes_rewind;
+    const double capture_us = capture_time * 1e6 / captures;
+    printf("capture: %8.2f us  every %u frames, %.2f%% of frame time\n", capture_us, interval, capture_us / interval / frame_us * 100);
+
+    uint64_t stored = 0;
+    for (uint32_t i = 0; i < rewind->entry_count; i++){
+        stored += rewind->entries[(rewind->entry_first + i) % rewind->entry_max].size;
+    }
+    const double entry_bytes = rewind->entry_count ? (double)stored / rewind->entry_count : 0;
+    printf("history: %u entries of %.0f bytes (state %u bytes), %u KB ring holds ~%.0f s\n",
+           (unsigned)rewind->entry_count, entry_bytes, (unsigned)rewind->state_size, (unsigned)rewind_kb,
+           entry_bytes > 0 ? (double)rewind_kb * 1024 / entry_bytes * interval / 60.0 : 0.0);
+
+    uint32_t steps = 0;
+    double step_max = 0;
+    start = nes_bench_clock();
+    for (;;){
+        const double step_start = nes_bench_clock();
+        if (nes_rewind_step(nes)){
+            break;
+        }
+        const double step = nes_bench_clock() - step_start;
+        step_max = step > step_max ? step : step_max;
+        steps++;
+    }
+    if (steps){
+        printf("rewind:  %8.2f us  per step (max %.2f us), %u steps\n",
+               (nes_bench_clock() - start) * 1e6 / steps, step_max * 1e6, (unsigned)steps);
+    }
+
+    nes_unload_file(nes);
+    nes_deinit(nes);
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes_batch.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Input movies as reproducible benchmarks and regression tests.
+ *
+ *   nes_movie record <rom.nes> <out.nmv> [-f frames] [-i inputs.txt] [-H] [-l hashes.log]
+ *   nes_movie play <rom.nes> <in.nmv> [-n repeat] [-l hashes.log]
+ *
+ * record runs from power-on with scripted inputs (nes_batch_run format) and stores the hashes of
+ * every frame unless -H. play replays unthrottled, checks every frame and prints the speed;
+ * the exit code is non-zero when a frame does not match. -l writes the picture/RAM/VRAM hashes
+ * of every frame, one line per frame, so runs can be compared without keeping any frame. Movies recorded by the SDL ports
+ * (nes xxx.nes movie.nmv) play the same way.
+ */
+
+#define NES_MOVIE_FRAMES        (3600)
+
+static double nes_movie_clock(void){
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int nes_movie_main_record(nes_t* nes, const char* movie_path, uint32_t frames,
+                                 const nes_batch_input_t* inputs, uint32_t input_count, uint8_t flags){
+    if (nes_movie_record(nes, flags)){
+        return -1;
+    }
+    if (nes->nes_frame_hash.log){
+        nes_frame_hash_enable(nes, 1);
+    }
+    uint32_t next_input = 0;
+    for (uint32_t frame = 0; frame < frames; frame++){
+        while (next_input < input_count && inputs[next_input].frame <= frame){
+            nes->nes_cpu.joypad.joypad = inputs[next_input++].joypad;
+        }
+        nes_step_frame(nes);
+    }
+    if (nes_movie_save_file(nes, movie_path)){
+        NES_LOG_ERROR("failed to write %s\n", movie_path);
+        return -1;
+    }
+    printf("%s: %u frames recorded\n", movie_path, (unsigned)nes->nes_movie->frame_count);
+    return 0;
+}
+
+static int nes_movie_main_play(nes_t* nes, const char* movie_path, uint32_t repeat){
+    if (nes_movie_load_file(nes, movie_path)){
+        return -1;
+    }
+    const nes_movie_t* movie = nes->nes_movie;
+    int ret = 0;
+    for (uint32_t run = 0; run < repeat; run++){
+        nes_movie_play(nes);
+        if (nes->nes_frame_hash.log){
+            nes_frame_hash_enable(nes, 1);
+        }
+        const double start = nes_movie_clock();
+        while (movie->mode == NES_MOVIE_PLAY){
+            nes_step_frame(nes);
+        }
+        const double seconds = nes_movie_clock() - start;
+        printf("%s: %u frames in %.3f s, %.0f fps (%.1fx realtime)", movie_path, (unsigned)movie->frame_count,
+               seconds, movie->frame_count / seconds, movie->frame_count / seconds / 60.0988);
+        if (movie->mismatch_frame != NES_MOVIE_NO_MISMATCH){
+            printf(", MISMATCH at frame %u\n", (unsigned)movie->mismatch_frame);
+            ret = 1;
+        }else{
+            printf((movie->flags & NES_MOVIE_HASH) ? ", all frames match\n" : ", no hashes recorded\n");
+        }
+    }
+    return ret;
+}
+
+int main(int argc, char** argv){
+    if (argc < 4 || (strcmp(argv[1], "record") && strcmp(argv[1], "play"))){
+        printf("usage: %s record <rom.nes> <out.nmv> [-f frames] [-i inputs.txt] [-H] [-l hashes.log]\n"
+               "       %s play <rom.nes> <in.nmv> [-n repeat] [-l hashes.log]\n", argv[0], argv[0]);
+        return -1;
+    }
+    uint32_t frames = NES_MOVIE_FRAMES;
+    uint32_t repeat = 1;
+    uint8_t flags = NES_MOVIE_HASH;
+    const char* log_path = NULL;
+    nes_batch_input_t* inputs = NULL;
+    uint32_t input_count = 0;
+    for (int i = 4; i < argc; i++){
+        if (strcmp(argv[i], "-H") == 0){
+            flags &= (uint8_t)~NES_MOVIE_HASH;
+        }else if (argv[i][0] == '-' && argv[i][1] && argv[i][2] == '\0' && i + 1 < argc){
+            const char* value = argv[++i];
+            switch (argv[i - 1][1]){
+            case 'f': frames = (uint32_t)atoi(value); break;
+            case 'n': repeat = (uint32_t)atoi(value); break;
+            case 'l': log_path = value; break;
+            case 'i':
+                if (nes_batch_load_inputs(value, &inputs, &input_count)){
+                    return -1;
+                }
+                break;
+            default:
+                NES_LOG_ERROR("unknown option %s\n", argv[i - 1]);
+                return -1;
+            }
+        }else{
+            NES_LOG_ERROR("unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    nes_t* nes = nes_init();
+    if (nes == NULL || nes_load_file(nes, argv[2])){
+        NES_LOG_ERROR("nes load file fail\n");
+        return -1;
+    }
+    if (log_path && nes_frame_hash_log(nes, log_path)){
+        return -1;
+    }
+    int ret;
+    if (strcmp(argv[1], "record") == 0){
+        ret = nes_movie_main_record(nes, argv[3], frames, inputs, input_count, flags);
+    }else{
+        ret = nes_movie_main_play(nes, argv[3], repeat);
+    }
+    free(inputs);
+    nes_unload_file(nes);
+    nes_deinit(nes);
+    return ret;
+}
@@ -0,0 +1,349 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE                     /* struct sockaddr_in, inet_pton with -std=c11 */
+#endif
+
+#include "nes_netplay.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * Packet, little-endian:
+ *   magic u32 | first u32 | ack u32 | hash_count u32 | hash u64 | count u8 | count inputs u8
+ * `first` is the frame of the first input, `ack` tells the remote which of its inputs arrived,
+ * `hash` is the CPU RAM hash of frame hash_count - 1.
+ *
+ * A frame's snapshot is taken right before it runs, with the hash of its CPU RAM. The hash becomes
+ * final once every input before the frame is confirmed: then it can no longer be rolled back.
+ */
+
+#define NES_NETPLAY_MAGIC           (0x4C504E4E)    /* "NNPL" */
+#define NES_NETPLAY_HEADER          (25)
+#define NES_NETPLAY_PACKET_MAX      (NES_NETPLAY_HEADER + NES_NETPLAY_WINDOW)
+#define NES_NETPLAY_HELD            (256)           /*  Packets the simulated network holds at once */
+#define NES_NETPLAY_NONE            (0xFFFFFFFF)
+
+typedef struct {
+    uint32_t release;                       /*  Tick the packet is sent at */
+    uint16_t size;
+    uint8_t data[NES_NETPLAY_PACKET_MAX];
+} nes_netplay_packet_t;
+
+struct nes_netplay_link{
+    int fd;
+    struct sockaddr_in remote;
+    uint32_t tick;                          /*  Host frames so far */
+    uint32_t random;
+    nes_netplay_packet_t held[NES_NETPLAY_HELD];
+    uint32_t held_count;
+};
+
+static double nes_netplay_clock(void){
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static inline void nes_netplay_put32(uint8_t* p, uint32_t value){
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+static inline uint32_t nes_netplay_get32(const uint8_t* p){
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t nes_netplay_random(struct nes_netplay_link* link){
+    // xorshift32
+    link->random ^= link->random << 13;
+    link->random ^= link->random >> 17;
+    link->random ^= link->random << 5;
+    return link->random;
+}
+
+static void nes_netplay_link_close(struct nes_netplay_link* link){
+    if (link->fd >= 0){
+        close(link->fd);
+    }
+    free(link);
+}
+
+static struct nes_netplay_link* nes_netplay_link_open(const nes_netplay_config_t* config){
+    struct nes_netplay_link* link = (struct nes_netplay_link*)calloc(1, sizeof(struct nes_netplay_link));
+    if (link == NULL){
+        return NULL;
+    }
+    link->random = config->seed ? config->seed : 0x9E3779B9;
+    link->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in local = {0};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(config->local_port);
+    link->remote.sin_family = AF_INET;
+    link->remote.sin_port = htons(config->remote_port);
+    if (link->fd < 0 || fcntl(link->fd, F_SETFL, fcntl(link->fd, F_GETFL, 0) | O_NONBLOCK) < 0
+        || bind(link->fd, (struct sockaddr*)&local, sizeof(local)) < 0
+        || inet_pton(AF_INET, config->remote_host ? config->remote_host : "127.0.0.1", &link->remote.sin_addr) != 1){
+        NES_LOG_ERROR("nes_netplay: can not open UDP port %u (errno %d)\n", (unsigned)config->local_port, errno);
+        nes_netplay_link_close(link);
+        return NULL;
+    }
+    return link;
+}
+
+static void nes_netplay_link_send(nes_netplay_t* netplay, const uint8_t* data, uint16_t size){
+    struct nes_netplay_link* link = netplay->link;
+    const nes_netplay_config_t* config = &netplay->config;
+    if (config->loss > 0 && (nes_netplay_random(link) >> 8) < (uint32_t)(config->loss * (1 << 24))){
+        netplay->stats.packets_lost++;
+        return;
+    }
+    if (config->latency == 0 && config->jitter == 0){
+        sendto(link->fd, data, size, 0, (struct sockaddr*)&link->remote, sizeof(link->remote));
+        return;
+    }
+    if (link->held_count == NES_NETPLAY_HELD){
+        netplay->stats.packets_lost++;
+        return;
+    }
+    nes_netplay_packet_t* packet = &link->held[link->held_count++];
+    packet->release = link->tick + config->latency + (config->jitter ? nes_netplay_random(link) % (config->jitter + 1) : 0);
+    packet->size = size;
+    nes_memcpy(packet->data, data, size);
+}
+
+// Once per host frame: sends the held packets that are due
+static void nes_netplay_link_tick(struct nes_netplay_link* link){
+    link->tick++;
+    for (uint32_t i = 0; i < link->held_count;){
+        nes_netplay_packet_t* packet = &link->held[i];
+        if ((int32_t)(link->tick - packet->release) < 0){
+            i++;
+            continue;
+        }
+        sendto(link->fd, packet->data, packet->size, 0, (struct sockaddr*)&link->remote, sizeof(link->remote));
+        *packet = link->held[--link->held_count];
+    }
+}
+
+static inline uint32_t nes_netplay_slots(const nes_netplay_t* netplay){
+    return (uint32_t)netplay->config.rollback + 1;
+}
+
+static void nes_netplay_send(nes_netplay_t* netplay){
+    uint8_t packet[NES_NETPLAY_PACKET_MAX];
+    uint32_t first = netplay->remote_acked;
+    if (netplay->local_count - first > NES_NETPLAY_WINDOW){
+        first = netplay->local_count - NES_NETPLAY_WINDOW;
+    }
+    const uint8_t count = (uint8_t)(netplay->local_count - first);
+    const uint64_t hash = netplay->hash_count ? netplay->hashes[(netplay->hash_count - 1) % NES_NETPLAY_RING] : 0;
+    nes_netplay_put32(packet, NES_NETPLAY_MAGIC);
+    nes_netplay_put32(packet + 4, first);
+    nes_netplay_put32(packet + 8, netplay->remote_count);
+    nes_netplay_put32(packet + 12, netplay->hash_count);
+    nes_netplay_put32(packet + 16, (uint32_t)hash);
+    nes_netplay_put32(packet + 20, (uint32_t)(hash >> 32));
+    packet[24] = count;
+    for (uint8_t i = 0; i < count; i++){
+        packet[NES_NETPLAY_HEADER + i] = netplay->local[(first + i) % NES_NETPLAY_RING];
+    }
+    netplay->stats.packets_sent++;
+    nes_netplay_link_send(netplay, packet, (uint16_t)(NES_NETPLAY_HEADER + count));
+}
+
+static void nes_netplay_check_hash(nes_netplay_t* netplay, uint32_t hash_count, uint64_t hash){
+    if (hash_count == 0 || hash_count <= netplay->hash_checked || hash_count > netplay->hash_count
+        || netplay->hash_count - hash_count >= NES_NETPLAY_RING){
+        return;
+    }
+    netplay->hash_checked = hash_count;
+    if (netplay->hashes[(hash_count - 1) % NES_NETPLAY_RING] != hash){
+        if (netplay->stats.desyncs++ == 0){
+            netplay->stats.desync_frame = hash_count - 1;
+            NES_LOG_ERROR("nes_netplay: desync at frame %u\n", (unsigned)(hash_count - 1));
+        }
+    }
+}
+
+static void nes_netplay_receive(nes_netplay_t* netplay){
+    uint8_t packet[NES_NETPLAY_PACKET_MAX + 1];
+    for (;;){
+        const ssize_t size = recv(netplay->link->fd, packet, sizeof(packet), 0);
+        if (size < 0){
+            break;
+        }
+        if (size < NES_NETPLAY_HEADER || nes_netplay_get32(packet) != NES_NETPLAY_MAGIC
+            || size != NES_NETPLAY_HEADER + packet[24]){
+            continue;
+        }
+        netplay->stats.packets_received++;
+        const uint32_t first = nes_netplay_get32(packet + 4);
+        const uint32_t ack = nes_netplay_get32(packet + 8);
+        if (ack > netplay->remote_acked && ack <= netplay->local_count){
+            netplay->remote_acked = ack;
+        }
+        // Only the next missing input and those after it, they always arrive in one piece
+        for (uint32_t frame = netplay->remote_count; frame >= first && frame < first + packet[24]; frame++){
+            const uint8_t input = packet[NES_NETPLAY_HEADER + frame - first];
+            netplay->remote[frame % NES_NETPLAY_RING] = input;
+            if (frame < netplay->frame && netplay->used[frame % NES_NETPLAY_RING] != input && frame < netplay->rollback_frame){
+                netplay->rollback_frame = frame;
+            }
+            netplay->remote_count = frame + 1;
+        }
+        nes_netplay_check_hash(netplay, nes_netplay_get32(packet + 12),
+                               (uint64_t)nes_netplay_get32(packet + 16) | ((uint64_t)nes_netplay_get32(packet + 20) << 32));
+    }
+}
+
+// Snapshot, then one frame with the local input and the known or predicted remote input
+static int nes_netplay_run(nes_netplay_t* netplay, uint8_t hidden){
+    nes_t* nes = netplay->nes;
+    const uint32_t frame = netplay->frame;
+    const uint32_t slot = frame % nes_netplay_slots(netplay);
+    nes_state_save(nes, netplay->states + slot * netplay->state_size, netplay->state_size);
+    netplay->state_hashes[slot] = nes_hash64(nes->nes_cpu.cpu_ram, sizeof(nes->nes_cpu.cpu_ram), 0);
+
+    uint8_t remote = 0;
+    if (frame < netplay->remote_count){
+        remote = netplay->remote[frame % NES_NETPLAY_RING];
+    }else if (netplay->remote_count){
+        remote = netplay->remote[(netplay->remote_count - 1) % NES_NETPLAY_RING];
+    }
+    netplay->used[frame % NES_NETPLAY_RING] = remote;
+    const uint8_t local = netplay->local[frame % NES_NETPLAY_RING];
+    nes->nes_cpu.joypad.joypad = netplay->config.player == 0 ? (uint16_t)(local << 8 | remote) : (uint16_t)(remote << 8 | local);
+
+    const uint8_t nes_hidden = nes->nes_hidden;
+    nes->nes_hidden = nes_hidden | hidden;
+    const int status = nes_step_frame(nes);
+    nes->nes_hidden = nes_hidden;
+    netplay->frame++;
+    return status;
+}
+
+static void nes_netplay_rollback(nes_netplay_t* netplay){
+    const uint32_t target = netplay->frame;
+    const uint32_t first = netplay->rollback_frame;
+    netplay->rollback_frame = NES_NETPLAY_NONE;
+    if (target - first > netplay->config.rollback){
+        NES_LOG_ERROR("nes_netplay: frame %u is too old to roll back\n", (unsigned)first);
+        return;
+    }
+    const double start = nes_netplay_clock();
+    nes_state_load(netplay->nes, netplay->states + (first % nes_netplay_slots(netplay)) * netplay->state_size, netplay->state_size);
+    netplay->frame = first;
+    while (netplay->frame < target){
+        nes_netplay_run(netplay, NES_HIDDEN_VIDEO | NES_HIDDEN_AUDIO | NES_HIDDEN_SPECULATIVE);
+    }
+    const double time = nes_netplay_clock() - start;
+    nes_netplay_stats_t* stats = &netplay->stats;
+    stats->rollbacks++;
+    stats->resim_frames += target - first;
+    stats->resim_max = target - first > stats->resim_max ? target - first : stats->resim_max;
+    stats->resim_time += time;
+    stats->resim_time_max = time > stats->resim_time_max ? time : stats->resim_time_max;
+}
+
+// Hashes of the snapshots that can no longer be rolled back
+static void nes_netplay_confirm(nes_netplay_t* netplay){
+    while (netplay->hash_count < netplay->frame && netplay->hash_count <= netplay->remote_count
+           && netplay->hash_count <= netplay->rollback_frame){
+        netplay->hashes[netplay->hash_count % NES_NETPLAY_RING] = netplay->state_hashes[netplay->hash_count % nes_netplay_slots(netplay)];
+        netplay->hash_count++;
+    }
+}
+
+static void nes_netplay_sync(nes_netplay_t* netplay){
+    nes_netplay_link_tick(netplay->link);
+    nes_netplay_receive(netplay);
+    if (netplay->rollback_frame != NES_NETPLAY_NONE){
+        nes_netplay_rollback(netplay);
+    }
+    nes_netplay_confirm(netplay);
+}
+
+nes_netplay_t* nes_netplay_create(nes_t* nes, const nes_netplay_config_t* config){
+    if (config->player > 1 || config->rollback == 0 || config->rollback > NES_NETPLAY_ROLLBACK_MAX || config->delay > 8){
+        NES_LOG_ERROR("nes_netplay_create: player 0-1, rollback 1-%d and delay 0-8\n", NES_NETPLAY_ROLLBACK_MAX);
+        return NULL;
+    }
+    nes_netplay_t* netplay = (nes_netplay_t*)calloc(1, sizeof(nes_netplay_t));
+    if (netplay == NULL){
+        return NULL;
+    }
+    netplay->nes = nes;
+    netplay->config = *config;
+    netplay->local_count = config->delay;   // The first `delay` frames run without local input
+    netplay->rollback_frame = NES_NETPLAY_NONE;
+    netplay->stats.desync_frame = NES_NETPLAY_NONE;
+    netplay->state_size = nes_state_size(nes);
+    netplay->states = (uint8_t*)malloc(netplay->state_size * nes_netplay_slots(netplay) + 1);
+    if (netplay->state_size == 0 || netplay->states == NULL){
+        NES_LOG_ERROR("nes_netplay_create: state can not be captured\n");
+        nes_netplay_destroy(netplay);
+        return NULL;
+    }
+    netplay->link = nes_netplay_link_open(config);
+    if (netplay->link == NULL){
+        nes_netplay_destroy(netplay);
+        return NULL;
+    }
+    return netplay;
+}
+
+void nes_netplay_destroy(nes_netplay_t* netplay){
+    if (netplay == NULL){
+        return;
+    }
+    if (netplay->link){
+        nes_netplay_link_close(netplay->link);
+    }
+    free(netplay->states);
+    free(netplay);
+}
+
+int nes_netplay_frame(nes_netplay_t* netplay, uint8_t buttons){
+    nes_netplay_sync(netplay);
+    if (netplay->frame >= netplay->remote_count + netplay->config.rollback){
+        netplay->stats.stalls++;
+        nes_netplay_send(netplay);
+        return NES_NETPLAY_STALLED;
+    }
+    netplay->local[netplay->local_count % NES_NETPLAY_RING] = buttons;
+    netplay->local_count++;
+    nes_netplay_send(netplay);
+    const int status = nes_netplay_run(netplay, 0);
+    netplay->stats.frames++;
+    nes_netplay_confirm(netplay);
+    return status;
+}
+
+void nes_netplay_poll(nes_netplay_t* netplay){
+    nes_netplay_sync(netplay);
+    nes_netplay_send(netplay);
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "nes.h"
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#define NES_NETPLAY_RING            (128)       /*  Frames of inputs and hashes kept, power of two */
+#define NES_NETPLAY_ROLLBACK_MAX    (16)        /*  Most frames one peer may run ahead of the other */
+#define NES_NETPLAY_WINDOW          (64)        /*  Most inputs per packet */
+
+#define NES_NETPLAY_STALLED         (1 << 8)    /*  nes_netplay_frame(): waited for the remote, no frame ran */
+
+/*
+    Two-player rollback netplay. Every host frame the local buttons (A B Select Start Up Down Left
+    Right, bit 7 to 0) are sent with all inputs the remote has not acknowledged yet, so a lost packet
+    is covered by the next one. Missing remote input is predicted by repeating the last one received.
+    When a prediction turns out wrong, the state at the first wrong frame is loaded and every frame
+    since is run again hidden (no picture, no sound) before the next frame is shown. A peer stops
+    when it is `rollback` frames ahead of the last remote input it has.
+    Both peers hash CPU RAM at every frame whose inputs are all confirmed and exchange the newest
+    hash to detect desyncs.
+*/
+typedef struct {
+    uint8_t player;                         /*  0: port 1, 1: port 2 */
+    uint8_t delay;                          /*  Local input delay in frames, fewer rollbacks for more latency */
+    uint8_t rollback;                       /*  1 - NES_NETPLAY_ROLLBACK_MAX */
+    uint16_t local_port;
+    const char* remote_host;                /*  IPv4 address */
+    uint16_t remote_port;
+    /*  Simulated network, applied to sent packets, e.g. by the loopback harness */
+    uint32_t latency;                       /*  Host frames a packet is held */
+    uint32_t jitter;                        /*  Up to this many frames more, packets may overtake each other */
+    float loss;                             /*  Share of packets dropped, 0 - 1 */
+    uint32_t seed;
+} nes_netplay_config_t;
+
+typedef struct {
+    uint32_t frames;                        /*  Frames shown */
+    uint32_t stalls;                        /*  Host frames spent waiting for the remote */
+    uint32_t rollbacks;                     /*  Wrong predictions */
+    uint64_t resim_frames;                  /*  Frames run again */
+    uint32_t resim_max;                     /*  Most frames run again in one host frame */
+    double resim_time;                      /*  Seconds spent loading states and running frames again */
+    double resim_time_max;                  /*  Longest rollback */
+    uint32_t packets_sent;
+    uint32_t packets_received;
+    uint32_t packets_lost;                  /*  Dropped by the simulated network */
+    uint32_t desyncs;                       /*  Remote hashes that differed from ours */
+    uint32_t desync_frame;                  /*  First one, UINT32_MAX when none */
+} nes_netplay_stats_t;
+
+struct nes_netplay_link;
+
+typedef struct nes_netplay{
+    nes_t* nes;
+    nes_netplay_config_t config;
+    uint32_t frame;                         /*  Next frame to run */
+    uint32_t local_count;                   /*  Local inputs known for frames 0 .. local_count - 1 */
+    uint32_t remote_count;                  /*  Remote inputs received for frames 0 .. remote_count - 1 */
+    uint32_t remote_acked;                  /*  The remote has our inputs for frames 0 .. remote_acked - 1 */
+    uint32_t rollback_frame;                /*  First mispredicted frame, UINT32_MAX when none */
+    uint8_t local[NES_NETPLAY_RING];
+    uint8_t remote[NES_NETPLAY_RING];
+    uint8_t used[NES_NETPLAY_RING];         /*  Remote input each frame was last run with */
+    uint64_t hashes[NES_NETPLAY_RING];      /*  CPU RAM at the start of each confirmed frame */
+    uint32_t hash_count;                    /*  Hashes known for frames 0 .. hash_count - 1 */
+    uint32_t hash_checked;                  /*  Frames up to this one were compared with the remote */
+    size_t state_size;
+    uint8_t* states;                        /*  (rollback + 1) snapshots, frame f in slot f % (rollback + 1) */
+    uint64_t state_hashes[NES_NETPLAY_ROLLBACK_MAX + 1];    /*  CPU RAM hash of each snapshot */
+    nes_netplay_stats_t stats;
+    struct nes_netplay_link* link;
+} nes_netplay_t;
+
+/* Both peers must start from the same state, e.g. right after loading the ROM */
+nes_netplay_t* nes_netplay_create(nes_t* nes, const nes_netplay_config_t* config);
+void nes_netplay_destroy(nes_netplay_t* netplay);
+/* One host frame: exchanges inputs, rolls back if needed and runs the next frame. nes_step_* flags or NES_NETPLAY_STALLED */
+int nes_netplay_frame(nes_netplay_t* netplay, uint8_t buttons);
+/* A host frame without running a frame (paused, or done): keeps exchanging inputs and hashes */
+void nes_netplay_poll(nes_netplay_t* netplay);
+
+#ifdef __cplusplus
+    }
+#endif
@@ -0,0 +1,158 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes_netplay.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Loopback netplay harness: two peers in one process talk over UDP on 127.0.0.1 through a simulated
+ * network, each host frame runs one frame on both. Every player holds pseudo-random buttons for a
+ * few frames at a time. At the end both peers must have the same CPU RAM.
+ *
+ *   nes_netplay_run <rom.nes> [-f frames] [-l latency_ms] [-j jitter_ms] [-p loss_percent]
+ *                   [-r rollback] [-d delay] [-P port]
+ */
+
+#define NES_NETPLAY_MAIN_FRAMES     (3600)
+#define NES_NETPLAY_MAIN_FPS        (60.0988)
+
+static double nes_netplay_main_clock(void){
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Buttons held for 4 - 19 frames, different for each player
+static uint8_t nes_netplay_main_buttons(uint32_t* random, uint32_t* hold, uint8_t* buttons){
+    if (*hold == 0){
+        *random = *random * 1664525u + 1013904223u;
+        *hold = 4 + ((*random >> 12) & 15);
+        *buttons = (uint8_t)(*random >> 24) & 0xCF;   // No Select or Start
+        if (((*random >> 8) & 15) == 0){
+            *buttons |= 0x10;
+        }
+    }
+    (*hold)--;
+    return *buttons;
+}
+
+int main(int argc, char** argv){
+    if (argc < 2){
+        printf("usage: %s <rom.nes> [-f frames] [-l latency_ms] [-j jitter_ms] [-p loss_percent] [-r rollback] [-d delay] [-P port]\n", argv[0]);
+        return -1;
+    }
+    uint32_t frames = NES_NETPLAY_MAIN_FRAMES;
+    double latency_ms = 50, jitter_ms = 10, loss = 5;
+    int rollback = 8, delay = 1, port = 27910;
+    for (int i = 2; i + 1 < argc; i += 2){
+        if (strcmp(argv[i], "-f") == 0){
+            frames = (uint32_t)atoi(argv[i + 1]);
+        }else if (strcmp(argv[i], "-l") == 0){
+            latency_ms = atof(argv[i + 1]);
+        }else if (strcmp(argv[i], "-j") == 0){
+            jitter_ms = atof(argv[i + 1]);
+        }else if (strcmp(argv[i], "-p") == 0){
+            loss = atof(argv[i + 1]);
+        }else if (strcmp(argv[i], "-r") == 0){
+            rollback = atoi(argv[i + 1]);
+        }else if (strcmp(argv[i], "-d") == 0){
+            delay = atoi(argv[i + 1]);
+        }else if (strcmp(argv[i], "-P") == 0){
+            port = atoi(argv[i + 1]);
+        }
+    }
+
+    nes_t* nes[2] = {NULL, NULL};
+    nes_netplay_t* peers[2] = {NULL, NULL};
+    for (int p = 0; p < 2; p++){
+        nes[p] = nes_init();
+        if (nes[p] == NULL || nes_load_file(nes[p], argv[1])){
+            NES_LOG_ERROR("nes load file fail\n");
+            return -1;
+        }
+        // One way latency in host frames, a frame is ~16.6 ms
+        const nes_netplay_config_t config = {
+            .player = (uint8_t)p,
+            .delay = (uint8_t)delay,
+            .rollback = (uint8_t)rollback,
+            .local_port = (uint16_t)(port + p),
+            .remote_host = "127.0.0.1",
+            .remote_port = (uint16_t)(port + 1 - p),
+            .latency = (uint32_t)(latency_ms * NES_NETPLAY_MAIN_FPS / 1000 + 0.5),
+            .jitter = (uint32_t)(jitter_ms * NES_NETPLAY_MAIN_FPS / 1000 + 0.5),
+            .loss = (float)(loss / 100),
+            .seed = 0x12345u + (uint32_t)p,
+        };
+        peers[p] = nes_netplay_create(nes[p], &config);
+        if (peers[p] == NULL){
+            return -1;
+        }
+    }
+
+    uint32_t random[2] = {1, 2}, hold[2] = {0, 0};
+    uint8_t buttons[2] = {0, 0};
+    double host_time[2] = {0, 0};
+    uint32_t ticks = 0;
+    const double start = nes_netplay_main_clock();
+    while (peers[0]->stats.frames < frames || peers[1]->stats.frames < frames){
+        for (int p = 0; p < 2; p++){
+            const double frame_start = nes_netplay_main_clock();
+            if (peers[p]->stats.frames < frames){
+                nes_netplay_frame(peers[p], nes_netplay_main_buttons(&random[p], &hold[p], &buttons[p]));
+            }else{
+                nes_netplay_poll(peers[p]);
+            }
+            host_time[p] += nes_netplay_main_clock() - frame_start;
+        }
+        ticks++;
+    }
+    const double elapsed = nes_netplay_main_clock() - start;
+    // Let the last inputs arrive so both end on confirmed frames
+    for (uint32_t i = 0; i < 1000 && (peers[0]->remote_count < frames || peers[1]->remote_count < frames
+                                      || peers[0]->hash_checked < frames || peers[1]->hash_checked < frames); i++){
+        nes_netplay_poll(peers[0]);
+        nes_netplay_poll(peers[1]);
+    }
+
+    printf("%u frames in %u host frames (%.1f s), latency %.0f ms +%.0f ms jitter, %.1f%% loss, rollback %d, delay %d\n",
+           (unsigned)frames, (unsigned)ticks, elapsed, latency_ms, jitter_ms, loss, rollback, delay);
+    for (int p = 0; p < 2; p++){
+        const nes_netplay_stats_t* stats = &peers[p]->stats;
+        const double frame_us = (host_time[p] - stats->resim_time) / (stats->frames ? stats->frames : 1) * 1e6;
+        const double resim_us = stats->resim_frames ? stats->resim_time / stats->resim_frames * 1e6 : 0;
+        printf("peer %d: %u stalls, %u rollbacks, %llu frames re-run (%.2f per rollback, max %u)\n", p, (unsigned)stats->stalls,
+               (unsigned)stats->rollbacks, (unsigned long long)stats->resim_frames,
+               stats->rollbacks ? (double)stats->resim_frames / stats->rollbacks : 0.0, (unsigned)stats->resim_max);
+        printf("        frame %.1f us, re-run frame %.1f us (%.2fx), rollback max %.1f us (%.1f%% of a 16.6 ms frame)\n",
+               frame_us, resim_us, frame_us > 0 ? resim_us / frame_us : 0.0, stats->resim_time_max * 1e6,
+               stats->resim_time_max * 1e6 / 16639.0 * 100);
+        printf("        packets %u sent, %u received, %u lost, %u desyncs\n", (unsigned)stats->packets_sent,
+               (unsigned)stats->packets_received, (unsigned)stats->packets_lost, (unsigned)stats->desyncs);
+    }
+    const int same = peers[0]->frame == peers[1]->frame && peers[0]->hash_count == peers[1]->hash_count
+                     && memcmp(nes[0]->nes_cpu.cpu_ram, nes[1]->nes_cpu.cpu_ram, sizeof(nes[0]->nes_cpu.cpu_ram)) == 0
+                     && peers[0]->stats.desyncs == 0 && peers[1]->stats.desyncs == 0;
+    printf("%s at frame %u\n", same ? "in sync" : "DESYNC", (unsigned)peers[0]->frame);
+
+    for (int p = 0; p < 2; p++){
+        nes_netplay_destroy(peers[p]);
+        nes_unload_file(nes[p]);
+        nes_deinit(nes[p]);
+    }
+    return same ? 0 : 1;
+}
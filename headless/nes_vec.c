@@ -0,0 +1,323 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes_vec.h"
+#include "nes_batch.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+/*
+ * Persistent pool: every nes_vec_step() bumps `generation`, then the workers and the caller take
+ * instances one at a time until all are stepped. A step is short (k frames of one instance), so the
+ * threads stay alive between steps instead of being started per call.
+ *
+ * Of the k frames of a step only the last one renders, straight into the downsampled observation
+ * (nes_obs); the others run RAM-only. Audio is never mixed.
+ */
+
+struct nes_vec_pool{
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    pthread_t* threads;
+    int thread_count;                       /*  Workers besides the caller */
+    int busy;                               /*  Workers still in the current step */
+    int quit;
+    uint32_t generation;
+    size_t next;                            /*  Next instance to step */
+    const uint16_t* actions;
+    uint32_t k;
+};
+
+static int64_t nes_vec_probe_read(nes_t* nes, const nes_vec_probe_t* probe){
+    int64_t value = 0;
+    for (uint8_t i = 0; i < probe->bytes; i++){
+        const uint16_t address = (uint16_t)(probe->address + i);
+        uint8_t byte = 0;
+        if (address < 0x2000){
+            byte = nes->nes_cpu.cpu_ram[address & (NES_CPU_RAM_SIZE - 1)];
+        }else if (address >= 0x6000 && address < 0x8000 && nes->nes_rom.sram){
+            byte = nes->nes_rom.sram[address - 0x6000];
+        }
+        switch (probe->encoding){
+        case NES_VEC_DIGITS:
+            value = value * 10 + byte;
+            break;
+        case NES_VEC_BCD:
+            value = value * 100 + (byte >> 4) * 10 + (byte & 0x0F);
+            break;
+        default:
+            value |= (int64_t)byte << (8 * i);
+            break;
+        }
+    }
+    return value;
+}
+
+static void nes_vec_reset_one(nes_vec_t* envs, size_t i){
+    nes_t* nes = envs->envs[i];
+    nes_state_load(nes, envs->start_state, envs->state_size);
+    nes_memcpy(envs->obs + i * envs->obs_size, envs->start_obs, envs->obs_size);
+    envs->frames[i] = 0;
+    int64_t* values = envs->values + i * envs->config.probe_count;
+    for (uint32_t p = 0; p < envs->config.probe_count; p++){
+        values[p] = nes_vec_probe_read(nes, &envs->probes[p]);
+    }
+}
+
+static void nes_vec_step_one(nes_vec_t* envs, size_t i, uint16_t action, uint32_t k){
+    nes_t* nes = envs->envs[i];
+    int64_t* values = envs->values + i * envs->config.probe_count;
+    float reward = 0;
+    uint8_t done = 0;
+    nes->nes_cpu.joypad.joypad = action;
+    for (uint32_t frame = 0; frame < k && done == 0; frame++){
+        nes->nes_hidden = frame + 1 < k ? (NES_HIDDEN_VIDEO | NES_HIDDEN_AUDIO) : NES_HIDDEN_AUDIO;
+        nes_step_frame(nes);
+        envs->frames[i]++;
+        for (uint32_t p = 0; p < envs->config.probe_count; p++){
+            const nes_vec_probe_t* probe = &envs->probes[p];
+            const int64_t value = nes_vec_probe_read(nes, probe);
+            if (probe->kind == NES_VEC_PROBE_REWARD){
+                reward += (float)(value - values[p]) * probe->scale;
+                values[p] = value;
+            }else if ((((uint32_t)value & probe->mask) == probe->target) == (probe->kind == NES_VEC_PROBE_DONE_EQ)){
+                done = NES_VEC_TERMINATED;
+            }
+        }
+        if (done == 0 && envs->config.max_frames && envs->frames[i] >= envs->config.max_frames){
+            done = NES_VEC_TRUNCATED;
+        }
+    }
+    envs->rewards[i] = reward;
+    envs->dones[i] = done;
+    if (done){
+        nes_vec_reset_one(envs, i);
+    }else{
+        nes_memcpy(envs->obs + i * envs->obs_size, nes->nes_obs->data, envs->obs_size);
+    }
+}
+
+static void nes_vec_drain(nes_vec_t* envs){
+    struct nes_vec_pool* pool = envs->pool;
+    for (;;){
+        pthread_mutex_lock(&pool->lock);
+        const size_t i = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        if (i >= envs->count){
+            break;
+        }
+        nes_vec_step_one(envs, i, pool->actions[i], pool->k);
+    }
+}
+
+static void* nes_vec_worker(void* arg){
+    nes_vec_t* envs = (nes_vec_t*)arg;
+    struct nes_vec_pool* pool = envs->pool;
+    uint32_t generation = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;){
+        while (pool->generation == generation && pool->quit == 0){
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->quit){
+            break;
+        }
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        nes_vec_drain(envs);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0){
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static int nes_vec_pool_start(nes_vec_t* envs, int threads){
+    struct nes_vec_pool* pool = (struct nes_vec_pool*)calloc(1, sizeof(struct nes_vec_pool));
+    if (pool == NULL){
+        return NES_ERROR;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    envs->pool = pool;
+    if (threads > 1){
+        pool->threads = (pthread_t*)calloc((size_t)threads - 1, sizeof(pthread_t));
+        for (int t = 0; pool->threads && t < threads - 1; t++){
+            if (pthread_create(&pool->threads[t], NULL, nes_vec_worker, envs)){
+                break;          // Fewer workers, the caller picks up the rest
+            }
+            pool->thread_count++;
+        }
+    }
+    return NES_OK;
+}
+
+static void nes_vec_pool_stop(nes_vec_t* envs){
+    struct nes_vec_pool* pool = envs->pool;
+    if (pool == NULL){
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int t = 0; t < pool->thread_count; t++){
+        pthread_join(pool->threads[t], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool);
+    envs->pool = NULL;
+}
+
+nes_vec_t* nes_vec_create(const char* rom_path, size_t count, const nes_vec_config_t* config){
+    if (count == 0 || config == NULL){
+        return NULL;
+    }
+    for (uint32_t p = 0; p < config->probe_count; p++){
+        const nes_vec_probe_t* probe = &config->probes[p];
+        const uint8_t max_bytes = probe->encoding == NES_VEC_DIGITS ? 8 : 4;
+        if (probe->bytes == 0 || probe->bytes > max_bytes || probe->encoding > NES_VEC_BCD || probe->kind > NES_VEC_PROBE_DONE_NE){
+            NES_LOG_ERROR("nes_vec_create: bad probe %u at $%04X\n", (unsigned)p, probe->address);
+            return NULL;
+        }
+    }
+    nes_vec_t* envs = (nes_vec_t*)calloc(1, sizeof(nes_vec_t));
+    if (envs == NULL){
+        return NULL;
+    }
+    envs->count = count;
+    envs->config = *config;
+    envs->probes = (nes_vec_probe_t*)calloc(config->probe_count ? config->probe_count : 1, sizeof(nes_vec_probe_t));
+    envs->rom = nes_init();
+    if (envs->probes == NULL || envs->rom == NULL || nes_load_file(envs->rom, rom_path)){
+        NES_LOG_ERROR("nes_vec_create: can not load %s\n", rom_path);
+        nes_vec_destroy(envs);
+        return NULL;
+    }
+    if (nes_obs_init(envs->rom, config->width, config->height, config->channels)){
+        nes_vec_destroy(envs);
+        return NULL;
+    }
+    if (config->probe_count){
+        nes_memcpy(envs->probes, config->probes, config->probe_count * sizeof(nes_vec_probe_t));
+    }
+    envs->config.probes = envs->probes;
+
+    // Start state: after the boot frames, with the picture of the last one
+    nes_t* rom = envs->rom;
+    for (uint32_t frame = 0; frame < config->start_frames; frame++){
+        rom->nes_hidden = frame + 1 < config->start_frames ? (NES_HIDDEN_VIDEO | NES_HIDDEN_AUDIO) : NES_HIDDEN_AUDIO;
+        nes_step_frame(rom);
+    }
+    envs->state_size = nes_state_size(rom);
+    envs->obs_size = (size_t)config->width * config->height * config->channels;
+    envs->start_state = (uint8_t*)malloc(envs->state_size ? envs->state_size : 1);
+    envs->start_obs = (uint8_t*)malloc(envs->obs_size);
+    envs->envs = (nes_t**)calloc(count, sizeof(nes_t*));
+    envs->obs = (uint8_t*)malloc(count * envs->obs_size);
+    envs->rewards = (float*)calloc(count, sizeof(float));
+    envs->dones = (uint8_t*)calloc(count, sizeof(uint8_t));
+    envs->frames = (uint32_t*)calloc(count, sizeof(uint32_t));
+    envs->values = (int64_t*)calloc(count * (config->probe_count ? config->probe_count : 1), sizeof(int64_t));
+    if (envs->state_size == 0 || envs->start_state == NULL || envs->start_obs == NULL || envs->envs == NULL
+        || envs->obs == NULL || envs->rewards == NULL || envs->dones == NULL || envs->frames == NULL || envs->values == NULL
+        || nes_state_save(rom, envs->start_state, envs->state_size)){
+        nes_vec_destroy(envs);
+        return NULL;
+    }
+    nes_memcpy(envs->start_obs, rom->nes_obs->data, envs->obs_size);
+    for (size_t i = 0; i < count; i++){
+        envs->envs[i] = nes_clone(rom);
+        if (envs->envs[i] == NULL || nes_obs_init(envs->envs[i], config->width, config->height, config->channels)){
+            nes_vec_destroy(envs);
+            return NULL;
+        }
+    }
+    nes_vec_reset(envs);
+
+    int threads = config->threads > 0 ? config->threads : nes_batch_cpu_count();
+    if ((size_t)threads > count){
+        threads = (int)count;
+    }
+    if (nes_vec_pool_start(envs, threads)){
+        nes_vec_destroy(envs);
+        return NULL;
+    }
+    return envs;
+}
+
+void nes_vec_destroy(nes_vec_t* envs){
+    if (envs == NULL){
+        return;
+    }
+    nes_vec_pool_stop(envs);
+    // Clones share the ROM image, release them first
+    for (size_t i = 0; envs->envs && i < envs->count; i++){
+        if (envs->envs[i]){
+            nes_obs_deinit(envs->envs[i]);
+            nes_clone_free(envs->envs[i]);
+        }
+    }
+    if (envs->rom){
+        nes_unload_file(envs->rom);
+        nes_deinit(envs->rom);
+    }
+    free(envs->envs);
+    free(envs->probes);
+    free(envs->start_state);
+    free(envs->start_obs);
+    free(envs->obs);
+    free(envs->rewards);
+    free(envs->dones);
+    free(envs->frames);
+    free(envs->values);
+    free(envs);
+}
+
+void nes_vec_reset(nes_vec_t* envs){
+    for (size_t i = 0; i < envs->count; i++){
+        nes_vec_reset_one(envs, i);
+        envs->rewards[i] = 0;
+        envs->dones[i] = 0;
+    }
+}
+
+int nes_vec_step(nes_vec_t* envs, const uint16_t* actions, uint32_t k){
+    struct nes_vec_pool* pool = envs->pool;
+    pthread_mutex_lock(&pool->lock);
+    pool->actions = actions;
+    pool->k = k ? k : 1;
+    pool->next = 0;
+    pool->busy = pool->thread_count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    nes_vec_drain(envs);
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy){
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NES_OK;
+}
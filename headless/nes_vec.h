@@ -0,0 +1,92 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "nes.h"
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#define NES_VEC_PROBE_REWARD    (0)         /*  reward += (value - previous value) * scale */
+#define NES_VEC_PROBE_DONE_EQ   (1)         /*  Episode over when (value & mask) == target */
+#define NES_VEC_PROBE_DONE_NE   (2)         /*  Episode over when (value & mask) != target */
+
+#define NES_VEC_BINARY          (0)         /*  Little-endian integer */
+#define NES_VEC_DIGITS          (1)         /*  One decimal digit per byte, most significant first */
+#define NES_VEC_BCD             (2)         /*  Two decimal digits per byte, most significant first */
+
+#define NES_VEC_TERMINATED      (1)         /*  dones[]: a done probe matched */
+#define NES_VEC_TRUNCATED       (2)         /*  dones[]: max_frames reached */
+
+/* A value in CPU RAM ($0000-$07FF) or SRAM ($6000-$7FFF), read after every frame */
+typedef struct {
+    uint16_t address;
+    uint8_t bytes;                          /*  1-4, up to 8 digits with NES_VEC_DIGITS */
+    uint8_t encoding;                       /*  NES_VEC_BINARY, NES_VEC_DIGITS or NES_VEC_BCD */
+    uint8_t kind;                           /*  NES_VEC_PROBE_* */
+    uint32_t mask;                          /*  Done probes */
+    uint32_t target;                        /*  Done probes */
+    float scale;                            /*  Reward probes */
+} nes_vec_probe_t;
+
+typedef struct {
+    uint16_t width;                         /*  Observation size, e.g. 84 x 84 */
+    uint16_t height;
+    uint8_t channels;                       /*  NES_OBS_GRAY or NES_OBS_RGB */
+    uint32_t start_frames;                  /*  Frames run without input before the start state is taken */
+    uint32_t max_frames;                    /*  Episode length limit, 0 for none */
+    const nes_vec_probe_t* probes;          /*  Copied by nes_vec_create() */
+    uint32_t probe_count;
+    int threads;                            /*  <= 0: one per online CPU, at most one per instance */
+} nes_vec_config_t;
+
+struct nes_vec_pool;
+
+/*
+ * M instances of one ROM stepped together. After nes_vec_step() instance i has its observation at
+ * obs + i * obs_size, its reward in rewards[i] and NES_VEC_* in dones[i]. A finished instance is
+ * put back to the start state right away: obs then holds the start observation, rewards and dones
+ * still describe the step that ended the episode.
+ */
+typedef struct nes_vec{
+    size_t count;
+    nes_t* rom;                             /*  Instance the ROM is loaded in, the others are clones of it */
+    nes_t** envs;
+    nes_vec_config_t config;
+    nes_vec_probe_t* probes;
+    size_t state_size;
+    uint8_t* start_state;                   /*  After start_frames */
+    uint8_t* start_obs;
+    size_t obs_size;                        /*  width * height * channels */
+    uint8_t* obs;                           /*  count * obs_size */
+    float* rewards;
+    uint8_t* dones;
+    uint32_t* frames;                       /*  Frames into the current episode */
+    int64_t* values;                        /*  Last value of every probe, count * probe_count */
+    struct nes_vec_pool* pool;
+} nes_vec_t;
+
+nes_vec_t* nes_vec_create(const char* rom_path, size_t count, const nes_vec_config_t* config);
+void nes_vec_destroy(nes_vec_t* envs);
+/* Every instance back to the start state */
+void nes_vec_reset(nes_vec_t* envs);
+/* actions[i] (nes_joypad_t.joypad) is held on instance i for k frames, only the last one is rendered */
+int nes_vec_step(nes_vec_t* envs, const uint16_t* actions, uint32_t k);
+
+#ifdef __cplusplus
+    }
+#endif
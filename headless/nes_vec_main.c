@@ -0,0 +1,157 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes_vec.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Vectorized stepping benchmark: M instances, random actions held for k frames.
+ *
+ *   nes_vec_run <rom.nes> [-n envs] [-k repeat] [-s steps] [-j threads] [-W width] [-H height] [-c 1|3]
+ *               [-b start_frames] [-m max_frames] [-r addr[:bytes[:d|b]]]... [-d addr=value]... [-o obs.pgm]
+ *
+ * -r adds a reward probe (binary, d: one digit per byte, b: BCD), -d ends the episode when the byte
+ * equals value. -o writes the last observation of instance 0 as PGM (gray) or PPM (RGB).
+ */
+
+#define NES_VEC_MAX_PROBES      (16)
+
+static double nes_vec_main_clock(void){
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int nes_vec_main_probe(const char* spec, uint8_t kind, nes_vec_probe_t* probe){
+    char* end;
+    nes_memset(probe, 0, sizeof(*probe));
+    probe->kind = kind;
+    probe->address = (uint16_t)strtoul(spec, &end, 0);
+    probe->bytes = 1;
+    probe->scale = 1.0f;
+    if (kind == NES_VEC_PROBE_REWARD){
+        if (*end == ':'){
+            probe->bytes = (uint8_t)strtoul(end + 1, &end, 0);
+        }
+        if (*end == ':'){
+            probe->encoding = end[1] == 'd' ? NES_VEC_DIGITS : (end[1] == 'b' ? NES_VEC_BCD : NES_VEC_BINARY);
+        }
+        return NES_OK;
+    }
+    if (*end != '='){
+        return NES_ERROR;
+    }
+    probe->mask = 0xFF;
+    probe->target = (uint32_t)strtoul(end + 1, NULL, 0);
+    return NES_OK;
+}
+
+static void nes_vec_main_write_obs(const char* path, const nes_vec_t* envs){
+    FILE* file = fopen(path, "wb");
+    if (file == NULL){
+        NES_LOG_ERROR("can not open %s\n", path);
+        return;
+    }
+    fprintf(file, "P%c\n%u %u\n255\n", envs->config.channels == NES_OBS_GRAY ? '5' : '6',
+            (unsigned)envs->config.width, (unsigned)envs->config.height);
+    fwrite(envs->obs, 1, envs->obs_size, file);
+    fclose(file);
+}
+
+int main(int argc, char** argv){
+    if (argc < 2){
+        printf("usage: %s <rom.nes> [-n envs] [-k repeat] [-s steps] [-j threads] [-W width] [-H height] [-c 1|3]\n"
+               "       [-b start_frames] [-m max_frames] [-r addr[:bytes[:d|b]]]... [-d addr=value]... [-o obs.pgm]\n", argv[0]);
+        return -1;
+    }
+    nes_vec_probe_t probes[NES_VEC_MAX_PROBES];
+    nes_vec_config_t config = {
+        .width = 84,
+        .height = 84,
+        .channels = NES_OBS_GRAY,
+        .start_frames = 60,
+        .probes = probes,
+    };
+    size_t count = 16;
+    uint32_t k = 4;
+    uint32_t steps = 1000;
+    const char* obs_path = NULL;
+    for (int i = 2; i + 1 < argc; i += 2){
+        const char* value = argv[i + 1];
+        const char option = argv[i][0] == '-' ? argv[i][1] : '\0';
+        if (option == 'r' || option == 'd'){
+            if (config.probe_count == NES_VEC_MAX_PROBES
+                || nes_vec_main_probe(value, option == 'r' ? NES_VEC_PROBE_REWARD : NES_VEC_PROBE_DONE_EQ, &probes[config.probe_count])){
+                NES_LOG_ERROR("bad probe %s\n", value);
+                return -1;
+            }
+            config.probe_count++;
+            continue;
+        }
+        switch (option){
+        case 'n': count = (size_t)atoi(value); break;
+        case 'k': k = (uint32_t)atoi(value); break;
+        case 's': steps = (uint32_t)atoi(value); break;
+        case 'j': config.threads = atoi(value); break;
+        case 'W': config.width = (uint16_t)atoi(value); break;
+        case 'H': config.height = (uint16_t)atoi(value); break;
+        case 'c': config.channels = (uint8_t)atoi(value); break;
+        case 'b': config.start_frames = (uint32_t)atoi(value); break;
+        case 'm': config.max_frames = (uint32_t)atoi(value); break;
+        case 'o': obs_path = value; break;
+        default:
+            NES_LOG_ERROR("unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    nes_vec_t* envs = nes_vec_create(argv[1], count, &config);
+    if (envs == NULL){
+        return -1;
+    }
+    uint16_t* actions = (uint16_t*)malloc(count * sizeof(uint16_t));
+    if (actions == NULL){
+        nes_vec_destroy(envs);
+        return -1;
+    }
+    double reward = 0;
+    uint32_t episodes = 0;
+    uint32_t seed = 0x9E3779B9u;
+    const double start = nes_vec_main_clock();
+    for (uint32_t step = 0; step < steps; step++){
+        for (size_t i = 0; i < count; i++){
+            seed = seed * 1664525u + 1013904223u;
+            actions[i] = (uint16_t)(seed >> 16) & 0xF0F0;
+        }
+        nes_vec_step(envs, actions, k);
+        for (size_t i = 0; i < count; i++){
+            reward += envs->rewards[i];
+            episodes += envs->dones[i] ? 1 : 0;
+        }
+    }
+    const double seconds = nes_vec_main_clock() - start;
+    printf("%zu envs x %u steps x %u frames: %.3f s, %.0f env steps/s, %.0f frames/s\n",
+           count, (unsigned)steps, (unsigned)k, seconds, (double)count * steps / seconds, (double)count * steps * k / seconds);
+    printf("reward %.1f, %u episodes ended\n", reward, (unsigned)episodes);
+    if (obs_path){
+        nes_vec_main_write_obs(obs_path, envs);
+    }
+    free(actions);
+    nes_vec_destroy(envs);
+    return 0;
+}
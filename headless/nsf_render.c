@@ -0,0 +1,206 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Offline NSF/NSFe renderer, as fast as the CPU core runs.
+ *
+ *   nsf_render <file.nsf> <out_prefix> [-t track] [-s seconds] [-r rate] [-S]
+ *
+ * Every track (or only -t track, 1-based) is written to <out_prefix>_NN.wav,
+ * 16-bit mono. The length comes from the NSFe "time" chunk when present,
+ * -s seconds otherwise (default 150). With out_prefix "-" nothing is written,
+ * which makes it an APU/CPU benchmark. -S also writes every channel before the
+ * mixer to <out_prefix>_NN_<channel>.wav, 8-bit (NES_APU_STEMS).
+ */
+
+#define NSF_RENDER_SECONDS      (150)
+
+static FILE* wav_file = NULL;
+static uint32_t wav_data_size = 0;
+
+#if (NES_APU_STEMS == 1)
+#define NSF_RENDER_STEMS        (5)
+
+static const char* const stem_names[NSF_RENDER_STEMS] = {"pulse1", "pulse2", "triangle", "noise", "dmc"};
+static const uint8_t stem_scale[NSF_RENDER_STEMS] = {17, 17, 17, 17, 2};   // 0-15 and DMC 0-127 to 0-255
+static FILE* stem_files[NSF_RENDER_STEMS] = {NULL};
+static uint32_t stem_data_size = 0;
+
+int nes_sound_stems(nes_t* nes, uint8_t *stems, size_t len){
+    (void)nes;
+    if (stem_files[0] == NULL){
+        return 0;
+    }
+    uint8_t samples[1024];
+    for (uint8_t channel = 0; channel < NSF_RENDER_STEMS; channel++){
+        for (size_t i = 0; i < len; i += sizeof(samples)){
+            const size_t count = len - i < sizeof(samples) ? len - i : sizeof(samples);
+            for (size_t j = 0; j < count; j++){
+                samples[j] = (uint8_t)(stems[channel * len + i + j] * stem_scale[channel]);
+            }
+            fwrite(samples, 1, count, stem_files[channel]);
+        }
+    }
+    stem_data_size += (uint32_t)len;
+    return 0;
+}
+#endif
+
+int nes_sound_output(nes_t* nes, uint8_t *buffer, size_t len){
+    (void)nes;
+    if (wav_file){
+        wav_data_size += (uint32_t)fwrite(buffer, 1, len, wav_file);
+    }
+    return 0;
+}
+
+static void wav_write_u32(uint8_t* p, uint32_t v){
+    p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
+
+static void wav_write_header(FILE* file, uint32_t sample_rate, uint32_t data_size, uint8_t bits){
+    uint8_t header[44] = {
+        'R','I','F','F', 0,0,0,0, 'W','A','V','E',
+        'f','m','t',' ', 16,0,0,0, 1,0, 1,0, 0,0,0,0, 0,0,0,0, 2,0, 16,0,
+        'd','a','t','a', 0,0,0,0,
+    };
+    wav_write_u32(header + 4, 36 + data_size);
+    wav_write_u32(header + 24, sample_rate);
+    wav_write_u32(header + 28, sample_rate * (bits / 8));
+    header[32] = bits / 8;
+    header[34] = bits;
+    wav_write_u32(header + 40, data_size);
+    fseek(file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), file);
+}
+
+static double nsf_render_clock(void){
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv){
+    if (argc < 3){
+        printf("usage: %s <file.nsf> <out_prefix|-> [-t track] [-s seconds] [-r rate] [-S]\n", argv[0]);
+        return -1;
+    }
+    const char* nsf_path = argv[1];
+    const char* out_prefix = argv[2];
+    int track = 0;
+    uint32_t seconds = NSF_RENDER_SECONDS;
+    int stems = 0;
+    nes_apu_config_t apu_config = {
+        .sample_rate = 48000,
+        .format = NES_APU_FORMAT_S16,
+        .block_size = 1024,
+    };
+    for (int i = 3; i < argc; i++){
+        if (strcmp(argv[i], "-S") == 0){
+            stems = 1;
+        }else if (i + 1 >= argc){
+            break;
+        }else if (strcmp(argv[i], "-t") == 0){
+            track = atoi(argv[++i]);
+        }else if (strcmp(argv[i], "-s") == 0){
+            seconds = (uint32_t)atoi(argv[++i]);
+        }else if (strcmp(argv[i], "-r") == 0){
+            apu_config.sample_rate = (uint32_t)atoi(argv[++i]);
+        }
+    }
+#if (NES_APU_STEMS == 0)
+    if (stems){
+        printf("-S needs NES_APU_STEMS\n");
+        return -1;
+    }
+#endif
+
+    nes_t* nes = nes_init();
+    if (nes == NULL || nes_apu_config(nes, &apu_config) || nes_nsf_load_file(nes, nsf_path)){
+        NES_LOG_ERROR("nsf load file fail\n");
+        return -1;
+    }
+    nes_nsf_t* nsf = (nes_nsf_t*)nes->nes_mapper.mapper_register;
+    printf("%s - %s (%s), %d tracks\n", nsf->song_name, nsf->artist, nsf->copyright, nsf->total_songs);
+
+    const uint8_t first = track ? (uint8_t)(track - 1) : 0;
+    const uint8_t last = track ? (uint8_t)track : nsf->total_songs;
+    double total_audio = 0, total_time = 0;
+    for (uint8_t song = first; song < last && song < nsf->total_songs; song++){
+        char wav_path[1024];
+        if (strcmp(out_prefix, "-")){
+            snprintf(wav_path, sizeof(wav_path), "%s_%02d.wav", out_prefix, song + 1);
+            wav_file = fopen(wav_path, "wb");
+            if (wav_file == NULL){
+                NES_LOG_ERROR("can not open %s\n", wav_path);
+                break;
+            }
+            wav_write_header(wav_file, apu_config.sample_rate, 0, 16);
+#if (NES_APU_STEMS == 1)
+            for (uint8_t channel = 0; stems && channel < NSF_RENDER_STEMS; channel++){
+                snprintf(wav_path, sizeof(wav_path), "%s_%02d_%s.wav", out_prefix, song + 1, stem_names[channel]);
+                stem_files[channel] = fopen(wav_path, "wb");
+                if (stem_files[channel] == NULL){
+                    NES_LOG_ERROR("can not open %s\n", wav_path);
+                    return -1;
+                }
+                wav_write_header(stem_files[channel], apu_config.sample_rate, 0, 8);
+            }
+            stem_data_size = 0;
+#endif
+        }
+        wav_data_size = 0;
+        const int32_t track_time = nes_nsf_track_time(nes, song);
+        const uint64_t length_us = track_time > 0 ? (uint64_t)track_time * 1000 : (uint64_t)seconds * 1000000;
+
+        const double start = nsf_render_clock();
+        nes_nsf_init(nes, song);
+        for (uint64_t t = 0; t < length_us; t += nsf->play_speed){
+            nes_nsf_frame(nes);
+        }
+        const double elapsed = nsf_render_clock() - start;
+
+        if (wav_file){
+            wav_write_header(wav_file, apu_config.sample_rate, wav_data_size, 16);
+            fclose(wav_file);
+            wav_file = NULL;
+        }
+#if (NES_APU_STEMS == 1)
+        for (uint8_t channel = 0; channel < NSF_RENDER_STEMS; channel++){
+            if (stem_files[channel]){
+                wav_write_header(stem_files[channel], apu_config.sample_rate, stem_data_size, 8);
+                fclose(stem_files[channel]);
+                stem_files[channel] = NULL;
+            }
+        }
+#endif
+        total_audio += (double)length_us / 1e6;
+        total_time += elapsed;
+        printf("track %2d: %7.1fs audio in %6.3fs (%.0fx realtime)\n", song + 1, (double)length_us / 1e6, elapsed, (double)length_us / 1e6 / elapsed);
+    }
+    if (total_time > 0){
+        printf("total: %.1fs audio in %.3fs (%.0fx realtime)\n", total_audio, total_time, total_audio / total_time);
+    }
+
+    nes_nsf_unload(nes);
+    nes_deinit(nes);
+    return 0;
+}
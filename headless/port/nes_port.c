@@ -0,0 +1,104 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#if !defined(_POSIX_C_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200809L             /* struct stat st_mtim */
+#endif
+
+#include "nes.h"
+
+#if (NES_ROM_CACHE == 1)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*
+ * Headless port: no window, no audio device, no timing.
+ * Memory and file functions use the weak defaults in nes_default.c, ROM files are mapped,
+ * the tools override nes_sound_output / nes_frame when they need them.
+ */
+
+#if (NES_ROM_CACHE == 1)
+// Pages come from the page cache: instances and processes running the same ROM share them
+void *nes_file_map(const char * filename, size_t *size){
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0){
+        return NULL;
+    }
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0){
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED){
+        return NULL;
+    }
+    *size = (size_t)st.st_size;
+    return data;
+}
+
+void nes_file_unmap(void *data, size_t size){
+    munmap(data, size);
+}
+
+// A file rewritten in place gets a new mtime, a replaced one a new inode
+int nes_file_id(const char * filename, nes_file_id_t *id){
+    struct stat st;
+    if (stat(filename, &st) || st.st_size <= 0){
+        return NES_ERROR;
+    }
+    id->device = (uint64_t)st.st_dev;
+    id->inode = (uint64_t)st.st_ino;
+    id->size = (uint64_t)st.st_size;
+    id->mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return NES_OK;
+}
+#endif
+
+NES_WEAK int nes_initex(nes_t *nes){
+    (void)nes;
+    return 0;
+}
+
+NES_WEAK int nes_deinitex(nes_t *nes){
+    (void)nes;
+    return 0;
+}
+
+NES_WEAK int nes_draw(nes_t* nes, int x1, int y1, int x2, int y2, nes_color_t* color_data){
+    (void)nes;
+    (void)x1;
+    (void)y1;
+    (void)x2;
+    (void)y2;
+    (void)color_data;
+    return 0;
+}
+
+NES_WEAK void nes_frame(nes_t* nes){
+    (void)nes;
+}
+
+#if (NES_ENABLE_SOUND == 1)
+NES_WEAK int nes_sound_output(nes_t* nes, uint8_t *buffer, size_t len){
+    (void)nes;
+    (void)buffer;
+    (void)len;
+    return 0;
+}
+#endif
@@ -0,0 +1,70 @@
+set_project("nes_headless")
+set_xmakever("3.0.0")
+add_rules("mode.debug", "mode.release")
+
+if is_mode("debug") then
+    set_symbols("debug")
+    set_optimize("none")
+else
+    set_strip("all")
+    set_symbols("hidden")
+    set_optimize("fastest")
+end
+
+set_warnings("allextra")
+set_languages("c11")
+
+local nes_dir = ".."
+
+target("nes_core", function ()
+    set_kind("static")
+    add_includedirs(nes_dir .. "/inc", "port", {public = true})
+    add_files(nes_dir .. "/src/**.c")
+    add_files("port/*.c")
+end)
+
+target("nsf_render", function ()
+    set_kind("binary")
+    add_deps("nes_core")
+    add_files("nsf_render.c")
+end)
+
+target("nes_bench", function ()
+    set_kind("binary")
+    add_deps("nes_core")
+    add_files("nes_bench.c")
+end)
+
+target("nes_batch", function ()
+    set_kind("static")
+    add_deps("nes_core")
+    add_files("nes_batch.c", "nes_vec.c", "nes_netplay.c")
+    add_includedirs(".", {public = true})
+    if is_plat("linux", "macosx", "bsd") then
+        add_syslinks("pthread", {public = true})
+    end
+end)
+
+target("nes_batch_run", function ()
+    set_kind("binary")
+    add_deps("nes_batch")
+    add_files("nes_batch_main.c")
+end)
+
+target("nes_movie", function ()
+    set_kind("binary")
+    add_deps("nes_batch")
+    add_files("nes_movie_main.c")
+end)
+
+target("nes_vec_run", function ()
+    set_kind("binary")
+    add_deps("nes_batch")
+    add_files("nes_vec_main.c")
+end)
+
+target("nes_netplay_run", function ()
+    set_kind("binary")
+    add_deps("nes_batch")
+    add_files("nes_netplay_main.c")
+end)
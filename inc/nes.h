@@ -22,6 +22,16 @@
 #include "nes_ppu.h"
 #include "nes_apu.h"
 #include "nes_mapper.h"
+#include "nes_nsf.h"
+#include "nes_state.h"
+#include "nes_lz.h"
+#include "nes_hash.h"
+#include "nes_rewind.h"
+#include "nes_runahead.h"
+#include "nes_movie.h"
+#include "nes_obs.h"
+#include "nes_input.h"
+#include "nes_dirty.h"
 
 #ifdef __cplusplus
     extern "C" {
@@ -50,12 +60,36 @@
 #define NES_OK                  (0) 
 #define NES_ERROR               (-1)
 
+// https://www.nesdev.org/wiki/PPU_rendering
+#define NES_SCANLINE_PRERENDER  (261)
+
+/* nes_step_* status flags */
+#define NES_STEP_SCANLINE       (1 << 0)  /* At least one scanline was run */
+#define NES_STEP_FRAME_READY    (1 << 1)  /* The picture is complete, nes_draw() has been called */
+#define NES_STEP_FRAME_END      (1 << 2)  /* The pre-render line is done, the next step starts a new frame */
+#define NES_STEP_AUDIO_READY    (1 << 3)  /* nes_sound_output() has been called */
+#define NES_STEP_LAG_FRAME      (1 << 4)  /* With NES_STEP_FRAME_END: the game never read the joypad in that frame */
+
+/*
+    nes_hidden flags, output suppressed while emulating frames nobody sees: run-ahead, or RAM-only
+    runs (NES_HIDDEN_VIDEO | NES_HIDDEN_AUDIO) for bots and batch jobs that only read game RAM.
+    Can be changed between any two steps, the emulation itself is the same either way.
+*/
+#define NES_HIDDEN_VIDEO        (1 << 0)  /* No drawing and no nes_draw(), sprite 0 hit is still evaluated */
+#define NES_HIDDEN_AUDIO        (1 << 1)  /* Channels are clocked but not mixed, no nes_sound_output() */
+#define NES_HIDDEN_SPECULATIVE  (1 << 2)  /* The state will be thrown away: no rewind capture */
+
 typedef struct nes{
     uint8_t nes_quit;
 #if (NES_FRAME_SKIP != 0)
     uint8_t nes_frame_skip_count;
 #endif
-    uint16_t scanline;
+    uint8_t nes_hidden;                 /*  NES_HIDDEN_* */
+    uint16_t scanline;                  /*  Next scanline to run, 0-261 */
+    int32_t run_cycles_carry;           /*  nes_run_cycles() overshoot, negative */
+    uint8_t nes_lag;                    /*  The last finished frame was a lag frame (input had no effect) */
+    uint32_t nes_frame_count;           /*  Frames finished since power-on */
+    uint32_t nes_lag_count;             /*  Lag frames among them */
     nes_rom_info_t nes_rom;
     nes_cpu_t nes_cpu;
     nes_ppu_t nes_ppu;
@@ -63,7 +97,24 @@ typedef struct nes{
     nes_apu_t nes_apu;
 #endif
     nes_mapper_t nes_mapper;
-    nes_color_t nes_draw_data[NES_DRAW_SIZE];
+    nes_rewind_t* nes_rewind;           /*  Rewind history, NULL unless nes_rewind_init() */
+    nes_runahead_t* nes_runahead;       /*  NULL unless nes_runahead_init() */
+    nes_movie_t* nes_movie;             /*  Input movie being recorded or played, NULL when none */
+    nes_obs_t* nes_obs;                 /*  Downsampled observation instead of nes_draw(), NULL unless nes_obs_init() */
+#if (NES_FRAME_HASH == 1)
+    nes_frame_hash_t nes_frame_hash;
+#endif
+#if (NES_DIRTY_TILE > 0)
+    nes_dirty_t nes_dirty;
+#endif
+#if (NES_INPUT_QUEUE == 1)
+    nes_input_queue_t* nes_input_queue; /*  Timestamped joypad events, NULL unless nes_input_init() */
+#endif
+    void (*nes_input_latch)(struct nes* nes);   /*  Optional, called when the game strobes $4016 to set nes_cpu.joypad */
+    void* user_data;                    /*  Port/host state of this instance */
+    nes_color_t* nes_draw_data;         /*  Frame the lines are rendered into, nes_draw_buffer or the host's (nes_set_framebuffer) */
+    uint32_t nes_draw_stride;           /*  Pixels from the start of one line to the next */
+    nes_color_t* nes_draw_buffer;       /*  Own NES_DRAW_SIZE frame, NULL while the host provides one */
 } nes_t;
 
 
@@ -71,6 +122,17 @@ nes_t* nes_init(void);
 int nes_deinit(nes_t *nes);
 
 void nes_run(nes_t* nes);
+void nes_reset(nes_t* nes);
+int nes_step_scanline(nes_t* nes);
+int nes_step_frame(nes_t* nes);
+int nes_run_cycles(nes_t* nes, uint32_t cycles);
+/*
+    Renders straight into a host frame, e.g. a locked texture or an LCD buffer: NES_DRAW_LINES lines
+    (NES_HEIGHT unless streaming) of NES_WIDTH pixels, `stride` pixels apart. nes_draw() is still
+    called when lines are done, with color_data pointing into the host frame: nothing left to copy.
+    Can be changed between frames; NULL goes back to the own frame.
+*/
+int nes_set_framebuffer(nes_t* nes, nes_color_t* buffer, uint32_t stride);
 
 #if (NES_USE_FS == 1)
 int nes_load_file(nes_t* nes, const char* file_path);
@@ -19,12 +19,29 @@
     extern "C" {
 #endif
 
+/* Defaults used until nes_apu_config() is called */
+#ifndef NES_APU_SAMPLE_RATE
 #define NES_APU_SAMPLE_RATE         (44100)
+#endif
 #define NES_APU_SAMPLE_PER_SYNC     (NES_APU_SAMPLE_RATE/60)
 
 struct nes;
 typedef struct nes nes_t;
 
+/* Output sample format of nes_sound_output() */
+typedef enum {
+    NES_APU_FORMAT_U8,                      /*  unsigned 8-bit */
+    NES_APU_FORMAT_S8,                      /*  signed 8-bit */
+    NES_APU_FORMAT_S16,                     /*  signed 16-bit, native byte order */
+    NES_APU_FORMAT_F32,                     /*  32-bit float, -1.0 ~ 1.0 */
+} nes_apu_format_t;
+
+typedef struct {
+    uint32_t sample_rate;                   /*  Output rate in Hz: 22050, 44100, 48000 or 96000 */
+    nes_apu_format_t format;                /*  Output sample format */
+    uint16_t block_size;                    /*  Samples per nes_sound_output() call, 0: one video frame */
+} nes_apu_config_t;
+
 // https://www.nesdev.org/wiki/APU
 // https://www.nesdev.org/apu_ref.txt
 
@@ -75,9 +92,8 @@ typedef struct {
     uint8_t sweep_divider;
     uint8_t envelope_divider;
     uint8_t envelope_volume;
-    uint8_t sample_buffer[NES_APU_SAMPLE_PER_SYNC];
-    uint16_t sample_index;
-    float seq_local_old;
+    uint16_t timer;                         /*  CPU cycles left until the sequencer steps */
+    uint8_t sequence;                       /*  Sequencer position 0-7 */
 } pulse_t;
 
 // https://www.nesdev.org/wiki/APU#Triangle_($4008-$400B)
@@ -109,9 +125,8 @@ typedef struct {
     uint8_t linear_counter;
     uint8_t linear_restart;
     uint16_t cur_period;
-    uint8_t sample_buffer[NES_APU_SAMPLE_PER_SYNC];
-    uint16_t sample_index;
-    float seq_local_old;
+    uint16_t timer;                         /*  CPU cycles left until the sequencer steps */
+    uint8_t sequence;                       /*  Sequencer position 0-31 */
 } triangle_t;
 
 // https://www.nesdev.org/wiki/APU#Noise_($400C-$400F)
@@ -153,8 +168,7 @@ typedef struct {
     uint8_t envelope_restart;
     uint8_t envelope_divider;
     uint8_t envelope_volume;
-    uint8_t sample_buffer[NES_APU_SAMPLE_PER_SYNC];
-    uint16_t sample_index;
+    uint16_t timer;                         /*  CPU cycles left until the LFSR is clocked */
 } noise_t;
 
 typedef struct {
@@ -176,8 +190,16 @@ typedef struct {
     };
     uint8_t sample_address;                 /*	Sample address (A) */
     uint8_t sample_length;                  /*	Sample length (L) */
-    uint8_t sample_buffer[NES_APU_SAMPLE_PER_SYNC];
-    uint16_t sample_index;
+    uint16_t timer_period;                  /*  CPU cycles per output clock, looked up from the rate index */
+    uint16_t timer;                         /*  CPU cycles left until the next output clock */
+    uint16_t current_address;               /*  Memory reader: address of the next sample byte ($8000-$FFFF) */
+    uint16_t bytes_remaining;               /*  Memory reader: sample bytes left to fetch */
+    uint8_t read_buffer;                    /*  Sample buffer filled by the memory reader */
+    uint8_t buffer_empty;                   /*  Sample buffer is empty, a fetch is due */
+    uint8_t shift_register;                 /*  Output unit shift register */
+    uint8_t bits_remaining;                 /*  Output unit bits left in the current output cycle */
+    uint8_t silence;                        /*  Output unit silence flag */
+    uint8_t output_level;                   /*  7-bit output level fed to the mixer */
 } dmc_t;
 
 // https://www.nesdev.org/wiki/APU#Registers
@@ -212,17 +234,32 @@ typedef struct nes_apu{
         uint8_t frame_counter;              //  Frame Counter ($4017)
     };
 
-    uint64_t clock_count;
-    // sample_buffer: pulse1 pulse2 triangle noise dmc output
-    uint8_t sample_buffer[NES_APU_SAMPLE_PER_SYNC];
+    uint64_t cpu_clock;                     /*  CPU cycle the APU has been advanced to */
+    uint64_t irq_clock;                     /*  Earliest CPU cycle an APU IRQ can be raised */
+    uint64_t dmc_clock;                     /*  CPU cycle of the next DMC memory reader fetch */
+    uint32_t channel_pending;               /*  CPU cycles not yet applied to the channel timers */
+    uint32_t sample_phase;                  /*  Output sample phase, in units of 1/NES_CPU_CLOCK_FREQ second */
+    uint16_t sample_wait;                   /*  CPU cycles until the next output sample */
+    uint16_t frame_wait;                    /*  CPU cycles until the next frame counter step */
+    uint8_t frame_step;                     /*  Next frame counter step */
+    nes_apu_config_t config;
+    uint8_t sample_bytes;                   /*  Bytes per output sample */
+    float highpass_in;                      /*  DC blocker state: last input */
+    float highpass_out;                     /*  DC blocker state: last output */
+    float highpass_coef;                    /*  DC blocker pole for the configured rate */
+    uint8_t* sample_buffer;                 /*  One block of mixed output in the configured format */
+#if (NES_APU_STEMS == 1)
+    uint8_t* stem_buffer;                   /*  Per-channel levels: pulse1 pulse2 triangle noise dmc, block_size each */
+#endif
     uint16_t sample_index;
-    uint64_t cpu_lock_count;
-    uint64_t sample_local_start;
-    uint64_t sample_local_end;
+    uint8_t block_ready;                    /*  Set when a block is passed to nes_sound_output() */
 } nes_apu_t;
 
+int nes_apu_config(nes_t *nes, const nes_apu_config_t* config);
 void nes_apu_init(nes_t *nes);
-void nes_apu_frame(nes_t *nes);
+void nes_apu_deinit(nes_t *nes);
+void nes_apu_sync(nes_t *nes);
+void nes_apu_hsync(nes_t *nes);
 uint8_t nes_read_apu_register(nes_t *nes,uint16_t address);
 void nes_write_apu_register(nes_t* nes,uint16_t address,uint8_t data);
 
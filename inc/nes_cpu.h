@@ -87,10 +87,12 @@ typedef struct nes_cpu{
     uint8_t irq_counter;
     uint8_t irq_nmi;
     uint8_t opcode;
-    uint16_t cycles;
+    uint16_t cycles;                    /*  Cycles consumed in the current nes_opcode() slice */
+    uint64_t cycles_total;              /*  Cycles of all finished slices, cycles_total + cycles is the CPU clock */
     uint8_t cpu_ram[NES_CPU_RAM_SIZE];
     uint8_t* prg_banks[4];              /*  4 bank ( 8Kb * 4 ) = 32KB  */
     nes_joypad_t joypad;
+    uint8_t joypad_read;                /*  $4016/$4017 was read during the current frame */
 } nes_cpu_t;
 
 void nes_cpu_init(nes_t *nes);
@@ -49,14 +49,64 @@
 #define NES_FRAME_SKIP          (0)
 #endif
 
+/* Per-channel output (pulse1 pulse2 triangle noise dmc) passed to nes_sound_stems() */
+#ifndef NES_APU_STEMS
+#define NES_APU_STEMS           (0)
+#endif
+
+/* Per-frame picture/RAM/VRAM hashes (nes_frame_hash_enable) */
+#ifndef NES_FRAME_HASH
+#define NES_FRAME_HASH          (0)
+#endif
+
+/* Timestamped joypad events applied at their CPU cycle (nes_input_init), needs C11 <stdatomic.h> */
+#ifndef NES_INPUT_QUEUE
+#define NES_INPUT_QUEUE         (0)
+#endif
+
+/* Events the input queue holds, power of two */
+#ifndef NES_INPUT_QUEUE_SIZE
+#define NES_INPUT_QUEUE_SIZE    (256)
+#endif
+
+/* nes_load_file() shares one read-only image per ROM content between instances, mapped with
+   nes_file_map() when the port has it, needs C11 <stdatomic.h> */
+#ifndef NES_ROM_CACHE
+#define NES_ROM_CACHE           (0)
+#endif
+
 #ifndef NES_RAM_LACK
 #define NES_RAM_LACK            (0)
 #endif
 
+/* Streaming output: the frame buffer is a ring of the last NES_DRAW_LINES lines and nes_draw() gets
+ * every NES_DRAW_BLOCK lines as soon as they are done. With NES_DRAW_LINES = 2 * NES_DRAW_BLOCK the
+ * port can send one block (SPI/DMA) while the next one is rendered, e.g. 16/8 lines RGB565 = 8 KB.
+ * NES_RAM_LACK is the 120/120 case.
+ */
+#ifndef NES_DRAW_LINES
 #if (NES_RAM_LACK == 1)
-#define NES_DRAW_SIZE           (NES_WIDTH * NES_HEIGHT / 2) 
+#define NES_DRAW_LINES          (NES_HEIGHT / 2)
 #else
-#define NES_DRAW_SIZE           (NES_WIDTH * NES_HEIGHT)
+#define NES_DRAW_LINES          (NES_HEIGHT)
+#endif
+#endif
+
+/* Lines per nes_draw() call, divides NES_DRAW_LINES */
+#ifndef NES_DRAW_BLOCK
+#define NES_DRAW_BLOCK          (NES_DRAW_LINES)
+#endif
+
+#define NES_DRAW_SIZE           (NES_WIDTH * NES_DRAW_LINES)
+
+/* Dirty tiles reported to nes_draw_dirty(): 0 off, 8 or 16 pixel tiles, NES_DRAW_BLOCK a multiple of it */
+#ifndef NES_DIRTY_TILE
+#define NES_DIRTY_TILE          (0)
+#endif
+
+/* Dirty rectangles per nes_draw_dirty() call */
+#ifndef NES_DIRTY_RECTS
+#define NES_DIRTY_RECTS         (32)
 #endif
 
 #ifndef NES_COLOR_SWAP
@@ -94,11 +144,30 @@ size_t nes_fread(void *ptr, size_t size, size_t nmemb, FILE *stream);
 size_t nes_fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream);
 int nes_fseek(FILE *stream, long int offset, int whence);
 int nes_fclose(FILE *stream );
+#if (NES_ROM_CACHE == 1)
+/* Read-only mapping of a whole file, NULL when not supported: it is read into nes_malloc() memory */
+void *nes_file_map(const char * filename, size_t *size);
+void nes_file_unmap(void *data, size_t size);
+/* Identity of a file, e.g. (st_dev, st_ino, st_size, st_mtim): equal while the file is unchanged */
+typedef struct {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime;                          /*  Nanoseconds */
+} nes_file_id_t;
+/* 0 with the identity of the file, -1 when not supported: every load then maps and hashes the file */
+int nes_file_id(const char * filename, nes_file_id_t *id);
+#endif
 
 #endif
 
-int nes_draw(int x1, int y1, int x2, int y2, nes_color_t* color_data);
-int nes_sound_output(uint8_t *buffer, size_t len);
+struct nes;
+
+int nes_draw(struct nes* nes, int x1, int y1, int x2, int y2, nes_color_t* color_data);
+int nes_sound_output(struct nes* nes, uint8_t *buffer, size_t len);
+#if (NES_APU_STEMS == 1)
+int nes_sound_stems(struct nes* nes, uint8_t *stems, size_t len);
+#endif
 
 #ifdef __cplusplus          
     }
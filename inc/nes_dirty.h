@@ -0,0 +1,70 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+struct nes;
+typedef struct nes nes_t;
+
+#if (NES_DIRTY_TILE > 0)
+
+#define NES_DIRTY_COLUMNS       (256 / NES_DIRTY_TILE)      /* NES_WIDTH */
+#define NES_DIRTY_ROWS          (240 / NES_DIRTY_TILE)      /* NES_HEIGHT */
+
+typedef struct nes_rect{
+    uint16_t x1;
+    uint16_t y1;
+    uint16_t x2;                                /*  Inclusive */
+    uint16_t y2;                                /*  Inclusive */
+} nes_rect_t;
+
+/*
+    Dirty tiles: every rendered line is hashed per NES_DIRTY_TILE pixels wide tile, a finished tile row
+    is compared with the tiles of the last picture handed to the port. Changed tiles are merged into
+    rectangles (runs in a tile row, then equal runs of the rows below), when NES_DIRTY_RECTS are not
+    enough the rest is merged into the last one: it only ever reports more than changed.
+*/
+typedef struct {
+    uint32_t hash[NES_DIRTY_ROWS][NES_DIRTY_COLUMNS];   /*  Tiles of the last picture drawn */
+    uint32_t row[NES_DIRTY_COLUMNS];                    /*  Tile row being rendered */
+    uint8_t full;                                       /*  Report every tile of the next picture */
+    uint16_t rect_count;
+    nes_rect_t rects[NES_DIRTY_RECTS];
+} nes_dirty_t;
+
+/*
+    Port hook, replaces nes_draw() when NES_DIRTY_TILE > 0: the block of lines y1-y2 is done and
+    color_data points to its first line (nes_draw_stride pixels per line). Only `rects` (screen
+    coordinates, inside y1-y2) changed since the last picture, count can be 0. The default calls
+    nes_draw() for the whole block.
+*/
+int nes_draw_dirty(nes_t* nes, int y1, int y2, const nes_rect_t* rects, uint16_t count, nes_color_t* color_data);
+
+/* The display no longer shows the last picture (e.g. after an overlay): the next one is reported whole */
+void nes_dirty_invalidate(nes_t* nes);
+
+/* Called by nes_step_scanline() */
+void nes_dirty_line(nes_t* nes, const nes_color_t* line);
+void nes_dirty_draw(nes_t* nes, uint16_t y1, uint16_t y2, nes_color_t* color_data);
+
+#endif
+
+#ifdef __cplusplus
+    }
+#endif
@@ -0,0 +1,76 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+struct nes;
+typedef struct nes nes_t;
+
+/*
+    XXH64 (https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md), used for ROM identity,
+    movie verification and regression hashes. Reads little-endian words.
+*/
+uint64_t nes_hash64(const void* data, size_t size, uint64_t seed);
+/* Identity of the loaded ROM: PRG and CHR ROM contents and the mapper number */
+uint64_t nes_rom_hash(nes_t* nes);
+
+/* Streaming form, the digest equals nes_hash64() of everything passed to nes_hash_update() */
+typedef struct {
+    uint64_t v[4];
+    uint64_t seed;
+    uint64_t total;
+    uint8_t buffer[32];
+    uint32_t buffered;
+} nes_hash_state_t;
+
+void nes_hash_reset(nes_hash_state_t* state, uint64_t seed);
+void nes_hash_update(nes_hash_state_t* state, const void* data, size_t size);
+uint64_t nes_hash_digest(const nes_hash_state_t* state);
+
+#if (NES_FRAME_HASH == 1)
+/*
+    Per-frame hashes for regression runs: the picture is hashed line by line right after each line
+    is rendered, while it is still in cache, CPU RAM and VRAM (4K) at frame end.
+*/
+typedef struct {
+    uint64_t video;                         /*  nes_hash64 of the picture, 0 when it was not drawn */
+    uint64_t ram;
+    uint64_t vram;
+    uint32_t frame;                         /*  Frames hashed since nes_frame_hash_enable() */
+    uint8_t enable;
+    uint16_t lines;                         /*  Lines hashed in the current frame */
+    nes_hash_state_t video_state;
+#if (NES_USE_FS == 1)
+    FILE* log;
+#endif
+} nes_frame_hash_t;
+
+void nes_frame_hash_enable(nes_t* nes, uint8_t enable);
+/* Called by nes_step_scanline() */
+void nes_frame_hash_line(nes_t* nes, const nes_color_t* line);
+void nes_frame_hash_end(nes_t* nes);
+#if (NES_USE_FS == 1)
+/* One "frame video ram vram" line of hex per frame, NULL closes the log */
+int nes_frame_hash_log(nes_t* nes, const char* file_path);
+#endif
+#endif
+
+#ifdef __cplusplus
+    }
+#endif
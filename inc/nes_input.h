@@ -0,0 +1,60 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+struct nes;
+typedef struct nes nes_t;
+
+#if (NES_INPUT_QUEUE == 1)
+
+/*
+    Input queue: host threads push (CPU cycle, joypad) events without locks, the core sets
+    nes_cpu.joypad.joypad to each event once its cycle is reached. The joypad is only visible to the
+    game through $4016/$4017, so events are applied there and at the frame end; the result is the
+    same as applying them at their exact cycle, whatever the frame batching. Events must be pushed
+    in cycle order, one whose cycle has already passed applies at the next joypad access.
+    Single producer: one host thread pushes. Events wait during run-ahead frames and movie playback.
+*/
+typedef struct nes_input_event{
+    uint64_t cycle;                         /*  CPU clock, nes_cpu.cycles_total + nes_cpu.cycles */
+    uint16_t joypad;                        /*  New nes_cpu.joypad.joypad */
+} nes_input_event_t;
+
+/* Ring and atomic indices, opaque so the header stays C++ friendly */
+typedef struct nes_input_queue nes_input_queue_t;
+
+int nes_input_init(nes_t* nes);
+void nes_input_deinit(nes_t* nes);
+/* Producer thread. NES_ERROR when the queue is full */
+int nes_input_push(nes_t* nes, uint64_t cycle, uint16_t joypad);
+/* Producer thread: CPU clock at the start of the current frame, to stamp events with */
+uint64_t nes_input_frame_clock(nes_t* nes);
+/* Core thread: drops every pending event, e.g. after nes_reset() */
+void nes_input_clear(nes_t* nes);
+/* Core thread, called at joypad accesses: applies the events that are due */
+void nes_input_apply(nes_t* nes);
+/* Called at every real (not run-ahead) frame end by nes_step_scanline(): applies the due events and publishes the frame clock */
+void nes_input_frame(nes_t* nes);
+
+#endif
+
+#ifdef __cplusplus
+    }
+#endif
@@ -0,0 +1,37 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+/*
+    Small LZ77 block codec in the LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md),
+    used for savestates and rewind. Single pass, 4KB of stack, no allocation.
+*/
+
+/* Worst case compressed size of `size` bytes */
+#define NES_LZ_BOUND(size)      ((size) + (size) / 255 + 16)
+
+/* Returns the compressed size, 0 if it does not fit in `capacity` */
+size_t nes_lz_compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity);
+/* Decodes exactly `dst_size` bytes, NES_ERROR on malformed input */
+int nes_lz_decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dst_size);
+
+#ifdef __cplusplus
+    }
+#endif
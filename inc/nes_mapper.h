@@ -38,7 +38,8 @@ typedef struct {
     void (*mapper_ppu)(nes_t* nes, uint16_t write_addr);
     /* Callback at Rendering Screen 1:BG, 0:Sprite */
     void (*mapper_render_screen)(nes_t* nes, uint8_t mode);
-    void* mapper_register;
+    void* mapper_register;      /* Per-instance mapper state, allocated by the mapper and freed in mapper_deinit */
+    uint16_t mapper_register_size; /* Bytes of mapper_register, copied by nes_state_save()/nes_clone() */
     void* mapper_data;
 } nes_mapper_t;
 
@@ -54,6 +55,7 @@ void nes_load_chrrom_8k(nes_t* nes,uint8_t des, uint8_t src);
 
 /* mapper */
 int nes_load_mapper(nes_t* nes);
+void nes_unload_mapper(nes_t* nes);
 
 /* iNES 1.0 mapper 0~255 */
 int nes_mapper0_init(nes_t* nes);
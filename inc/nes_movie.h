@@ -0,0 +1,96 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#define NES_MOVIE_MAGIC         (0x564F4D4E)    /* "NMOV" */
+#define NES_MOVIE_VERSION       (2)
+
+#define NES_MOVIE_OFF           (0)
+#define NES_MOVIE_RECORD        (1)
+#define NES_MOVIE_PLAY          (2)
+
+#define NES_MOVIE_HASH          (1 << 0)        /* Record the picture and RAM hash of every frame */
+
+#define NES_MOVIE_NO_MISMATCH   (0xFFFFFFFF)
+#define NES_MOVIE_NO_INPUT      (0xFFFFFFFF)
+
+struct nes;
+typedef struct nes nes_t;
+
+/*
+    Input movie: the snapshot the recording starts from (power-on when started right after loading
+    the ROM), the ROM hash, the joypad the game saw and the hashes of every frame. The game only
+    sees the joypad through $4016/$4017, so the recording keeps a (CPU cycle, joypad) input every
+    time an access finds it changed: queued mid-frame events and late-latch refreshes included.
+    Playback loads the snapshot and applies the inputs at the same accesses, the core is
+    deterministic so the replay is bit-identical; with NES_MOVIE_HASH every frame is checked
+    against the recorded hashes. Rewinding or loading a state while recording breaks the recording.
+*/
+typedef struct {
+    uint64_t cycle;                         /*  CPU clock of the access, nes_cpu.cycles_total + nes_cpu.cycles */
+    uint16_t joypad;                        /*  nes_cpu.joypad.joypad from that access on */
+    uint16_t reserved[3];
+} nes_movie_input_t;
+
+typedef struct {
+    uint64_t video_hash;                    /*  nes_draw_data at frame end, 0 when the picture was not drawn */
+    uint64_t ram_hash;                      /*  CPU RAM at frame end */
+    uint16_t joypad;                        /*  nes_cpu.joypad.joypad at frame end, informative: playback uses the inputs */
+    uint16_t reserved[3];
+} nes_movie_frame_t;
+
+typedef struct nes_movie{
+    uint8_t mode;                           /*  NES_MOVIE_OFF/RECORD/PLAY, playback turns OFF after the last frame */
+    uint8_t flags;
+    uint64_t rom_hash;
+    uint32_t state_size;
+    uint8_t* state;                         /*  Snapshot the movie starts from */
+    nes_movie_frame_t* frames;
+    uint32_t frame_count;
+    uint32_t frame_max;                     /*  Allocated frames */
+    nes_movie_input_t* inputs;
+    uint32_t input_count;
+    uint32_t input_max;                     /*  Allocated inputs */
+    uint32_t input;                         /*  Next input to play */
+    uint32_t joypad;                        /*  Joypad of the last input, NES_MOVIE_NO_INPUT before the first */
+    uint32_t frame;                         /*  Next frame to record or play */
+    uint32_t mismatch_frame;                /*  First frame that did not match on playback */
+} nes_movie_t;
+
+/* Starts recording from the current state */
+int nes_movie_record(nes_t* nes, uint8_t flags);
+/* Restarts the recorded or loaded movie from its first frame */
+int nes_movie_play(nes_t* nes);
+void nes_movie_deinit(nes_t* nes);
+/* Called at every frame end by nes_step_scanline(): records the frame and checks the hashes */
+void nes_movie_frame(nes_t* nes);
+/* Called at $4016/$4017 accesses while recording or playing: records the joypad the game sees or plays it back */
+void nes_movie_input(nes_t* nes);
+
+#if (NES_USE_FS == 1)
+/* header | snapshot | frames | inputs, nes_lz compressed */
+int nes_movie_save_file(nes_t* nes, const char* file_path);
+/* Fails when the movie was recorded with another ROM */
+int nes_movie_load_file(nes_t* nes, const char* file_path);
+#endif
+
+#ifdef __cplusplus
+    }
+#endif
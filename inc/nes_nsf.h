@@ -0,0 +1,78 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#define NES_NSF_HEADER_SIZE     (0x80)
+#define NES_NSF_TEXT_SIZE       (32)
+#define NES_NSF_BANK_SIZE       (0x1000)    /* 4K */
+#define NES_NSF_PLAY_SPEED      (16639)     /* NTSC default, 60.1Hz in microseconds */
+
+struct nes;
+typedef struct nes nes_t;
+
+/*
+NSF: https://www.nesdev.org/wiki/NSF
+$00 "NESM" $1A  $05 version  $06 total songs  $07 starting song (1-based)
+$08 load address  $0A init address  $0C play address  (16-bit little endian, $8000-$FFFF)
+$0E song name  $2E artist  $4E copyright  (32 bytes, null terminated)
+$6E NTSC play speed (us)  $70 bankswitch init[8]  $78 PAL play speed (us)
+$7A PAL/NTSC bits  $7B extra sound chips  $7C NSF2  $7D program data size (24-bit)
+*/
+
+/* NSF player state, stored in nes_mapper.mapper_register while an NSF is loaded */
+typedef struct nes_nsf{
+    uint8_t total_songs;
+    uint8_t starting_song;              /*  0-based */
+    uint8_t current_song;               /*  0-based */
+    uint8_t bank_enable;                /*  $5FF8-$5FFF bank switching is used */
+    uint16_t load_address;
+    uint16_t init_address;
+    uint16_t play_address;
+    uint16_t play_speed;                /*  PLAY period in microseconds */
+    uint32_t play_phase;                /*  Fraction of a CPU cycle carried between PLAY periods, in 1/1000000 */
+    uint8_t bankswitch_init[8];
+    char song_name[NES_NSF_TEXT_SIZE + 1];
+    char artist[NES_NSF_TEXT_SIZE + 1];
+    char copyright[NES_NSF_TEXT_SIZE + 1];
+    const uint8_t* data;                /*  Program data in the loaded image, starting at load_address (or its 4K bank) */
+    uint32_t data_size;
+    const uint8_t* track_times;         /*  NSFe "time" chunk: int32 milliseconds per track, NULL if absent */
+    uint8_t track_times_count;
+    uint8_t* file;                      /*  File buffer owned by nes_nsf_load_file() */
+    uint8_t prg_window[0x8000];         /*  $8000-$FFFF as seen by the CPU, mapped with nes_load_prgrom_8k() */
+} nes_nsf_t;
+
+/*
+    Loads an NSF or NSFe image. Like nes_load_rom(), the program data and the NSFe "time" chunk are
+    used in place: `data` must stay valid until nes_nsf_unload() or the next nes_nsf_load().
+    nes_nsf_load_file() keeps its own buffer.
+*/
+int nes_nsf_load(nes_t* nes, const uint8_t* data, size_t size);
+int nes_nsf_unload(nes_t* nes);
+#if (NES_USE_FS == 1)
+int nes_nsf_load_file(nes_t* nes, const char* file_path);
+#endif
+int nes_nsf_init(nes_t* nes, uint8_t song);
+void nes_nsf_frame(nes_t* nes);
+int32_t nes_nsf_track_time(nes_t* nes, uint8_t song);
+
+#ifdef __cplusplus
+    }
+#endif
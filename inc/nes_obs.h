@@ -0,0 +1,59 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+struct nes;
+typedef struct nes nes_t;
+
+#define NES_OBS_GRAY            (1)     /* Channels: luma */
+#define NES_OBS_RGB             (3)     /* Channels: R, G, B interleaved */
+
+/*
+    Downsampled observation: each visible line is box-filtered into `width` x `height` 8-bit pixels
+    right after it is rendered, so the picture only ever exists one line at a time. While an
+    observation is attached, lines are rendered into the first line of nes_draw_data and nes_draw()
+    is not called; NES_STEP_FRAME_READY means `data` is complete. Frames with NES_HIDDEN_VIDEO leave
+    `data` untouched.
+*/
+typedef struct nes_obs{
+    uint16_t width;
+    uint16_t height;
+    uint8_t channels;                       /*  NES_OBS_GRAY or NES_OBS_RGB */
+    uint8_t* data;                          /*  width * height * channels, rows top to bottom */
+    uint32_t* sums;                         /*  Lines of the output row being accumulated, per source pixel */
+    uint16_t lines;                         /*  Source lines in `sums` */
+    uint16_t line_next;                     /*  Scanline that continues the row in `sums` */
+    uint32_t frame;                         /*  nes_frame_count of the lines in `sums` */
+    uint16_t* column_pixels;                /*  Source pixels of each output column */
+    uint16_t* row;                          /*  Output row of each source line */
+    uint16_t column_pixels_min;
+    uint16_t lines_min;                     /*  Source lines of the shortest output row */
+    uint64_t reciprocals[2][2];             /*  2^56 / divisor by [lines - lines_min][column pixels - column_pixels_min] */
+} nes_obs_t;
+
+/* width 1-256, height 1-240, channels NES_OBS_GRAY or NES_OBS_RGB */
+int nes_obs_init(nes_t* nes, uint16_t width, uint16_t height, uint8_t channels);
+void nes_obs_deinit(nes_t* nes);
+/* Called by nes_step_scanline() for every rendered visible line */
+void nes_obs_line(nes_t* nes, const nes_color_t* line);
+
+#ifdef __cplusplus
+    }
+#endif
@@ -0,0 +1,72 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+struct nes;
+typedef struct nes nes_t;
+
+/*
+    Rewind history: a snapshot is captured at the end of every `interval`-th frame. Each entry holds the
+    64-byte blocks that changed since the previous snapshot, XORed with their old content and nes_lz
+    compressed, in a fixed-size byte ring; the oldest entries are dropped when it is full. Only the newest snapshot is kept uncompressed, stepping back
+    XORs the newest entry into it.
+*/
+typedef struct {
+    uint32_t offset;                        /*  In data */
+    uint32_t size;                          /*  Compressed size */
+    uint32_t delta_size;                    /*  Uncompressed size */
+} nes_rewind_entry_t;
+
+typedef struct nes_rewind{
+    uint8_t* data;                          /*  Byte ring of compressed deltas */
+    uint32_t data_size;
+    uint32_t write_offset;
+    nes_rewind_entry_t* entries;            /*  Ring of entries, oldest at entry_first */
+    uint32_t entry_max;
+    uint32_t entry_first;
+    uint32_t entry_count;
+    uint32_t state_size;
+    uint8_t* state;                         /*  Newest snapshot */
+    uint8_t* scratch;                       /*  Snapshot of the capture in progress */
+    uint8_t* delta;                         /*  Changed blocks of the capture in progress, then their compressed form */
+    uint32_t delta_max;                     /*  Largest delta: every block changed */
+    uint16_t interval;
+    uint16_t frame;                         /*  Frames since the last capture */
+    uint8_t has_state;
+    uint8_t state_loaded;                   /*  `state` was loaded by nes_rewind_step(), the next step pops */
+    uint8_t paused;                         /*  No captures, e.g. while the host is rewinding */
+} nes_rewind_t;
+
+/* size: bytes of compressed history, interval: frames between captures */
+int nes_rewind_init(nes_t* nes, size_t size, uint16_t interval);
+void nes_rewind_deinit(nes_t* nes);
+/* Called at every frame end by nes_step_scanline(), captures every `interval` frames */
+void nes_rewind_frame(nes_t* nes);
+int nes_rewind_capture(nes_t* nes);
+/* Stops captures while the host is stepping back */
+void nes_rewind_pause(nes_t* nes, uint8_t paused);
+/* Loads the previous captured state, NES_ERROR when the history is exhausted */
+int nes_rewind_step(nes_t* nes);
+/* Number of states nes_rewind_step() can still go back to */
+uint32_t nes_rewind_count(nes_t* nes);
+
+#ifdef __cplusplus
+    }
+#endif
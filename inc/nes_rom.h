@@ -124,6 +124,12 @@ typedef struct {
     };                                  /*  Default Expansion Device */
 } nes_header_nes2_t;
 
+#if (NES_USE_FS == 1) && (NES_ROM_CACHE == 1)
+typedef struct nes_rom_image nes_rom_image_t;
+/* ROM files currently shared by nes_load_file() instances */
+uint32_t nes_rom_cache_images(void);
+#endif
+
 typedef struct nes_rom_info{
     uint16_t prg_rom_size;
     uint16_t chr_rom_size;
@@ -134,6 +140,9 @@ typedef struct nes_rom_info{
     uint8_t  mirroring_type;            /*  0: Horizontal or mapper-controlled 1: Vertical */
     uint8_t  four_screen;               /*  0: No 1: Yes */
     uint8_t  save_ram;                  /*  0: Not present 1: Present */
+#if (NES_USE_FS == 1) && (NES_ROM_CACHE == 1)
+    nes_rom_image_t* image;             /*  Shared file PRG/CHR ROM point into, NULL when they are owned */
+#endif
 } nes_rom_info_t;
 
 #ifdef __cplusplus          
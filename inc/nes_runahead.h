@@ -0,0 +1,46 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+struct nes;
+typedef struct nes nes_t;
+
+/*
+    Run-ahead: every host frame runs the real frame (sound, no picture), saves the state, runs
+    `frames` speculative frames with the same input and shows the picture of the last one, then
+    loads the state back. Games that react to input one or more frames late then respond on the
+    next displayed frame. Hidden frames skip the background/sprite drawing and the audio mix,
+    sprite 0 hit and the sprite overflow flag are still evaluated.
+*/
+typedef struct nes_runahead{
+    uint8_t frames;                         /*  Speculative frames per host frame */
+    uint32_t state_size;
+    uint8_t* state;                         /*  State after the real frame */
+} nes_runahead_t;
+
+/* frames: 1-2 removes the usual lag of most games, 0 turns run-ahead off */
+int nes_runahead_init(nes_t* nes, uint8_t frames);
+void nes_runahead_deinit(nes_t* nes);
+/* One host frame, replaces nes_step_frame(). Returns the nes_step_* flags of the real frame plus NES_STEP_FRAME_READY */
+int nes_runahead_frame(nes_t* nes);
+
+#ifdef __cplusplus
+    }
+#endif
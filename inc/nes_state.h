@@ -0,0 +1,53 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#define NES_STATE_MAGIC         (0x5353454E)    /* "NESS" */
+#define NES_STATE_VERSION       (3)
+
+struct nes;
+typedef struct nes nes_t;
+
+/*
+    In-memory snapshot of the mutable emulator state: CPU/PPU/APU registers, RAM, VRAM, OAM,
+    mapper registers, SRAM and CHR-RAM. Bank pointers are stored as offsets, so a snapshot can be
+    loaded into any instance running the same ROM. The snapshot is tied to this build (raw structs).
+    The audio output side (format, block being filled) belongs to the host and is not part of it.
+*/
+size_t nes_state_size(nes_t* nes);
+int nes_state_save(nes_t* nes, void* buffer, size_t size);
+int nes_state_load(nes_t* nes, const void* buffer, size_t size);
+
+#define NES_STATE_FILE_MAGIC    (0x5641534E)    /* "NSAV" */
+#define NES_STATE_FILE_LZ       (1 << 0)        /* Compress chunks */
+
+#if (NES_USE_FS == 1)
+/* Chunked savestate file (CPU, PPU, APU, mapper, SRAM, ...), streamed through the nes_f* port hooks */
+int nes_state_save_file(nes_t* nes, const char* file_path, uint8_t flags);
+int nes_state_load_file(nes_t* nes, const char* file_path);
+#endif
+
+/* Copy of `nes` sharing its ROM image, `nes` must outlive it. Release with nes_clone_free() */
+nes_t* nes_clone(nes_t* nes);
+void nes_clone_free(nes_t* clone);
+
+#ifdef __cplusplus
+    }
+#endif
@@ -81,7 +81,7 @@ int nes_log_printf(const char *format, ...){
 
 #if (NES_ENABLE_SOUND == 1)
 
-int nes_sound_output(uint8_t *buffer, size_t len){
+int nes_sound_output(nes_t* nes, uint8_t *buffer, size_t len){
     return 0;
 }
 #endif
@@ -94,7 +94,7 @@ int nes_deinitex(nes_t *nes){
     return 0;
 }
 
-int nes_draw(int x1, int y1, int x2, int y2, nes_color_t* color_data){
+int nes_draw(nes_t* nes, int x1, int y1, int x2, int y2, nes_color_t* color_data){
     return 0;
 }
 
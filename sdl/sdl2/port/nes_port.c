@@ -61,63 +61,128 @@ int nes_fclose(FILE *stream ){
 }
 #endif
 
-static SDL_Window *window = NULL;
-static SDL_Renderer *renderer = NULL;
-static SDL_Texture *framebuffer = NULL;
+#define SDL_FRAME_BUFFERS               (3)
+#define SDL_FRAME_FRESH                 (1 << 2)    /*  frame_ready: holds a frame that was not shown yet */
+#define SDL_BUTTONS_REWIND              (1 << 16)   /*  buttons: R is held */
 
+/* Intervals between frames on one side, in performance counter ticks */
+typedef struct {
+    uint64_t last;
+    uint64_t max;
+    double sum;
+    double sum_squares;
+    uint32_t count;
+} sdl_jitter_t;
+
+/* Port state of one instance, kept in nes->user_data */
+typedef struct {
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    SDL_Texture *framebuffer;
+#if (NES_ENABLE_SOUND == 1)
+    SDL_AudioDeviceID audio_device;
+#endif
+    nes_joypad_t joypad;                /*  Keyboard, owned by the thread that polls events */
+    uint8_t rewinding;                  /*  R is held */
+    uint8_t threaded;                   /*  nes_run() is on its own thread, see nes_sdl_run() */
+    SDL_atomic_t buttons;               /*  joypad.joypad | SDL_BUTTONS_REWIND, for the emulation */
+    SDL_atomic_t quit;
+    /*
+        Triple buffer: the emulation draws into frames[frame_write], the presenter shows frames[frame_read]
+        and the newest finished frame waits in frame_ready. Each side swaps its buffer with frame_ready,
+        neither ever waits for the other; a frame the presenter did not get to in time is dropped.
+    */
+    nes_color_t* frames[SDL_FRAME_BUFFERS];
+    int frame_write;
+    int frame_read;
+    uint8_t frame_drawn;                /*  frames[frame_write] holds a complete picture */
+    SDL_atomic_t frame_ready;           /*  Buffer index | SDL_FRAME_FRESH */
+    uint64_t deadline;                  /*  Performance counter value the next frame is due at */
+    sdl_jitter_t emulation_jitter;
+    sdl_jitter_t present_jitter;
+} nes_sdl_t;
+
+static void sdl_jitter_add(sdl_jitter_t* jitter) {
+    const uint64_t now = SDL_GetPerformanceCounter();
+    if (jitter->last) {
+        const uint64_t interval = now - jitter->last;
+        jitter->max = interval > jitter->max ? interval : jitter->max;
+        jitter->sum += (double)interval;
+        jitter->sum_squares += (double)interval * (double)interval;
+        jitter->count++;
+    }
+    jitter->last = now;
+}
+
+static void sdl_jitter_log(const char* name, const sdl_jitter_t* jitter) {
+    if (jitter->count == 0) {
+        return;
+    }
+    const double ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    const double mean = jitter->sum / jitter->count;
+    const double variance = jitter->sum_squares / jitter->count - mean * mean;
+    SDL_Log("%s: %u frames, every %.2f ms, jitter %.2f ms, longest %.2f ms", name, (unsigned)jitter->count,
+            mean * ms, SDL_sqrt(variance > 0 ? variance : 0) * ms, (double)jitter->max * ms);
+}
+
+// Drains every pending event, key changes between two polls are all applied
 static void sdl_event(nes_t *nes) {
+    nes_sdl_t* sdl = (nes_sdl_t*)nes->user_data;
     SDL_Event event;
-    if (SDL_PollEvent(&event)){
+    while (SDL_PollEvent(&event)){
         switch (event.type) {
             case SDL_KEYDOWN:
                 switch (event.key.keysym.scancode){
                     case 26://W
-                        nes->nes_cpu.joypad.U1 = 1;
+                        sdl->joypad.U1 = 1;
                         break;
                     case 22://S
-                        nes->nes_cpu.joypad.D1 = 1;
+                        sdl->joypad.D1 = 1;
                         break;
                     case 4://A
-                        nes->nes_cpu.joypad.L1 = 1;
+                        sdl->joypad.L1 = 1;
                         break;
                     case 7://D
-                        nes->nes_cpu.joypad.R1 = 1;
+                        sdl->joypad.R1 = 1;
                         break;
                     case 13://J
-                        nes->nes_cpu.joypad.A1 = 1;
+                        sdl->joypad.A1 = 1;
                         break;
                     case 14://K
-                        nes->nes_cpu.joypad.B1 = 1;
+                        sdl->joypad.B1 = 1;
                         break;
                     case 25://V
-                        nes->nes_cpu.joypad.SE1 = 1;
+                        sdl->joypad.SE1 = 1;
                         break;
                     case 5://B
-                        nes->nes_cpu.joypad.ST1 = 1;
+                        sdl->joypad.ST1 = 1;
                         break;
                     case 82://↑
-                        nes->nes_cpu.joypad.U2 = 1;
+                        sdl->joypad.U2 = 1;
                         break;
                     case 81://↓
-                        nes->nes_cpu.joypad.D2 = 1;
+                        sdl->joypad.D2 = 1;
                         break;
                     case 80://←
-                        nes->nes_cpu.joypad.L2 = 1;
+                        sdl->joypad.L2 = 1;
                         break;
                     case 79://→
-                        nes->nes_cpu.joypad.R2 = 1;
+                        sdl->joypad.R2 = 1;
                         break;
                     case 93://5
-                        nes->nes_cpu.joypad.A2 = 1;
+                        sdl->joypad.A2 = 1;
                         break;
                     case 94://6
-                        nes->nes_cpu.joypad.B2 = 1;
+                        sdl->joypad.B2 = 1;
                         break;
                     case 89://1
-                        nes->nes_cpu.joypad.SE2 = 1;
+                        sdl->joypad.SE2 = 1;
                         break;
                     case 90://2
-                        nes->nes_cpu.joypad.ST2 = 1;
+                        sdl->joypad.ST2 = 1;
+                        break;
+                    case 21://R
+                        sdl->rewinding = 1;
                         break;
                     default:
                         break;
@@ -126,155 +191,309 @@ static void sdl_event(nes_t *nes) {
             case SDL_KEYUP:
                 switch (event.key.keysym.scancode){
                     case 26://W
-                        nes->nes_cpu.joypad.U1 = 0;
+                        sdl->joypad.U1 = 0;
                         break;
                     case 22://S
-                        nes->nes_cpu.joypad.D1 = 0;
+                        sdl->joypad.D1 = 0;
                         break;
                     case 4://A
-                        nes->nes_cpu.joypad.L1 = 0;
+                        sdl->joypad.L1 = 0;
                         break;
                     case 7://D
-                        nes->nes_cpu.joypad.R1 = 0;
+                        sdl->joypad.R1 = 0;
                         break;
                     case 13://J
-                        nes->nes_cpu.joypad.A1 = 0;
+                        sdl->joypad.A1 = 0;
                         break;
                     case 14://K
-                        nes->nes_cpu.joypad.B1 = 0;
+                        sdl->joypad.B1 = 0;
                         break;
                     case 25://V
-                        nes->nes_cpu.joypad.SE1 = 0;
+                        sdl->joypad.SE1 = 0;
                         break;
                     case 5://B
-                        nes->nes_cpu.joypad.ST1 = 0;
+                        sdl->joypad.ST1 = 0;
                         break;
                     case 82://↑
-                        nes->nes_cpu.joypad.U2 = 0;
+                        sdl->joypad.U2 = 0;
                         break;
                     case 81://↓
-                        nes->nes_cpu.joypad.D2 = 0;
+                        sdl->joypad.D2 = 0;
                         break;
                     case 80://←
-                        nes->nes_cpu.joypad.L2 = 0;
+                        sdl->joypad.L2 = 0;
                         break;
                     case 79://→
-                        nes->nes_cpu.joypad.R2 = 0;
+                        sdl->joypad.R2 = 0;
                         break;
                     case 93://5
-                        nes->nes_cpu.joypad.A2 = 0;
+                        sdl->joypad.A2 = 0;
                         break;
                     case 94://6
-                        nes->nes_cpu.joypad.B2 = 0;
+                        sdl->joypad.B2 = 0;
                         break;
                     case 89://1
-                        nes->nes_cpu.joypad.SE2 = 0;
+                        sdl->joypad.SE2 = 0;
                         break;
                     case 90://2
-                        nes->nes_cpu.joypad.ST2 = 0;
+                        sdl->joypad.ST2 = 0;
+                        break;
+                    case 21://R
+                        sdl->rewinding = 0;
                         break;
                     default:
                         break;
                     }
                 break;
             case SDL_QUIT:
-                nes_deinit(nes);
-                return;
+                SDL_AtomicSet(&sdl->quit, 1);
+                break;
         }
     }
+    SDL_AtomicSet(&sdl->buttons, sdl->joypad.joypad | (sdl->rewinding ? SDL_BUTTONS_REWIND : 0));
+}
+
+// Called by the core when the game strobes the joypad: input is read as late as possible
+static void sdl_input_latch(nes_t *nes) {
+    nes_sdl_t* sdl = (nes_sdl_t*)nes->user_data;
+    if (!sdl->threaded) {
+        sdl_event(nes);
+    }
+    nes->nes_cpu.joypad.joypad = (uint16_t)SDL_AtomicGet(&sdl->buttons);
+}
+
+// Presenter: uploads and shows the newest finished frame, 0 when none arrived since the last call
+static int sdl_present(nes_sdl_t* sdl) {
+    if ((SDL_AtomicGet(&sdl->frame_ready) & SDL_FRAME_FRESH) == 0) {
+        return 0;
+    }
+    sdl->frame_read = SDL_AtomicSet(&sdl->frame_ready, sdl->frame_read) & ~SDL_FRAME_FRESH;
+    SDL_UpdateTexture(sdl->framebuffer, NULL, sdl->frames[sdl->frame_read], NES_WIDTH * (int)sizeof(nes_color_t));
+    SDL_RenderCopy(sdl->renderer, sdl->framebuffer, NULL, NULL);
+    SDL_RenderPresent(sdl->renderer);
+    sdl_jitter_add(&sdl->present_jitter);
+    return 1;
 }
 
 #if (NES_ENABLE_SOUND == 1)
 
-static SDL_AudioDeviceID nes_audio_device;
 #define SDL_AUDIO_NUM_CHANNELS          (1)
+#define SDL_AUDIO_QUEUE_BLOCKS          (3)     /* Blocks queued at most before new ones are dropped */
 
 
-static uint8_t apu_output = 0;
-static void AudioCallback(void* userdata, Uint8* stream, int len) {
-    (void)len;
-    nes_t *nes = (nes_t*)userdata;
-    if (apu_output){
-        nes_memcpy(stream, &nes->nes_apu.sample_buffer , NES_APU_SAMPLE_PER_SYNC);
-        apu_output = 0;
+int nes_sound_output(nes_t* nes, uint8_t *buffer, size_t len){
+    nes_sdl_t* sdl = (nes_sdl_t*)nes->user_data;
+    // Emulation pacing and the audio clock drift apart: drop a block rather than let latency grow
+    if (SDL_GetQueuedAudioSize(sdl->audio_device) > SDL_AUDIO_QUEUE_BLOCKS * len){
+        return 0;
     }
-}
-
-int nes_sound_output(uint8_t *buffer, size_t len){
-    (void)buffer;
-    (void)len;
-    apu_output = 1;
+    SDL_QueueAudio(sdl->audio_device, buffer, (Uint32)len);
     return 0;
 }
 #endif
 
 int nes_initex(nes_t *nes){
-    if (SDL_Init(SDL_INIT_VIDEO|SDL_INIT_AUDIO|SDL_INIT_JOYSTICK| SDL_INIT_TIMER)) {
+    if (SDL_InitSubSystem(SDL_INIT_VIDEO|SDL_INIT_AUDIO|SDL_INIT_JOYSTICK| SDL_INIT_TIMER)) {
         SDL_Log("Can not init video, %s", SDL_GetError());
         return -1;
     }
-    window = SDL_CreateWindow(
+    nes_sdl_t* sdl = (nes_sdl_t*)SDL_calloc(1, sizeof(nes_sdl_t));
+    if (sdl == NULL) {
+        SDL_QuitSubSystem(SDL_INIT_VIDEO|SDL_INIT_AUDIO|SDL_INIT_JOYSTICK| SDL_INIT_TIMER);
+        return -1;
+    }
+    nes->user_data = sdl;
+    nes->nes_input_latch = sdl_input_latch;
+    for (int i = 0; i < SDL_FRAME_BUFFERS; i++) {
+        sdl->frames[i] = (nes_color_t*)SDL_calloc(NES_WIDTH * NES_HEIGHT, sizeof(nes_color_t));
+        if (sdl->frames[i] == NULL) {
+            goto error;
+        }
+    }
+    sdl->frame_write = 0;
+    SDL_AtomicSet(&sdl->frame_ready, 1);
+    sdl->frame_read = 2;
+#if (NES_DRAW_LINES == NES_HEIGHT)
+    // Lines are rendered straight into the triple buffer
+    nes_set_framebuffer(nes, sdl->frames[sdl->frame_write], NES_WIDTH);
+#endif
+    sdl->window = SDL_CreateWindow(
             NES_NAME,
             SDL_WINDOWPOS_UNDEFINED,
             SDL_WINDOWPOS_UNDEFINED,
             NES_WIDTH * 2, NES_HEIGHT * 2,      // 二倍分辨率
             SDL_WINDOW_SHOWN|SDL_WINDOW_ALLOW_HIGHDPI
     );
-    if (window == NULL) {
+    if (sdl->window == NULL) {
         SDL_Log("Can not create window, %s", SDL_GetError());
-        return -1;
+        goto error;
     }
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
-    framebuffer = SDL_CreateTexture(renderer,
+    sdl->renderer = SDL_CreateRenderer(sdl->window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE | SDL_RENDERER_PRESENTVSYNC);
+    if (sdl->renderer == NULL) {
+        SDL_Log("Can not create renderer, %s", SDL_GetError());
+        goto error;
+    }
+    sdl->framebuffer = SDL_CreateTexture(sdl->renderer,
                                     SDL_PIXELFORMAT_ARGB8888,
                                     SDL_TEXTUREACCESS_STREAMING,
                                     NES_WIDTH,
                                     NES_HEIGHT);
+    if (sdl->framebuffer == NULL) {
+        SDL_Log("Can not create texture, %s", SDL_GetError());
+        goto error;
+    }
 #if (NES_ENABLE_SOUND == 1)
+    const nes_apu_config_t apu_config = {
+        .sample_rate = NES_APU_SAMPLE_RATE,
+        .format = NES_APU_FORMAT_S16,
+        .block_size = NES_APU_SAMPLE_PER_SYNC,
+    };
+    nes_apu_config(nes, &apu_config);
     SDL_AudioSpec desired = {
         .freq = NES_APU_SAMPLE_RATE,
-        .format = AUDIO_S8,
+        .format = AUDIO_S16SYS,
         .channels = SDL_AUDIO_NUM_CHANNELS,
         .samples = NES_APU_SAMPLE_PER_SYNC,
-        .callback = AudioCallback,
-        .userdata = nes
+        .callback = NULL,
     };
-    nes_audio_device = SDL_OpenAudioDevice(NULL, SDL_FALSE, &desired, NULL, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
-    if (!nes_audio_device) {
+    sdl->audio_device = SDL_OpenAudioDevice(NULL, SDL_FALSE, &desired, NULL, 0);
+    if (!sdl->audio_device) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't open audio: %s\n", SDL_GetError());
     }
-    SDL_PauseAudioDevice(nes_audio_device, SDL_FALSE);
+    SDL_PauseAudioDevice(sdl->audio_device, SDL_FALSE);
 #endif
     return 0;
+error:
+    // Unwind whatever was created, nes_init() fails with it
+    nes_deinitex(nes);
+    return -1;
 }
 
 int nes_deinitex(nes_t *nes){
-    (void)nes;
-    SDL_DestroyTexture(framebuffer);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
+    nes_sdl_t* sdl = (nes_sdl_t*)nes->user_data;
+    if (sdl == NULL) {
+        return 0;
+    }
+#if (NES_ENABLE_SOUND == 1)
+    if (sdl->audio_device) {
+        SDL_CloseAudioDevice(sdl->audio_device);
+    }
+#endif
+    if (sdl->framebuffer) {
+        SDL_DestroyTexture(sdl->framebuffer);
+    }
+    if (sdl->renderer) {
+        SDL_DestroyRenderer(sdl->renderer);
+    }
+    if (sdl->window) {
+        SDL_DestroyWindow(sdl->window);
+    }
+    for (int i = 0; i < SDL_FRAME_BUFFERS; i++) {
+        SDL_free(sdl->frames[i]);
+    }
+    SDL_free(sdl);
+    nes->user_data = NULL;
+    nes->nes_input_latch = NULL;
+    SDL_QuitSubSystem(SDL_INIT_VIDEO|SDL_INIT_AUDIO|SDL_INIT_JOYSTICK| SDL_INIT_TIMER);
     return 0;
 }
 
-int nes_draw(int x1, int y1, int x2, int y2, nes_color_t* color_data){
-    if (!framebuffer){
+int nes_draw(nes_t* nes, int x1, int y1, int x2, int y2, nes_color_t* color_data){
+    nes_sdl_t* sdl = (nes_sdl_t*)nes->user_data;
+    if (!sdl || !sdl->frames[0]){
         return -1;
     }
-    SDL_Rect rect;
-    rect.x = x1;
-    rect.y = y1;
-    rect.w = x2 - x1 + 1;
-    rect.h = y2 - y1 + 1;
-    SDL_UpdateTexture(framebuffer, &rect, color_data, rect.w * 4);
+    nes_color_t* frame = sdl->frames[sdl->frame_write];
+    if (color_data != frame + y1 * NES_WIDTH + x1){
+        // Streaming (NES_DRAW_LINES < NES_HEIGHT): blocks of lines come from the core's own ring
+        const int width = x2 - x1 + 1;
+        for (int y = y1; y <= y2; y++){
+            SDL_memcpy(frame + y * NES_WIDTH + x1, color_data, width * sizeof(nes_color_t));
+            color_data += width;
+        }
+    }
+    if (y2 == NES_HEIGHT - 1){
+        sdl->frame_drawn = 1;
+    }
     return 0;
 }
 
-#define FRAMES_PER_SECOND   1000/60
+// Emulation: one frame every 1/60.0988 s by the performance counter, a late frame moves the schedule
+static void sdl_pace(nes_sdl_t* sdl){
+    const uint64_t frequency = SDL_GetPerformanceFrequency();
+    const uint64_t period = frequency * 10000 / 600988;
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (sdl->deadline == 0 || now > sdl->deadline + period){
+        sdl->deadline = now;
+    }
+    sdl->deadline += period;
+    while ((now = SDL_GetPerformanceCounter()) < sdl->deadline){
+        const uint64_t ms = (sdl->deadline - now) * 1000 / frequency;
+        SDL_Delay(ms > 1 ? (Uint32)(ms - 1) : 0);       // Sleep most of the wait, yield through the last ms
+    }
+    sdl_jitter_add(&sdl->emulation_jitter);
+}
 
 void nes_frame(nes_t* nes){
-    SDL_RenderCopy(renderer, framebuffer, NULL, NULL);
-    SDL_RenderPresent(renderer);
-    sdl_event(nes);
-    SDL_Delay(FRAMES_PER_SECOND);
+    nes_sdl_t* sdl = (nes_sdl_t*)nes->user_data;
+    if (sdl == NULL){
+        nes->nes_quit = 1;
+        return;
+    }
+    if (sdl->frame_drawn){
+        // Hand the picture over and draw the next one into the buffer that comes back
+        sdl->frame_write = SDL_AtomicSet(&sdl->frame_ready, sdl->frame_write | SDL_FRAME_FRESH) & ~SDL_FRAME_FRESH;
+        sdl->frame_drawn = 0;
+#if (NES_DRAW_LINES == NES_HEIGHT)
+        nes_set_framebuffer(nes, sdl->frames[sdl->frame_write], NES_WIDTH);
+#endif
+    }
+    if (!sdl->threaded){
+        sdl_present(sdl);
+        sdl_event(nes);
+    }
+    const int buttons = SDL_AtomicGet(&sdl->buttons);
+    if (nes->nes_movie == NULL || nes->nes_movie->mode != NES_MOVIE_PLAY){
+        nes->nes_cpu.joypad.joypad = (uint16_t)buttons;
+    }
+    if (SDL_AtomicGet(&sdl->quit)){
+        nes->nes_quit = 1;
+    }
+    nes_rewind_pause(nes, (buttons & SDL_BUTTONS_REWIND) != 0);
+    if (buttons & SDL_BUTTONS_REWIND){
+        nes_rewind_step(nes);
+    }
+    sdl_pace(sdl);
+}
+
+static int SDLCALL sdl_emulation_thread(void* data){
+    nes_t* nes = (nes_t*)data;
+    nes_run(nes);
+    SDL_AtomicSet(&((nes_sdl_t*)nes->user_data)->quit, 1);
+    return 0;
+}
+
+void nes_sdl_run(nes_t* nes){
+    nes_sdl_t* sdl = (nes_sdl_t*)nes->user_data;
+    if (sdl == NULL){
+        return;
+    }
+    // Events and rendering stay on this (main) thread, as SDL requires
+    sdl->threaded = 1;
+    SDL_Thread* thread = SDL_CreateThread(sdl_emulation_thread, "nes", nes);
+    if (thread == NULL){
+        // No threads, e.g. wasm without pthreads: nes_frame() presents
+        sdl->threaded = 0;
+        nes_run(nes);
+    }else{
+        while (SDL_AtomicGet(&sdl->quit) == 0){
+            sdl_event(nes);
+            if (!sdl_present(sdl)){
+                SDL_Delay(1);
+            }
+        }
+        SDL_WaitThread(thread, NULL);
+    }
+    sdl_jitter_log("emulation", &sdl->emulation_jitter);
+    sdl_jitter_log("present", &sdl->present_jitter);
 }
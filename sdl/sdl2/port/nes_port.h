@@ -0,0 +1,33 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "nes.h"
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+/*
+    Runs nes_run() on an emulation thread until quit while the calling (main) thread polls events and
+    presents the frames, so vsync and driver stalls do not hold up the emulation. Logs the frame
+    intervals and jitter of both sides when done.
+*/
+void nes_sdl_run(nes_t* nes);
+
+#ifdef __cplusplus
+    }
+#endif
@@ -15,21 +15,58 @@
  */
 
 #include "nes.h"
+#include "nes_port.h"
+
+#include <stdlib.h>
 
 
 int main(int argc, char** argv){
     nes_t* nes = nes_init();
-    if (argc == 2){
-        const char* nes_file_path = argv[1];
+    if (nes == NULL){
+        NES_LOG_ERROR("nes init fail\n");
+        return -1;
+    }
+    // nes <xxx.nes> [session.nmv] [-r] [-a frames]
+    const char* nes_file_path = argc >= 2 ? argv[1] : NULL;
+    const char* movie_path = NULL;
+    uint8_t rewind_enable = 0;
+    uint8_t runahead = 0;
+    for (int i = 2; i < argc; i++){
+        if (strcmp(argv[i], "-r") == 0){
+            rewind_enable = 1;
+        }else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc){
+            runahead = (uint8_t)atoi(argv[++i]);
+        }else if (argv[i][0] != '-' && movie_path == NULL){
+            movie_path = argv[i];
+        }else{
+            NES_LOG_ERROR("unknown option %s\n", argv[i]);
+            goto error;
+        }
+    }
+    if (nes_file_path){
         size_t nes_file_path_len = strlen(nes_file_path);
-        if (nes_memcmp(nes_file_path+nes_file_path_len-4,".nes",4)==0 || nes_memcmp(nes_file_path+nes_file_path_len-4,".NES",4)==0){
+        if (nes_file_path_len >= 4 && (nes_memcmp(nes_file_path+nes_file_path_len-4,".nes",4)==0 || nes_memcmp(nes_file_path+nes_file_path_len-4,".NES",4)==0)){
             NES_LOG_INFO("nes_file_path:%s\n",nes_file_path);
             int ret = nes_load_file(nes, nes_file_path);
             if (ret){
                 NES_LOG_ERROR("nes load file fail\n");
                 goto error;
             }
-            nes_run(nes);
+            if (movie_path){
+                // Record the session from power-on, replay with headless nes_movie
+                nes_movie_record(nes, NES_MOVIE_HASH);
+            }else if (rewind_enable){
+                // Hold R to rewind: 4MB of history, one capture every 2 frames
+                nes_rewind_init(nes, 4 * 1024 * 1024, 2);
+            }
+            if (runahead){
+                // Run frames ahead: cuts as many frames of input lag, each real frame is then emulated hidden
+                nes_runahead_init(nes, runahead);
+            }
+            nes_sdl_run(nes);
+            if (movie_path && nes_movie_save_file(nes, movie_path)){
+                NES_LOG_ERROR("failed to write %s\n", movie_path);
+            }
             nes_unload_file(nes);
             nes_deinit(nes);
             return 0;
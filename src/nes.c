@@ -45,13 +45,47 @@ nes_t* nes_init(void){
         return NULL;
     }
     nes_memset(nes, 0, sizeof(nes_t));
-    nes_initex(nes);
+    if (nes_set_framebuffer(nes, NULL, 0)){
+        nes_free(nes);
+        return NULL;
+    }
+#if (NES_DIRTY_TILE > 0)
+    nes_dirty_invalidate(nes);
+#endif
+    if (nes_initex(nes)){
+        // The port has unwound its own state, only the core buffers are left
+        NES_LOG_ERROR("nes_initex failed\n");
+#if (NES_ENABLE_SOUND==1)
+        nes_apu_deinit(nes);
+#endif
+        if (nes->nes_draw_buffer){
+            nes_free(nes->nes_draw_buffer);
+        }
+        nes_free(nes);
+        return NULL;
+    }
     return nes;
 }
 
 int nes_deinit(nes_t *nes){
     nes->nes_quit = 1;
     nes_deinitex(nes);
+    nes_rewind_deinit(nes);
+    nes_runahead_deinit(nes);
+    nes_movie_deinit(nes);
+    nes_obs_deinit(nes);
+#if (NES_INPUT_QUEUE == 1)
+    nes_input_deinit(nes);
+#endif
+#if (NES_FRAME_HASH == 1) && (NES_USE_FS == 1)
+    nes_frame_hash_log(nes, NULL);
+#endif
+#if (NES_ENABLE_SOUND==1)
+    nes_apu_deinit(nes);
+#endif
+    if (nes->nes_draw_buffer){
+        nes_free(nes->nes_draw_buffer);
+    }
     if (nes){
         nes_free(nes);
         nes = NULL;
@@ -68,6 +102,16 @@ static inline void nes_palette_generate(nes_t* nes){
     }
 }
 
+// Whether this frame's picture is drawn: not a skipped frame (NES_FRAME_SKIP) nor a hidden one
+static inline uint8_t nes_draw_enabled(nes_t* nes){
+#if (NES_FRAME_SKIP != 0)
+    if (nes->nes_frame_skip_count){
+        return 0;
+    }
+#endif
+    return (nes->nes_hidden & NES_HIDDEN_VIDEO) == 0;
+}
+
 static void nes_render_background_line(nes_t* nes,uint16_t scanline,nes_color_t* draw_data){
     (void)scanline;
     uint8_t p = 0;
@@ -135,9 +179,15 @@ static void nes_render_sprite_line(nes_t* nes,uint16_t scanline,nes_color_t* dra
     uint8_t sprite[8] = {0};
     uint8_t sprite_numbers = 0;
     const uint8_t sprite_size = nes->nes_ppu.CTRL_H?16:8;
+    const uint8_t draw = nes_draw_enabled(nes);
+    // Not drawn: only the sprite 0 hit and overflow flags are left to update
+    if (draw == 0 && nes->nes_ppu.STATUS_O && nes->nes_ppu.STATUS_S){
+        return;
+    }
+    const uint8_t sprite_count = (draw || nes->nes_ppu.STATUS_O == 0) ? 64 : 1;
 
     // 遍历显示的精灵和检测是否精灵溢出
-    for (uint8_t i = 0; i < 64; i++){
+    for (uint8_t i = 0; i < sprite_count; i++){
         if (nes->nes_ppu.sprite_info[i].y >= 0xEF){
             continue;
         }
@@ -154,6 +204,9 @@ static void nes_render_sprite_line(nes_t* nes,uint16_t scanline,nes_color_t* dra
     // 显示精灵
     for (uint8_t sprite_number = sprite_numbers; sprite_number > 0; sprite_number--){
         const uint8_t sprite_id = sprite[sprite_number-1];
+        if (draw == 0 && (sprite_id || nes->nes_ppu.STATUS_S)){
+            continue;   // Not drawn: only sprite 0 hit is left to check
+        }
         const sprite_info_t sprite_info = nes->nes_ppu.sprite_info[sprite_id];
         const uint8_t sprite_y = (uint8_t)(sprite_info.y + 1);
         const uint8_t* sprite_bit0_p = nes->nes_ppu.pattern_table[nes->nes_ppu.CTRL_H?((sprite_info.pattern_8x16)?4:0):(nes->nes_ppu.CTRL_S?4:0)] \
@@ -186,10 +239,7 @@ static void nes_render_sprite_line(nes_t* nes,uint16_t scanline,nes_color_t* dra
 
         const uint8_t sprite_bit0 = sprite_bit0_p[dy];
         const uint8_t sprite_bit1 = sprite_bit1_p[dy];
-#if (NES_FRAME_SKIP != 0)
-        if(nes->nes_frame_skip_count == 0)
-#endif
-        {
+        if (draw){
             uint8_t p = sprite_info.x;
             if (sprite_info.flip_h){
                 for (int8_t m = 0; m <= 7; m++){
@@ -281,134 +331,253 @@ static void nes_render_sprite_line(nes_t* nes,uint16_t scanline,nes_color_t* dra
 //             m = 7;
 //         }
 //     }
-//     nes_draw(0, 0, NES_WIDTH-1, NES_HEIGHT-1, nes->nes_draw_data);
+//     nes_draw(nes, 0, 0, NES_WIDTH-1, NES_HEIGHT-1, nes->nes_draw_data);
 //     nes_frame(nes);
 // }
 
-void nes_run(nes_t* nes){
-    NES_LOG_DEBUG("mapper:%03d\n",nes->nes_rom.mapper_number);
-    NES_LOG_DEBUG("prg_rom_size:%d*16kB\n",nes->nes_rom.prg_rom_size);
-    NES_LOG_DEBUG("chr_rom_size:%d*8kB\n",nes->nes_rom.chr_rom_size);
-    NES_LOG_DEBUG("mirroring_type:%d\n",nes->nes_rom.mirroring_type);
-    NES_LOG_DEBUG("four_screen:%d\n",nes->nes_rom.four_screen);
-    // NES_LOG_DEBUG("save_ram:%d\n",nes->nes_rom.save_ram);
+#if (NES_DRAW_LINES < 1) || (NES_DRAW_LINES > NES_HEIGHT) || (NES_DRAW_BLOCK < 1) || (NES_DRAW_LINES % NES_DRAW_BLOCK != 0)
+#error "NES_DRAW_LINES must be 1..NES_HEIGHT and a multiple of NES_DRAW_BLOCK"
+#endif
 
-    nes_cpu_reset(nes);
-    uint64_t frame_cnt = 0;
+// https://www.nesdev.org/wiki/PPU_rendering#Visible_scanlines_(0-239)
+// Buffer of the current visible line: its row of the frame, or the single line an observation reduces right away
+static inline nes_color_t* nes_line_data(nes_t* nes){
+    if (nes->nes_obs){
+        return nes->nes_draw_data;
+    }
+#if (NES_DRAW_LINES < NES_HEIGHT)
+    return nes->nes_draw_data + nes->scanline%NES_DRAW_LINES * nes->nes_draw_stride;
+#else
+    return nes->nes_draw_data + nes->scanline * nes->nes_draw_stride;
+#endif
+}
 
-    while (!nes->nes_quit){
-        // NES_LOG_DEBUG("frame_cnt:%d\n",frame_cnt);
-        frame_cnt++;
-#if (NES_FRAME_SKIP != 0)
-        if(nes->nes_frame_skip_count == 0)
+// Lines y1-y2 are done, color_data is the first of them
+static inline void nes_draw_lines(nes_t* nes, uint16_t y1, uint16_t y2, nes_color_t* color_data){
+#if (NES_DIRTY_TILE > 0)
+    nes_dirty_draw(nes, y1, y2, color_data);
+#else
+    nes_draw(nes, 0, y1, NES_WIDTH-1, y2, color_data);
 #endif
-        {
-            nes_palette_generate(nes);
+}
+
+static inline void nes_visible_line(nes_t* nes){
+    nes_color_t* draw_data = nes_line_data(nes);
+    if (nes_draw_enabled(nes)){
+        if (nes->nes_ppu.MASK_b){
+            nes_render_background_line(nes, nes->scanline, draw_data);
+        }else{
+            // Rendering off: backdrop color. Filled per pixel, a byte memset only works for single-byte colors
+            for (uint16_t x = 0; x < NES_WIDTH; x++){
+                draw_data[x] = nes->nes_ppu.background_palette[0];
+            }
         }
-        if (nes->nes_ppu.MASK_b == 0){
-#if (NES_FRAME_SKIP != 0)
-            if(nes->nes_frame_skip_count == 0)
-#endif
-            {
-                nes_memset(nes->nes_draw_data, nes->nes_ppu.background_palette[0], sizeof(nes_color_t) * NES_DRAW_SIZE);
+    }
+    if (nes->nes_ppu.MASK_s){
+        nes_render_sprite_line(nes, nes->scanline, draw_data);
+    }
+    nes_opcode(nes,85); // ppu cycles: 85*3=255
+    // https://www.nesdev.org/wiki/PPU_scrolling#Wrapping_around
+    if (nes->nes_ppu.MASK_b){
+        // https://www.nesdev.org/wiki/PPU_scrolling#At_dot_256_of_each_scanline
+        if ((nes->nes_ppu.v.fine_y) < 7) {
+            nes->nes_ppu.v.fine_y++;
+        }else {
+            nes->nes_ppu.v.fine_y = 0;
+            uint8_t y = (uint8_t)(nes->nes_ppu.v.coarse_y);
+            if (y == 29) {
+                y = 0;
+                nes->nes_ppu.v_reg ^= 0x0800;
+            }else if (y == 31) {
+                y = 0;
+            }else {
+                y++;
             }
+            nes->nes_ppu.v.coarse_y = y;
         }
+        // https://www.nesdev.org/wiki/PPU_scrolling#At_dot_257_of_each_scanline
+        // v: ....A.. ...BCDEF <- t: ....A.. ...BCDEF
+        nes->nes_ppu.v_reg = (nes->nes_ppu.v_reg & (uint16_t)0xFBE0) | (nes->nes_ppu.t_reg & (uint16_t)0x041F);
+    }
+    nes_opcode(nes,NES_PPU_CPU_CLOCKS-85);
 #if (NES_ENABLE_SOUND==1)
-        nes_apu_frame(nes);
+    nes_apu_hsync(nes);
 #endif
-        // https://www.nesdev.org/wiki/PPU_rendering#Visible_scanlines_(0-239)
-        for(nes->scanline = 0; nes->scanline < NES_HEIGHT; nes->scanline++) { // 0-239 Visible frame
-            if (nes->nes_ppu.MASK_b){
-#if (NES_FRAME_SKIP != 0)
-                if (nes->nes_frame_skip_count == 0)
-#endif
-                {
-#if (NES_RAM_LACK == 1)
-                nes_render_background_line(nes, nes->scanline, nes->nes_draw_data + nes->scanline%(NES_HEIGHT/2) * NES_WIDTH);
-#else
-                nes_render_background_line(nes, nes->scanline, nes->nes_draw_data + nes->scanline * NES_WIDTH);
+}
+
+/*
+    One scanline of the 262 line frame:
+    0-239 visible, 240 post-render, 241-260 VBlank, 261 pre-render.
+*/
+int nes_step_scanline(nes_t* nes){
+    int status = NES_STEP_SCANLINE;
+    if (nes->scanline == 0 && nes_draw_enabled(nes)){
+        nes_palette_generate(nes);
+    }
+    if (nes->scanline < NES_HEIGHT){                // 0-239 Visible frame
+        nes_visible_line(nes);
+        if (nes_draw_enabled(nes)){
+#if (NES_FRAME_HASH == 1)
+            if (nes->nes_frame_hash.enable && (nes->nes_hidden & NES_HIDDEN_SPECULATIVE) == 0){
+                nes_frame_hash_line(nes, nes_line_data(nes));
+            }
 #endif
+            if (nes->nes_obs){
+                nes_obs_line(nes, nes->nes_draw_data);
+                if (nes->scanline == NES_HEIGHT-1){
+                    status |= NES_STEP_FRAME_READY;
                 }
-            }
-            if (nes->nes_ppu.MASK_s){
-#if (NES_RAM_LACK == 1)
-                nes_render_sprite_line(nes, nes->scanline,nes->nes_draw_data + nes->scanline%(NES_HEIGHT/2) * NES_WIDTH);
-#else
-                nes_render_sprite_line(nes, nes-> scanline,nes->nes_draw_data + nes->scanline * NES_WIDTH);
+            }else{
+#if (NES_DIRTY_TILE > 0)
+                nes_dirty_line(nes, nes_line_data(nes));
 #endif
-            }
-            nes_opcode(nes,85); // ppu cycles: 85*3=255
-            // https://www.nesdev.org/wiki/PPU_scrolling#Wrapping_around
-            if (nes->nes_ppu.MASK_b){
-                // https://www.nesdev.org/wiki/PPU_scrolling#At_dot_256_of_each_scanline
-                if ((nes->nes_ppu.v.fine_y) < 7) {
-                    nes->nes_ppu.v.fine_y++;
-                }else {
-                    nes->nes_ppu.v.fine_y = 0;
-                    uint8_t y = (uint8_t)(nes->nes_ppu.v.coarse_y);
-                    if (y == 29) {
-                        y = 0;
-                        nes->nes_ppu.v_reg ^= 0x0800;
-                    }else if (y == 31) {
-                        y = 0;
-                    }else {
-                        y++;
+#if (NES_DRAW_BLOCK < NES_HEIGHT)
+                // Streaming: hand over each block as soon as its last line is done, the last one may be shorter
+                if (nes->scanline % NES_DRAW_BLOCK == NES_DRAW_BLOCK-1 || nes->scanline == NES_HEIGHT-1){
+                    const uint16_t first = (uint16_t)(nes->scanline - nes->scanline % NES_DRAW_BLOCK);
+                    nes_draw_lines(nes, first, nes->scanline, nes->nes_draw_data + first % NES_DRAW_LINES * nes->nes_draw_stride);
+                    if (nes->scanline == NES_HEIGHT-1){
+                        status |= NES_STEP_FRAME_READY;
                     }
-                    nes->nes_ppu.v.coarse_y = y;
                 }
-                // https://www.nesdev.org/wiki/PPU_scrolling#At_dot_257_of_each_scanline
-                // v: ....A.. ...BCDEF <- t: ....A.. ...BCDEF
-                nes->nes_ppu.v_reg = (nes->nes_ppu.v_reg & (uint16_t)0xFBE0) | (nes->nes_ppu.t_reg & (uint16_t)0x041F);
-            }
-            nes_opcode(nes,NES_PPU_CPU_CLOCKS-85);
-#if (NES_ENABLE_SOUND==1)
-            if (nes->scanline % 66 == 65) nes_apu_frame(nes);
-#endif
-#if (NES_RAM_LACK == 1)
-#if (NES_FRAME_SKIP != 0)
-            if(nes->nes_frame_skip_count == 0)
-#endif
-            {
-                if (nes->scanline == NES_HEIGHT/2-1){
-                    nes_draw(0, 0, NES_WIDTH-1, NES_HEIGHT/2-1, nes->nes_draw_data);
-                }else if(nes->scanline == NES_HEIGHT-1){
-                    nes_draw(0, NES_HEIGHT/2, NES_WIDTH-1, NES_HEIGHT-1, nes->nes_draw_data);
+#else
+                if (nes->scanline == NES_HEIGHT-1){
+                    nes_draw_lines(nes, 0, NES_HEIGHT-1, nes->nes_draw_data);
+                    status |= NES_STEP_FRAME_READY;
                 }
-            }
 #endif
+            }
         }
-#if (NES_RAM_LACK == 0)
-#if (NES_FRAME_SKIP != 0)
-        if(nes->nes_frame_skip_count == 0)
-#endif
-        {
-            nes_draw(0, 0, NES_WIDTH-1, NES_HEIGHT-1, nes->nes_draw_data);
-        }
+        nes->scanline++;
+    }else if (nes->scanline < NES_SCANLINE_PRERENDER){ // 240 Post-render line, 241-260 垂直空白行 x20
+        nes_opcode(nes,NES_PPU_CPU_CLOCKS);
+#if (NES_ENABLE_SOUND==1)
+        nes_apu_hsync(nes);
 #endif
-        nes_opcode(nes,NES_PPU_CPU_CLOCKS); //240 Post-render line
-        
-        nes->nes_ppu.STATUS_V = 1;// Set VBlank flag (241 line)
-        if (nes->nes_ppu.CTRL_V) {
-            nes->nes_cpu.irq_nmi=1;
-        }
-
-        for(uint8_t i = 0; i < 20; i++){ // 241-260行 垂直空白行 x20
-            nes_opcode(nes,NES_PPU_CPU_CLOCKS);
+        if (nes->scanline == NES_HEIGHT){
+            nes->nes_ppu.STATUS_V = 1;// Set VBlank flag (241 line)
+            if (nes->nes_ppu.CTRL_V) {
+                nes->nes_cpu.irq_nmi=1;
+            }
         }
+        nes->scanline++;
+    }else{
         nes->nes_ppu.ppu_status = 0;    // Clear:VBlank,Sprite 0,Overflow
         nes_opcode(nes,NES_PPU_CPU_CLOCKS); // Pre-render scanline (-1 or 261)
-
+#if (NES_ENABLE_SOUND==1)
+        nes_apu_sync(nes);              // Frame end: catch the APU up to the CPU
+#endif
         if (nes->nes_ppu.MASK_b){
             // https://www.nesdev.org/wiki/PPU_scrolling#During_dots_280_to_304_of_the_pre-render_scanline_(end_of_vblank)
             // v: GHIA.BC DEF..... <- t: GHIA.BC DEF.....
             nes->nes_ppu.v_reg = (nes->nes_ppu.v_reg & (uint16_t)0x841F) | (nes->nes_ppu.t_reg & (uint16_t)0x7BE0);
         }
-        nes_frame(nes);
 #if (NES_FRAME_SKIP != 0)
         if ( ++nes->nes_frame_skip_count > NES_FRAME_SKIP){
             nes->nes_frame_skip_count = 0;
         }
 #endif
+        nes->scanline = 0;
+        status |= NES_STEP_FRAME_END;
+        // Lag frame: the joypad was not read, whatever was pressed could not change this frame
+        nes->nes_lag = nes->nes_cpu.joypad_read == 0;
+        nes->nes_cpu.joypad_read = 0;
+        nes->nes_frame_count++;
+        if (nes->nes_lag){
+            nes->nes_lag_count++;
+            status |= NES_STEP_LAG_FRAME;
+        }
+        if ((nes->nes_hidden & NES_HIDDEN_SPECULATIVE) == 0){
+#if (NES_INPUT_QUEUE == 1)
+            if (nes->nes_input_queue){
+                nes_input_frame(nes);   // Before the movie records this frame's joypad
+            }
+#endif
+#if (NES_FRAME_HASH == 1)
+            if (nes->nes_frame_hash.enable){
+                nes_frame_hash_end(nes);
+            }
+#endif
+            if (nes->nes_rewind){
+                nes_rewind_frame(nes);
+            }
+            if (nes->nes_movie){
+                nes_movie_frame(nes);
+            }
+        }
+    }
+#if (NES_ENABLE_SOUND==1)
+    if (nes->nes_apu.block_ready){
+        nes->nes_apu.block_ready = 0;
+        status |= NES_STEP_AUDIO_READY;
+    }
+#endif
+    return status;
+}
+
+// Runs to the end of the current frame (the pre-render line)
+int nes_step_frame(nes_t* nes){
+    int status = 0;
+    do {
+        status |= nes_step_scanline(nes);
+    } while ((status & NES_STEP_FRAME_END) == 0);
+    return status;
+}
+
+// Runs whole scanlines for about `cycles` CPU cycles, the overshoot is taken off the next call
+int nes_run_cycles(nes_t* nes, uint32_t cycles){
+    int status = 0;
+    int64_t budget = (int64_t)cycles + nes->run_cycles_carry;
+    while (budget > 0){
+        const uint64_t start = nes->nes_cpu.cycles_total + nes->nes_cpu.cycles;
+        status |= nes_step_scanline(nes);
+        budget -= (int64_t)(nes->nes_cpu.cycles_total + nes->nes_cpu.cycles - start);
     }
+    nes->run_cycles_carry = (int32_t)budget;
+    return status;
+}
+
+int nes_set_framebuffer(nes_t* nes, nes_color_t* buffer, uint32_t stride){
+    if (buffer){
+        if (stride < NES_WIDTH){
+            return NES_ERROR;
+        }
+        if (nes->nes_draw_buffer){
+            nes_free(nes->nes_draw_buffer);
+            nes->nes_draw_buffer = NULL;
+        }
+        nes->nes_draw_data = buffer;
+        nes->nes_draw_stride = stride;
+        return NES_OK;
+    }
+    if (nes->nes_draw_buffer == NULL){
+        nes->nes_draw_buffer = (nes_color_t*)nes_malloc(NES_DRAW_SIZE * sizeof(nes_color_t));
+        if (nes->nes_draw_buffer == NULL){
+            return NES_ERROR;
+        }
+        nes_memset(nes->nes_draw_buffer, 0, NES_DRAW_SIZE * sizeof(nes_color_t));
+    }
+    nes->nes_draw_data = nes->nes_draw_buffer;
+    nes->nes_draw_stride = NES_WIDTH;
+    return NES_OK;
 }
 
+void nes_reset(nes_t* nes){
+    nes_cpu_reset(nes);
+    nes->scanline = 0;
+    nes->run_cycles_carry = 0;
+}
+
+void nes_run(nes_t* nes){
+    NES_LOG_DEBUG("mapper:%03d\n",nes->nes_rom.mapper_number);
+    NES_LOG_DEBUG("prg_rom_size:%d*16kB\n",nes->nes_rom.prg_rom_size);
+    NES_LOG_DEBUG("chr_rom_size:%d*8kB\n",nes->nes_rom.chr_rom_size);
+    NES_LOG_DEBUG("mirroring_type:%d\n",nes->nes_rom.mirroring_type);
+    NES_LOG_DEBUG("four_screen:%d\n",nes->nes_rom.four_screen);
+    // NES_LOG_DEBUG("save_ram:%d\n",nes->nes_rom.save_ram);
+
+    while (!nes->nes_quit){
+        nes_runahead_frame(nes);
+        nes_frame(nes);
+    }
+}
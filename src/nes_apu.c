@@ -38,6 +38,16 @@ static const uint8_t apu_triangle_wave[32] = {
     0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
 };
 
+// https://www.nesdev.org/wiki/APU_Noise NTSC period table, in CPU cycles
+static const uint16_t apu_noise_period[16] = {
+      4,   8,  16,  32,  64,  96, 128, 160, 202, 254, 380, 508, 762,1016,2034,4068
+};
+
+// https://www.nesdev.org/wiki/APU_DMC NTSC rate table, in CPU cycles
+static const uint16_t apu_dmc_rate[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106,  84,  72,  54
+};
+
 
 static inline void nes_apu_pulse_sweep(pulse_t* pulse, uint8_t period_one){
     if (pulse->sweep_divider == 0 && pulse->enabled && pulse->shift){
@@ -136,147 +146,229 @@ static inline void nes_apu_envelopes_and_linear_counter(nes_t *nes){
 }
 
 // https://www.nesdev.org/wiki/APU_Pulse
-static void nes_apu_play_pulse(nes_apu_t* apu,uint8_t pulse_id){
-    pulse_t* pulse = (pulse_id==1)? &apu->pulse1: &apu->pulse2;
-    uint8_t volume,enabled = (pulse_id==1)? apu->status_pulse1: apu->status_pulse2;
-    for (uint64_t sample_local = apu->sample_local_start; sample_local <= apu->sample_local_end; sample_local++){
-        uint8_t mute = 0;
-        if (pulse->sample_index >= NES_APU_SAMPLE_PER_SYNC){
-            break;
-        }
-        if ((!enabled) || (pulse->length_counter == 0)){
-            mute = 1;
-            pulse->sample_buffer[pulse->sample_index++] = 0;
-            pulse->seq_local_old = 0;
-            continue;
-        }else if (pulse->cur_period <= 7 || pulse->cur_period >= 0x800)
-            mute = 1;
-        const uint64_t cpu_local = sample_local* NES_CPU_CLOCK_FREQ / NES_APU_SAMPLE_RATE;
-        const uint64_t cpu_local_diff = cpu_local - apu->cpu_lock_count;
-        // fpulse = fCPU/(16*(t+1))
-        const float seq_diff = cpu_local_diff * 1.0f / (16 * (pulse->cur_period + 1));
-        const float seq_local = (seq_diff + pulse->seq_local_old) - (int)(seq_diff + pulse->seq_local_old);
-        if (mute){
-            volume = 0;
-        }else if (pulse->constant_volume){
-            volume = pulse->envelope_lowers;
-        }else{
-            volume = pulse->envelope_volume;
-        }
-        pulse->sample_buffer[pulse->sample_index++] = apu_pulse_wave[pulse->duty][(int)(seq_local * 8)] * volume;
-        if (sample_local == (uint64_t)((apu->clock_count + 1) * NES_APU_SAMPLE_RATE / 240)){
-            pulse->seq_local_old = seq_local;
-        }
+static inline void nes_apu_pulse_clock(pulse_t* pulse, uint32_t cycles){
+    if (cycles < pulse->timer){
+        pulse->timer -= (uint16_t)cycles;
+        return;
     }
+    // The pulse timer is clocked every second CPU cycle
+    const uint32_t period = ((uint32_t)pulse->cur_period + 1) << 1;
+    cycles -= pulse->timer;
+    pulse->sequence = (uint8_t)((pulse->sequence + 1 + cycles / period) & 0x07);
+    pulse->timer = (uint16_t)(period - cycles % period);
+}
+
+static inline uint8_t nes_apu_pulse_output(const pulse_t* pulse, uint8_t enabled){
+    if ((!enabled) || (pulse->length_counter == 0) || pulse->cur_period <= 7 || pulse->cur_period >= 0x800){
+        return 0;
+    }
+    const uint8_t volume = pulse->constant_volume ? pulse->envelope_lowers : pulse->envelope_volume;
+    return apu_pulse_wave[pulse->duty][pulse->sequence] * volume;
 }
 
 // https://www.nesdev.org/wiki/APU_Triangle
-static void nes_apu_play_triangle(nes_apu_t* apu){
-    triangle_t* triangle = &apu->triangle;
-    for (uint64_t sample_local = apu->sample_local_start; sample_local <= apu->sample_local_end; sample_local++){
-        if (triangle->sample_index >= NES_APU_SAMPLE_PER_SYNC){
-            break;
-        }
-        if ((!apu->status_triangle) || (triangle->length_counter == 0) || (triangle->linear_counter == 0)){
-            triangle->sample_buffer[triangle->sample_index++] = 0;
-            triangle->seq_local_old = 0;
-            continue;
-        }
-        const uint64_t cpu_local = sample_local* NES_CPU_CLOCK_FREQ / NES_APU_SAMPLE_RATE;
-        const uint64_t cpu_local_diff = cpu_local - apu->cpu_lock_count;
-        const float seq_diff = cpu_local_diff * 1.0f / (16 * (triangle->cur_period + 1));
-        const float seq_local = (seq_diff + triangle->seq_local_old) - (int)(seq_diff + triangle->seq_local_old);
-        uint8_t volume = apu_triangle_wave[(int)(seq_local * 32)];
-        triangle->sample_buffer[triangle->sample_index++] = volume;
-        if (sample_local == (uint64_t)((apu->clock_count + 1) * NES_APU_SAMPLE_RATE / 240)){
-            triangle->seq_local_old = seq_local;
-        }
+static inline void nes_apu_triangle_clock(triangle_t* triangle, uint32_t cycles){
+    // The sequencer only steps while both the length counter and the linear counter are non-zero
+    if ((triangle->length_counter == 0) || (triangle->linear_counter == 0)){
+        return;
+    }
+    if (cycles < triangle->timer){
+        triangle->timer -= (uint16_t)cycles;
+        return;
+    }
+    const uint32_t period = (uint32_t)triangle->cur_period + 1;
+    cycles -= triangle->timer;
+    triangle->sequence = (uint8_t)((triangle->sequence + 1 + cycles / period) & 0x1F);
+    triangle->timer = (uint16_t)(period - cycles % period);
+}
+
+static inline uint8_t nes_apu_triangle_output(const triangle_t* triangle, uint8_t enabled){
+    if (!enabled){
+        return 0;
+    }
+    // Ultrasonic periods average out to the middle of the waveform
+    if (triangle->cur_period < 2){
+        return 7;
     }
+    // A halted sequencer keeps outputting its current value
+    return apu_triangle_wave[triangle->sequence];
 }
 
 // https://www.nesdev.org/wiki/APU_Noise
-static void nes_apu_play_noise(nes_apu_t* apu){
-    noise_t* noise = &apu->noise;
-    uint8_t volume;
-    uint64_t cpu_local_old = apu->cpu_lock_count;
-    for (uint64_t sample_local = apu->sample_local_start; sample_local <= apu->sample_local_end; sample_local++){
-        if (noise->sample_index >= NES_APU_SAMPLE_PER_SYNC){
-            break;
-        }
-        if ((!apu->status_noise) || (noise->length_counter == 0)){
-            noise->sample_buffer[noise->sample_index++] = 0;
-            continue;
-        }
-        const uint64_t cpu_local = sample_local* NES_CPU_CLOCK_FREQ / NES_APU_SAMPLE_RATE;
-        const uint64_t lfsr_count = (cpu_local / (noise->noise_period + 1)) - (cpu_local_old / (noise->noise_period + 1));
-        cpu_local_old = cpu_local;
-        if (noise->loop_noise){ //短模式
-            for (uint64_t t = 0; t < lfsr_count; t++){
-                noise->lfsr = (noise->lfsr >> 1) | ((uint16_t)((noise->lfsr_d0 ^ noise->lfsr_d6) << 14));
-            }
-        }else{                  //长模式
-            for (uint64_t t = 0; t < lfsr_count; t++){
-                noise->lfsr = (noise->lfsr >> 1) | ((uint16_t)((noise->lfsr_d0 ^ noise->lfsr_d1) << 14));
-            }
-        }
-        if (noise->constant_volume){
-            volume = noise->volume_envelope;
-        }else{
-            volume = noise->envelope_volume;
-        }
-        noise->sample_buffer[noise->sample_index++] = (uint8_t)(noise->lfsr_d0 * volume);
+// Steps the 15 bit LFSR `steps` times. The feedback bits (bit 0 ^ bit 1, or bit 6 in short mode) of the
+// next 14 (9) steps all come from bits already in the register, so each run is a single shift.
+static inline uint16_t nes_apu_noise_lfsr(uint16_t lfsr, uint8_t short_mode, uint32_t steps){
+    const uint8_t tap = short_mode ? 6 : 1;     // 短模式 : 长模式
+    const uint32_t run_max = 15 - tap;
+    while (steps){
+        const uint32_t run = steps < run_max ? steps : run_max;
+        const uint16_t feedback = (uint16_t)((lfsr ^ (lfsr >> tap)) & ((1u << run) - 1));
+        lfsr = (uint16_t)((lfsr >> run) | (feedback << (15 - run)));
+        steps -= run;
     }
+    return lfsr;
 }
 
-// https://www.nesdev.org/wiki/APU_DMC
-static void nes_apu_play_dmc(nes_apu_t* apu){
+static inline void nes_apu_noise_clock(noise_t* noise, uint32_t cycles){
+    if (cycles < noise->timer){
+        noise->timer -= (uint16_t)cycles;
+        return;
+    }
+    const uint16_t period = apu_noise_period[noise->noise_period];
+    cycles -= noise->timer;
+    noise->lfsr = nes_apu_noise_lfsr(noise->lfsr, noise->loop_noise, 1 + cycles / period);
+    noise->timer = (uint16_t)(period - cycles % period);
+}
+
+static inline uint8_t nes_apu_noise_output(const noise_t* noise, uint8_t enabled){
+    if ((!enabled) || (noise->length_counter == 0)){
+        return 0;
+    }
+    const uint8_t volume = noise->constant_volume ? noise->volume_envelope : noise->envelope_volume;
+    return (uint8_t)(noise->lfsr_d0 * volume);
+}
 
-    for (uint64_t sample_local = apu->sample_local_start; sample_local <= apu->sample_local_end; sample_local++){
+extern void nes_cpu_irq(nes_t* nes);
+extern uint8_t nes_cpu_read(nes_t* nes, uint16_t address);
+
+static inline void nes_apu_dmc_restart(dmc_t* dmc){
+    dmc->current_address = 0xC000 + ((uint16_t)dmc->sample_address << 6);
+    dmc->bytes_remaining = ((uint16_t)dmc->sample_length << 4) + 1;
+}
 
+// https://www.nesdev.org/wiki/APU_DMC#Memory_reader
+static void nes_apu_dmc_fetch(nes_t* nes){
+    dmc_t* dmc = &nes->nes_apu.dmc;
+    if (!dmc->buffer_empty || dmc->bytes_remaining == 0){
+        return;
+    }
+    // The DMA reads the byte through the CPU bus, the CPU is stalled for up to 4 cycles meanwhile.
+    const uint16_t address = dmc->current_address;
+    dmc->read_buffer = nes_cpu_read(nes, address);
+    dmc->buffer_empty = 0;
+    nes->nes_cpu.cycles += 4;
+    dmc->current_address = (address == 0xFFFF) ? 0x8000 : address + 1;
+    if (--dmc->bytes_remaining == 0){
+        if (dmc->loop){
+            nes_apu_dmc_restart(dmc);
+        }else if (dmc->irq_enable){
+            nes->nes_apu.dmc_interrupt = 1;
+        }
     }
 }
 
-static inline void nes_apu_play(nes_t* nes){
-    nes->nes_apu.cpu_lock_count = nes->nes_apu.clock_count * NES_CPU_CLOCK_FREQ / 240;
-    nes->nes_apu.sample_local_start = nes->nes_apu.clock_count * NES_APU_SAMPLE_RATE / 240 + 1; 
-    nes->nes_apu.sample_local_end = (nes->nes_apu.clock_count + 1) * NES_APU_SAMPLE_RATE / 240;
-    nes_apu_play_pulse(&nes->nes_apu,1);
-    nes_apu_play_pulse(&nes->nes_apu,2);
-    nes_apu_play_triangle(&nes->nes_apu);
-    nes_apu_play_noise(&nes->nes_apu);
-    nes_apu_play_dmc(&nes->nes_apu);
-
-    if (nes->nes_apu.clock_count % 4 == 3){
-        // https://www.nesdev.org/wiki/APU_Mixer
-        nes_memset(nes->nes_apu.sample_buffer, 0, NES_APU_SAMPLE_PER_SYNC);
-        for (int t = 0; t <= NES_APU_SAMPLE_PER_SYNC - 1; t++){
-            // 这里采用线性近似方法 https://www.nesdev.org/wiki/APU_Mixer#Linear_Approximation
-            float volume_total = 0.00752f * (nes->nes_apu.pulse1.sample_buffer[t] + nes->nes_apu.pulse2.sample_buffer[t]);
-            volume_total += 0.00851f * nes->nes_apu.triangle.sample_buffer[t] + 0.00494f * nes->nes_apu.noise.sample_buffer[t] + 0.00335f * nes->nes_apu.dmc.sample_buffer[t];
-            nes->nes_apu.sample_buffer[t] = (uint8_t)(volume_total * 256);
+// https://www.nesdev.org/wiki/APU_DMC#Output_unit
+static inline void nes_apu_dmc_output_clock(dmc_t* dmc){
+    if (!dmc->silence){
+        if (dmc->shift_register & 1){
+            if (dmc->output_level <= 125) dmc->output_level += 2;
+        }else{
+            if (dmc->output_level >= 2) dmc->output_level -= 2;
+        }
+    }
+    dmc->shift_register >>= 1;
+    if (--dmc->bits_remaining == 0){
+        // Output cycle boundary: the only place the sample buffer is drained. The refill is
+        // done by nes_apu_sync() at apu->dmc_clock, never from here.
+        dmc->bits_remaining = 8;
+        if (dmc->buffer_empty){
+            dmc->silence = 1;
+        }else{
+            dmc->silence = 0;
+            dmc->shift_register = dmc->read_buffer;
+            dmc->buffer_empty = 1;
         }
-        nes_memset(nes->nes_apu.pulse1.sample_buffer, 0, NES_APU_SAMPLE_PER_SYNC);
-        nes_memset(nes->nes_apu.pulse2.sample_buffer, 0, NES_APU_SAMPLE_PER_SYNC);
-        nes_memset(nes->nes_apu.triangle.sample_buffer, 0, NES_APU_SAMPLE_PER_SYNC);
-        nes_memset(nes->nes_apu.noise.sample_buffer, 0, NES_APU_SAMPLE_PER_SYNC);
-        nes_memset(nes->nes_apu.dmc.sample_buffer, 0, NES_APU_SAMPLE_PER_SYNC);
+    }
+}
 
-        nes->nes_apu.pulse1.sample_index = 0;
-        nes->nes_apu.pulse2.sample_index = 0;
-        nes->nes_apu.triangle.sample_index = 0;
-        nes->nes_apu.noise.sample_index = 0;
-        nes->nes_apu.dmc.sample_index = 0;
+// https://www.nesdev.org/wiki/APU_DMC
+static inline void nes_apu_dmc_clock(dmc_t* dmc, uint32_t cycles){
+    // Only whole output clocks are stepped, never individual CPU cycles.
+    while (cycles >= dmc->timer){
+        cycles -= dmc->timer;
+        dmc->timer = dmc->timer_period;
+        nes_apu_dmc_output_clock(dmc);
+    }
+    dmc->timer -= (uint16_t)cycles;
+}
 
-        nes_sound_output(nes->nes_apu.sample_buffer, NES_APU_SAMPLE_PER_SYNC);
+// Apply the CPU cycles elapsed since the last call to every channel timer
+static inline void nes_apu_clock_channels(nes_t* nes){
+    nes_apu_t* apu = &nes->nes_apu;
+    const uint32_t cycles = apu->channel_pending;
+    if (cycles == 0){
+        return;
     }
+    apu->channel_pending = 0;
+    nes_apu_pulse_clock(&apu->pulse1, cycles);
+    nes_apu_pulse_clock(&apu->pulse2, cycles);
+    nes_apu_triangle_clock(&apu->triangle, cycles);
+    nes_apu_noise_clock(&apu->noise, cycles);
+    nes_apu_dmc_clock(&apu->dmc, cycles);
 }
 
-extern void nes_cpu_irq(nes_t* nes);
-static inline void nes_apu_frame_irq(nes_t *nes){
-    if (nes->nes_apu.irq_inhibit_flag==0){
-        nes->nes_apu.frame_interrupt = 1;
-        nes_cpu_irq(nes);
+// Channels are mixed straight into the output block, one sample at a time:
+// linear mix, 90Hz DC blocker, then conversion to the configured format.
+static inline void nes_apu_sample(nes_t* nes){
+    nes_apu_t* apu = &nes->nes_apu;
+    nes_apu_clock_channels(nes);
+    if (nes->nes_hidden & NES_HIDDEN_AUDIO){
+        return;
     }
+    const uint16_t t = apu->sample_index;
+    const uint8_t pulse1 = nes_apu_pulse_output(&apu->pulse1, apu->status_pulse1);
+    const uint8_t pulse2 = nes_apu_pulse_output(&apu->pulse2, apu->status_pulse2);
+    const uint8_t triangle = nes_apu_triangle_output(&apu->triangle, apu->status_triangle);
+    const uint8_t noise = nes_apu_noise_output(&apu->noise, apu->status_noise);
+    const uint8_t dmc = apu->dmc.output_level;
+#if (NES_APU_STEMS == 1)
+    const uint16_t block_size = apu->config.block_size;
+    apu->stem_buffer[t] = pulse1;
+    apu->stem_buffer[block_size + t] = pulse2;
+    apu->stem_buffer[block_size * 2 + t] = triangle;
+    apu->stem_buffer[block_size * 3 + t] = noise;
+    apu->stem_buffer[block_size * 4 + t] = dmc;
+#endif
+    // https://www.nesdev.org/wiki/APU_Mixer
+    // 这里采用线性近似方法 https://www.nesdev.org/wiki/APU_Mixer#Linear_Approximation
+    const float volume_total = 0.00752f * (pulse1 + pulse2) + 0.00851f * triangle + 0.00494f * noise + 0.00335f * dmc;
+    // First order high-pass, like the 90Hz filter on the console output
+    apu->highpass_out = apu->highpass_coef * apu->highpass_out + volume_total - apu->highpass_in;
+    apu->highpass_in = volume_total;
+    float sample = apu->highpass_out;
+    if (sample > 1.0f) sample = 1.0f;
+    else if (sample < -1.0f) sample = -1.0f;
+    switch (apu->config.format){
+        case NES_APU_FORMAT_U8:
+            apu->sample_buffer[t] = (uint8_t)(128 + (int)(sample * 127.0f));
+            break;
+        case NES_APU_FORMAT_S8:
+            ((int8_t*)apu->sample_buffer)[t] = (int8_t)(sample * 127.0f);
+            break;
+        case NES_APU_FORMAT_S16:
+            ((int16_t*)apu->sample_buffer)[t] = (int16_t)(sample * 32767.0f);
+            break;
+        case NES_APU_FORMAT_F32:
+            ((float*)apu->sample_buffer)[t] = sample;
+            break;
+    }
+    if (++apu->sample_index == apu->config.block_size){
+        nes_sound_output(nes, apu->sample_buffer, (size_t)apu->config.block_size * apu->sample_bytes);
+        apu->block_ready = 1;
+#if (NES_APU_STEMS == 1)
+        nes_sound_stems(nes, apu->stem_buffer, apu->config.block_size);
+#endif
+        apu->sample_index = 0;
+    }
+}
+
+// Output samples are spaced NES_CPU_CLOCK_FREQ/sample_rate CPU cycles apart,
+// sample_phase carries the fractional part so the long term rate is exact.
+static inline void nes_apu_sample_schedule(nes_apu_t* apu){
+    const uint32_t sample_rate = apu->config.sample_rate;
+    const uint32_t wait = (NES_CPU_CLOCK_FREQ - apu->sample_phase + sample_rate - 1) / sample_rate;
+    apu->sample_phase = apu->sample_phase + wait * sample_rate - NES_CPU_CLOCK_FREQ;
+    apu->sample_wait = (uint16_t)wait;
 }
 
 /*
@@ -289,9 +381,26 @@ mode 0:    mode 1:       function
  - l - l    - l - - l    Length counter and sweep
  e e e e    e e e - e    Envelope and linear counter
 */
-void nes_apu_frame(nes_t* nes){
-    if(nes->nes_apu.mode){// 5 step mode
-        switch(nes->nes_apu.clock_count % 5){
+
+// CPU cycle of each step from the start of the sequence (NTSC)
+static const uint16_t apu_frame_step_cycles[2][5] = {
+    {7457, 14913, 22371, 29829, 0},
+    {7457, 14913, 22371, 29829, 37281},
+};
+static const uint8_t apu_frame_steps[2] = {4, 5};
+static const uint16_t apu_frame_length[2] = {29830, 37282};
+
+static inline void nes_apu_frame_irq(nes_t *nes){
+    if (nes->nes_apu.irq_inhibit_flag==0){
+        nes->nes_apu.frame_interrupt = 1;
+    }
+}
+
+static void nes_apu_frame_step(nes_t* nes){
+    const uint8_t mode = nes->nes_apu.mode;
+    const uint8_t step = nes->nes_apu.frame_step;
+    if(mode){// 5 step mode
+        switch(step){
             case 0:
                 nes_apu_envelopes_and_linear_counter(nes);
                 break;
@@ -308,7 +417,7 @@ void nes_apu_frame(nes_t* nes){
                 break;
         }
     }else{  // 4 step mode
-        switch(nes->nes_apu.clock_count % 4){
+        switch(step){
             case 0:
                 nes_apu_envelopes_and_linear_counter(nes);
                 break;
@@ -328,27 +437,180 @@ void nes_apu_frame(nes_t* nes){
                 break;
         }
     }
-    nes_apu_play(nes);
-    nes->nes_apu.clock_count++;
+    if (step + 1 < apu_frame_steps[mode]){
+        nes->nes_apu.frame_wait = apu_frame_step_cycles[mode][step + 1] - apu_frame_step_cycles[mode][step];
+        nes->nes_apu.frame_step = step + 1;
+    }else{
+        nes->nes_apu.frame_wait = apu_frame_length[mode] - apu_frame_step_cycles[mode][step] + apu_frame_step_cycles[mode][0];
+        nes->nes_apu.frame_step = 0;
+    }
+}
+
+// Work out when the next frame or DMC interrupt and the next DMC fetch are due, so nes_apu_hsync()
+// only has to catch the APU up early when one of them is actually coming. Channel timers must be up to date.
+static void nes_apu_irq_schedule(nes_t* nes){
+    nes_apu_t* apu = &nes->nes_apu;
+    uint64_t wait = UINT64_MAX;
+    if (apu->mode == 0 && apu->irq_inhibit_flag == 0 && apu->frame_interrupt == 0){
+        const uint16_t length = apu_frame_length[0];
+        const uint16_t irq_cycle = apu_frame_step_cycles[0][3];
+        int32_t position = (int32_t)apu_frame_step_cycles[0][apu->frame_step] - apu->frame_wait;
+        if (position < 0){
+            position += length;
+        }
+        wait = (position < irq_cycle) ? (uint64_t)(irq_cycle - position) : (uint64_t)(length - position + irq_cycle);
+    }
+    const dmc_t* dmc = &apu->dmc;
+    if (dmc->irq_enable && !dmc->loop && dmc->bytes_remaining && apu->dmc_interrupt == 0){
+        // The last byte is fetched at the output cycle boundary that empties the buffer for the last time
+        const uint64_t dmc_wait = dmc->timer + (uint64_t)(dmc->bits_remaining - 1) * dmc->timer_period
+                                + (uint64_t)(dmc->bytes_remaining - 1) * 8 * dmc->timer_period;
+        if (dmc_wait < wait){
+            wait = dmc_wait;
+        }
+    }
+    apu->irq_clock = (wait == UINT64_MAX) ? UINT64_MAX : apu->cpu_clock + wait;
+    // The memory reader refills the buffer at the output cycle boundary that empties it, which only
+    // depends on the DMC timer: the fetch, and the CPU stall, land on the same cycle whatever the sample rate.
+    if (dmc->bytes_remaining == 0){
+        apu->dmc_clock = UINT64_MAX;
+    }else if (dmc->buffer_empty){
+        apu->dmc_clock = apu->cpu_clock;
+    }else{
+        apu->dmc_clock = apu->cpu_clock + dmc->timer + (uint64_t)(dmc->bits_remaining - 1) * dmc->timer_period;
+    }
+}
+
+// Advance the APU up to the current CPU cycle. Frame counter steps and output
+// samples are processed at the exact cycles they fall on.
+void nes_apu_sync(nes_t* nes){
+    nes_apu_t* apu = &nes->nes_apu;
+    const uint64_t cpu_clock = nes->nes_cpu.cycles_total + nes->nes_cpu.cycles;
+    // No output wanted: skip the sample points, the channel timers are exact however many cycles they are given
+    const uint8_t sampling = (nes->nes_hidden & NES_HIDDEN_AUDIO) == 0;
+    while (apu->cpu_clock < cpu_clock){
+        // DMC fetches are events of their own, so they never depend on where the sample points fall
+        const uint64_t until = (apu->dmc_clock < cpu_clock) ? apu->dmc_clock : cpu_clock;
+        uint32_t cycles = (until - apu->cpu_clock > apu->frame_wait) ? apu->frame_wait : (uint32_t)(until - apu->cpu_clock);
+        if (sampling && cycles > apu->sample_wait){
+            cycles = apu->sample_wait;
+        }
+        apu->cpu_clock += cycles;
+        apu->channel_pending += cycles;
+        apu->frame_wait -= (uint16_t)cycles;
+        if (apu->frame_wait == 0){
+            nes_apu_frame_step(nes);
+        }
+        if (sampling && (apu->sample_wait -= (uint16_t)cycles) == 0){
+            nes_apu_sample(nes);
+            nes_apu_sample_schedule(apu);
+        }
+        if (apu->cpu_clock == apu->dmc_clock){
+            nes_apu_clock_channels(nes);
+            nes_apu_dmc_fetch(nes);
+            nes_apu_irq_schedule(nes);
+        }
+    }
+    nes_apu_clock_channels(nes);
+    nes_apu_irq_schedule(nes);
+}
+
+// Called once per scanline: catches up only when an IRQ or a DMC fetch is due, then drives the IRQ line.
+void nes_apu_hsync(nes_t* nes){
+    const uint64_t cpu_clock = nes->nes_cpu.cycles_total + nes->nes_cpu.cycles;
+    if (cpu_clock >= nes->nes_apu.irq_clock || cpu_clock >= nes->nes_apu.dmc_clock){
+        nes_apu_sync(nes);
+    }
+    if (nes->nes_apu.frame_interrupt || nes->nes_apu.dmc_interrupt){
+        nes_cpu_irq(nes);
+    }
+}
+
+int nes_apu_config(nes_t *nes, const nes_apu_config_t* config){
+    nes_apu_t* apu = &nes->nes_apu;
+    static const uint8_t sample_bytes[] = {
+        [NES_APU_FORMAT_U8] = 1, [NES_APU_FORMAT_S8] = 1, [NES_APU_FORMAT_S16] = 2, [NES_APU_FORMAT_F32] = 4,
+    };
+    if (config->sample_rate < 8000 || config->sample_rate > 96000 || (unsigned)config->format > NES_APU_FORMAT_F32){
+        NES_LOG_ERROR("unsupported audio config: %u Hz format %d\n", (unsigned)config->sample_rate, (int)config->format);
+        return NES_ERROR;
+    }
+    const uint16_t block_size = config->block_size ? config->block_size : (uint16_t)(config->sample_rate / 60);
+    uint8_t* buffer = (uint8_t*)nes_malloc((int)(block_size * sample_bytes[config->format]));
+    if (buffer == NULL){
+        return NES_ERROR;
+    }
+#if (NES_APU_STEMS == 1)
+    uint8_t* stem_buffer = (uint8_t*)nes_malloc((int)(block_size * 5));
+    if (stem_buffer == NULL){
+        nes_free(buffer);
+        return NES_ERROR;
+    }
+#endif
+    nes_apu_deinit(nes);
+    apu->config = *config;
+    apu->config.block_size = block_size;
+    apu->sample_bytes = sample_bytes[config->format];
+    apu->sample_buffer = buffer;
+#if (NES_APU_STEMS == 1)
+    apu->stem_buffer = stem_buffer;
+#endif
+    apu->sample_index = 0;
+    apu->sample_phase = 0;
+    apu->highpass_coef = 1.0f - 565.5f / (float)config->sample_rate; // 1 - 2π*90Hz/fs
+    nes_apu_sample_schedule(apu);
+    return NES_OK;
+}
+
+void nes_apu_deinit(nes_t *nes){
+    if (nes->nes_apu.sample_buffer){
+        nes_free(nes->nes_apu.sample_buffer);
+        nes->nes_apu.sample_buffer = NULL;
+    }
+#if (NES_APU_STEMS == 1)
+    if (nes->nes_apu.stem_buffer){
+        nes_free(nes->nes_apu.stem_buffer);
+        nes->nes_apu.stem_buffer = NULL;
+    }
+#endif
 }
 
 void nes_apu_init(nes_t *nes){
+    if (nes->nes_apu.sample_buffer == NULL){
+        const nes_apu_config_t config = {
+            .sample_rate = NES_APU_SAMPLE_RATE,
+            .format = NES_APU_FORMAT_U8,
+            .block_size = NES_APU_SAMPLE_PER_SYNC,
+        };
+        nes_apu_config(nes, &config);
+    }
     nes->nes_apu.status = 0;
     nes->nes_apu.noise.lfsr = 1;
+    nes->nes_apu.noise.timer = apu_noise_period[0];
+    nes->nes_apu.dmc.timer_period = apu_dmc_rate[0];
+    nes->nes_apu.dmc.timer = apu_dmc_rate[0];
+    nes->nes_apu.dmc.bits_remaining = 8;
+    nes->nes_apu.dmc.buffer_empty = 1;
+    nes->nes_apu.dmc.silence = 1;
+    nes->nes_apu.frame_step = 0;
+    nes->nes_apu.frame_wait = apu_frame_step_cycles[0][0];
+    nes_apu_irq_schedule(nes);
 }
 
 uint8_t nes_read_apu_register(nes_t *nes,uint16_t address){
     uint8_t data = 0;
     if(address==0x4015){
+        nes_apu_sync(nes);
         data=nes->nes_apu.status&0xc0;
 
         if (nes->nes_apu.pulse1.length_counter) data |= 1;
         if (nes->nes_apu.pulse2.length_counter) data |= (1 << 1);
         if (nes->nes_apu.triangle.length_counter) data |= (1 << 2);
         if (nes->nes_apu.noise.length_counter) data |= (1 << 3);
-        if (nes->nes_apu.dmc.load_counter) data |= (1 << 4);
+        if (nes->nes_apu.dmc.bytes_remaining) data |= (1 << 4);
 
         nes->nes_apu.frame_interrupt = 0;
+        nes_apu_irq_schedule(nes);
     }else{
         NES_LOG_DEBUG("nes_read apu %04X %02X\n",address,data);
     }
@@ -356,6 +618,8 @@ uint8_t nes_read_apu_register(nes_t *nes,uint16_t address){
 }
 
 void nes_write_apu_register(nes_t* nes,uint16_t address,uint8_t data){
+    // Render everything up to this cycle with the old register values first
+    nes_apu_sync(nes);
     switch(address){
         // Pulse ($4000–$4007)
         // Pulse0 ($4000–$4003)
@@ -377,7 +641,7 @@ void nes_write_apu_register(nes_t* nes,uint16_t address,uint8_t data){
             }
             nes->nes_apu.pulse1.cur_period=nes->nes_apu.pulse1.timer_high<<8|nes->nes_apu.pulse1.timer_low;
             nes->nes_apu.pulse1.envelope_restart = 1;
-            nes->nes_apu.pulse1.seq_local_old = 0;
+            nes->nes_apu.pulse1.sequence = 0;
             break;
         // Pulse1 ($4004–$4007)
         case 0x4004:
@@ -389,6 +653,7 @@ void nes_write_apu_register(nes_t* nes,uint16_t address,uint8_t data){
             break;
         case 0x4006:
             nes->nes_apu.pulse2.timer_low=data;
+            nes->nes_apu.pulse2.cur_period=nes->nes_apu.pulse2.timer_high<<8|nes->nes_apu.pulse2.timer_low;
             break;
         case 0x4007:
             nes->nes_apu.pulse2.control3=data;
@@ -397,7 +662,7 @@ void nes_write_apu_register(nes_t* nes,uint16_t address,uint8_t data){
             }
             nes->nes_apu.pulse2.cur_period=nes->nes_apu.pulse2.timer_high<<8|nes->nes_apu.pulse2.timer_low;
             nes->nes_apu.pulse2.envelope_restart = 1;
-            nes->nes_apu.pulse2.seq_local_old = 0;
+            nes->nes_apu.pulse2.sequence = 0;
             break;
         // Triangle ($4008–$400B)
         case 0x4008:
@@ -436,9 +701,14 @@ void nes_write_apu_register(nes_t* nes,uint16_t address,uint8_t data){
         // DMC ($4010–$4013)
         case 0x4010:
             nes->nes_apu.dmc.control0=data;
+            nes->nes_apu.dmc.timer_period = apu_dmc_rate[nes->nes_apu.dmc.frequency];
+            if (!nes->nes_apu.dmc.irq_enable){
+                nes->nes_apu.dmc_interrupt = 0;
+            }
             break;
         case 0x4011:
             nes->nes_apu.dmc.control1=data;
+            nes->nes_apu.dmc.output_level = nes->nes_apu.dmc.load_counter;
             break;
         case 0x4012:
             nes->nes_apu.dmc.sample_address=data;
@@ -450,7 +720,8 @@ void nes_write_apu_register(nes_t* nes,uint16_t address,uint8_t data){
         //     break;
         // Status ($4015) https://www.nesdev.org/wiki/APU#Status_($4015)
         case 0x4015:
-            nes->nes_apu.status=data;
+            // Writing clears the DMC interrupt flag, the frame interrupt flag is left alone.
+            nes->nes_apu.status = (nes->nes_apu.status & 0x40) | (data & 0x1F);
             if (nes->nes_apu.status_pulse1==0){
                 nes->nes_apu.pulse1.length_counter=0;
             }
@@ -463,13 +734,21 @@ void nes_write_apu_register(nes_t* nes,uint16_t address,uint8_t data){
             if (nes->nes_apu.status_noise==0){
                 nes->nes_apu.noise.length_counter=0;
             }
-            // nes->nes_apu.dmc_interrupt = 0;
+            if (nes->nes_apu.status_dmc==0){
+                nes->nes_apu.dmc.bytes_remaining=0;
+            }else if (nes->nes_apu.dmc.bytes_remaining==0){
+                nes_apu_dmc_restart(&nes->nes_apu.dmc);
+                nes_apu_dmc_fetch(nes);
+            }
             break;
         case 0x4017:
             nes->nes_apu.frame_counter=data;
             if (nes->nes_apu.irq_inhibit_flag){
                 nes->nes_apu.frame_interrupt = 0;
             }
+            // Writing $4017 restarts the sequence
+            nes->nes_apu.frame_step = 0;
+            nes->nes_apu.frame_wait = apu_frame_step_cycles[nes->nes_apu.mode][0];
             if (nes->nes_apu.mode){
                 nes_apu_length_counter_and_sweep(nes);
                 nes_apu_envelopes_and_linear_counter(nes);
@@ -479,6 +758,7 @@ void nes_write_apu_register(nes_t* nes,uint16_t address,uint8_t data){
             NES_LOG_DEBUG("nes_write apu %04X %02X\n",address,data);
             break;
     }
+    nes_apu_irq_schedule(nes);
 }
 
 #endif
@@ -18,6 +18,15 @@
 
 static inline uint8_t nes_read_joypad(nes_t* nes,uint16_t address){
     uint8_t state = 0;
+    nes->nes_cpu.joypad_read = 1;       // Not a lag frame
+#if (NES_INPUT_QUEUE == 1)
+    if (nes->nes_input_queue){
+        nes_input_apply(nes);
+    }
+#endif
+    if (nes->nes_movie && nes->nes_movie->mode != NES_MOVIE_OFF){
+        nes_movie_input(nes);
+    }
     if (address == 0x4016){
         state = (nes->nes_cpu.joypad.joypad & (0x8000 >> (nes->nes_cpu.joypad.offset1 & nes->nes_cpu.joypad.mask))) ? 1 : 0;
         nes->nes_cpu.joypad.offset1++;
@@ -31,8 +40,22 @@ static inline uint8_t nes_read_joypad(nes_t* nes,uint16_t address){
 
 static inline void nes_write_joypad(nes_t* nes,uint8_t data){
     nes->nes_cpu.joypad.mask = (data & 1)?0x00:0x07;
-    if (data & 1)
+#if (NES_INPUT_QUEUE == 1)
+    if (nes->nes_input_queue){
+        nes_input_apply(nes);
+    }
+#endif
+    if (data & 1){
+        // Late latch: the port refreshes the buttons the moment the game strobes them, a played-back movie owns the input
+        if (nes->nes_input_latch && (nes->nes_movie == NULL || nes->nes_movie->mode != NES_MOVIE_PLAY)){
+            nes->nes_input_latch(nes);
+        }
         nes->nes_cpu.joypad.offset1 = nes->nes_cpu.joypad.offset2 = 0;
+    }
+    // After the queue and the latch: the movie records what they left, or overrides it on playback
+    if (nes->nes_movie && nes->nes_movie->mode != NES_MOVIE_OFF){
+        nes_movie_input(nes);
+    }
     // NES_LOG_DEBUG("nes_write joypad %04X %02X %d\n",address,data,nes->nes_cpu.joypad.mask);
 }
 
@@ -49,6 +72,8 @@ static inline uint8_t nes_read_cpu(nes_t* nes,uint16_t address){
 #if (NES_ENABLE_SOUND == 1)
                 return nes_read_apu_register(nes, address);
 #endif
+            }else if (address >= 0x4018 && nes->nes_mapper.mapper_read_apu){ // $4018-$5FFF cartridge space
+                return nes->nes_mapper.mapper_read_apu(nes, address);
             }else{
                 NES_LOG_DEBUG("nes_read address %04X not support \n",address);
             }
@@ -111,6 +136,8 @@ static inline void nes_write_cpu(nes_t* nes,uint16_t address, uint8_t data){
 #if (NES_ENABLE_SOUND == 1)
                 nes_write_apu_register(nes, address,data);
 #endif
+            }else if (address >= 0x4018 && nes->nes_mapper.mapper_apu){ // $4018-$5FFF cartridge space
+                nes->nes_mapper.mapper_apu(nes, address, data);
             }else{
                 NES_LOG_DEBUG("nes_write address %04X not support\n",address);
             }
@@ -1306,6 +1333,11 @@ void nes_cpu_irq(nes_t* nes){
     }
 }
 
+// Bus read for the other units (DMC DMA), goes through the same decoding as the CPU
+uint8_t nes_cpu_read(nes_t* nes, uint16_t address){
+    return nes_read_cpu(nes, address);
+}
+
 // https://www.nesdev.org/wiki/CPU_power_up_state#After_reset
 void nes_cpu_reset(nes_t* nes){
     NES_I_SET;                          // The I (IRQ disable) flag was set to true
@@ -1646,6 +1678,7 @@ void nes_opcode(nes_t* nes,uint16_t ticks){
 #endif
     }
     nes->nes_cpu.cycles -= ticks;
+    nes->nes_cpu.cycles_total += ticks;
 }
 
 
@@ -41,6 +41,16 @@ NES_WEAK int nes_memcmp(const void *str1, const void *str2, size_t n){
     return memcmp(str1,str2,n);
 }
 
+#if (NES_ENABLE_SOUND == 1) && (NES_APU_STEMS == 1)
+/* port: per-channel levels, nothing to do unless the port records them */
+NES_WEAK int nes_sound_stems(struct nes* nes, uint8_t *stems, size_t len){
+    (void)nes;
+    (void)stems;
+    (void)len;
+    return 0;
+}
+#endif
+
 #if (NES_USE_FS == 1)
 /* io */
 NES_WEAK FILE *nes_fopen(const char * filename, const char * mode ){
@@ -62,6 +72,25 @@ NES_WEAK int nes_fseek(FILE *stream, long int offset, int whence){
 NES_WEAK int nes_fclose(FILE *stream ){
     return fclose(stream);
 }
+
+#if (NES_ROM_CACHE == 1)
+NES_WEAK void *nes_file_map(const char * filename, size_t *size){
+    (void)filename;
+    (void)size;
+    return NULL;
+}
+
+NES_WEAK void nes_file_unmap(void *data, size_t size){
+    (void)data;
+    (void)size;
+}
+
+NES_WEAK int nes_file_id(const char * filename, nes_file_id_t *id){
+    (void)filename;
+    (void)id;
+    return -1;
+}
+#endif
 #endif
 
 #endif
@@ -0,0 +1,115 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes.h"
+
+#if (NES_DIRTY_TILE > 0)
+
+#if (NES_DIRTY_TILE != 8) && (NES_DIRTY_TILE != 16)
+#error "NES_DIRTY_TILE must be 8 or 16"
+#endif
+#if (NES_DRAW_BLOCK % NES_DIRTY_TILE != 0)
+#error "NES_DRAW_BLOCK must be a multiple of NES_DIRTY_TILE"
+#endif
+
+#define NES_DIRTY_FULL_NEXT     (1)     /* Set by nes_dirty_invalidate(), the whole next picture */
+#define NES_DIRTY_FULL_FRAME    (2)     /* The picture being rendered */
+
+NES_WEAK int nes_draw_dirty(nes_t* nes, int y1, int y2, const nes_rect_t* rects, uint16_t count, nes_color_t* color_data){
+    (void)rects;
+    (void)count;
+    return nes_draw(nes, 0, y1, NES_WIDTH-1, y2, color_data);
+}
+
+void nes_dirty_invalidate(nes_t* nes){
+    nes->nes_dirty.full = NES_DIRTY_FULL_NEXT;
+}
+
+// Tiles x1-x2 of tile row `row` changed: grows the rectangle right above it or adds one
+static void nes_dirty_rect(nes_dirty_t* dirty, uint16_t row, uint16_t x1, uint16_t x2){
+    const uint16_t y1 = (uint16_t)(row * NES_DIRTY_TILE);
+    const uint16_t y2 = (uint16_t)(y1 + NES_DIRTY_TILE - 1);
+    for (uint16_t i = dirty->rect_count; i > 0; i--){
+        nes_rect_t* rect = &dirty->rects[i - 1];
+        if (rect->y2 + 1 == y1 && rect->x1 == x1 && rect->x2 == x2){
+            rect->y2 = y2;
+            return;
+        }
+    }
+    if (dirty->rect_count < NES_DIRTY_RECTS){
+        nes_rect_t* rect = &dirty->rects[dirty->rect_count++];
+        rect->x1 = x1;
+        rect->y1 = y1;
+        rect->x2 = x2;
+        rect->y2 = y2;
+        return;
+    }
+    nes_rect_t* rect = &dirty->rects[NES_DIRTY_RECTS - 1];
+    rect->x1 = x1 < rect->x1 ? x1 : rect->x1;
+    rect->x2 = x2 > rect->x2 ? x2 : rect->x2;
+    rect->y2 = y2;
+}
+
+// FNV-1a over the pixels of each tile, a tile row is compared once its last line is done
+void nes_dirty_line(nes_t* nes, const nes_color_t* line){
+    nes_dirty_t* dirty = &nes->nes_dirty;
+    const uint16_t y = nes->scanline;
+    if (y % NES_DIRTY_TILE == 0){
+        if (y == 0 && dirty->full == NES_DIRTY_FULL_NEXT){
+            dirty->full = NES_DIRTY_FULL_FRAME;
+        }
+        for (uint16_t column = 0; column < NES_DIRTY_COLUMNS; column++){
+            dirty->row[column] = 0x811C9DC5u;
+        }
+    }
+    for (uint16_t column = 0; column < NES_DIRTY_COLUMNS; column++){
+        uint32_t hash = dirty->row[column];
+        for (uint8_t x = 0; x < NES_DIRTY_TILE; x++){
+            hash = (hash ^ (uint32_t)line[x]) * 0x01000193u;
+        }
+        dirty->row[column] = hash;
+        line += NES_DIRTY_TILE;
+    }
+    if (y % NES_DIRTY_TILE != NES_DIRTY_TILE - 1){
+        return;
+    }
+    const uint16_t row = y / NES_DIRTY_TILE;
+    int16_t first = -1;
+    for (uint16_t column = 0; column < NES_DIRTY_COLUMNS; column++){
+        const uint8_t changed = dirty->full || dirty->hash[row][column] != dirty->row[column];
+        dirty->hash[row][column] = dirty->row[column];
+        if (changed && first < 0){
+            first = (int16_t)column;
+        }else if (!changed && first >= 0){
+            nes_dirty_rect(dirty, row, (uint16_t)(first * NES_DIRTY_TILE), (uint16_t)(column * NES_DIRTY_TILE - 1));
+            first = -1;
+        }
+    }
+    if (first >= 0){
+        nes_dirty_rect(dirty, row, (uint16_t)(first * NES_DIRTY_TILE), NES_WIDTH - 1);
+    }
+}
+
+void nes_dirty_draw(nes_t* nes, uint16_t y1, uint16_t y2, nes_color_t* color_data){
+    nes_dirty_t* dirty = &nes->nes_dirty;
+    nes_draw_dirty(nes, y1, y2, dirty->rects, dirty->rect_count, color_data);
+    dirty->rect_count = 0;
+    if (y2 == NES_HEIGHT - 1 && dirty->full == NES_DIRTY_FULL_FRAME){
+        dirty->full = 0;
+    }
+}
+
+#endif
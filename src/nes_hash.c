@@ -0,0 +1,222 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes.h"
+
+#define NES_HASH_PRIME1         (0x9E3779B185EBCA87ULL)
+#define NES_HASH_PRIME2         (0xC2B2AE3D27D4EB4FULL)
+#define NES_HASH_PRIME3         (0x165667B19E3779F9ULL)
+#define NES_HASH_PRIME4         (0x85EBCA77C2B2AE63ULL)
+#define NES_HASH_PRIME5         (0x27D4EB2F165667C5ULL)
+
+static inline uint64_t nes_hash_rotl(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+// Unaligned loads: plain memcpy with a constant size compiles to a single load
+static inline uint64_t nes_hash_read64(const uint8_t* p){
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint32_t nes_hash_read32(const uint8_t* p){
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t nes_hash_round(uint64_t acc, uint64_t input){
+    acc += input * NES_HASH_PRIME2;
+    acc = nes_hash_rotl(acc, 31);
+    return acc * NES_HASH_PRIME1;
+}
+
+static inline uint64_t nes_hash_merge(uint64_t acc, uint64_t v){
+    acc ^= nes_hash_round(0, v);
+    return acc * NES_HASH_PRIME1 + NES_HASH_PRIME4;
+}
+
+static inline uint64_t nes_hash_converge(const uint64_t v[4]){
+    uint64_t hash = nes_hash_rotl(v[0], 1) + nes_hash_rotl(v[1], 7) + nes_hash_rotl(v[2], 12) + nes_hash_rotl(v[3], 18);
+    hash = nes_hash_merge(hash, v[0]);
+    hash = nes_hash_merge(hash, v[1]);
+    hash = nes_hash_merge(hash, v[2]);
+    return nes_hash_merge(hash, v[3]);
+}
+
+// Stripes of 32 bytes into the four lanes, returns the end of the last whole stripe
+static inline const uint8_t* nes_hash_stripes(uint64_t v[4], const uint8_t* p, const uint8_t* end){
+    uint64_t v1 = v[0], v2 = v[1], v3 = v[2], v4 = v[3];
+    for (; end - p >= 32; p += 32){
+        v1 = nes_hash_round(v1, nes_hash_read64(p));
+        v2 = nes_hash_round(v2, nes_hash_read64(p + 8));
+        v3 = nes_hash_round(v3, nes_hash_read64(p + 16));
+        v4 = nes_hash_round(v4, nes_hash_read64(p + 24));
+    }
+    v[0] = v1;
+    v[1] = v2;
+    v[2] = v3;
+    v[3] = v4;
+    return p;
+}
+
+static inline void nes_hash_lanes(uint64_t v[4], uint64_t seed){
+    v[0] = seed + NES_HASH_PRIME1 + NES_HASH_PRIME2;
+    v[1] = seed + NES_HASH_PRIME2;
+    v[2] = seed;
+    v[3] = seed - NES_HASH_PRIME1;
+}
+
+// Last 0-31 bytes and avalanche
+static uint64_t nes_hash_finalize(uint64_t hash, const uint8_t* p, const uint8_t* end){
+    for (; end - p >= 8; p += 8){
+        hash ^= nes_hash_round(0, nes_hash_read64(p));
+        hash = nes_hash_rotl(hash, 27) * NES_HASH_PRIME1 + NES_HASH_PRIME4;
+    }
+    if (end - p >= 4){
+        hash ^= (uint64_t)nes_hash_read32(p) * NES_HASH_PRIME1;
+        hash = nes_hash_rotl(hash, 23) * NES_HASH_PRIME2 + NES_HASH_PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++){
+        hash ^= (*p) * NES_HASH_PRIME5;
+        hash = nes_hash_rotl(hash, 11) * NES_HASH_PRIME1;
+    }
+    hash ^= hash >> 33;
+    hash *= NES_HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= NES_HASH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t nes_hash64(const void* data, size_t size, uint64_t seed){
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* const end = p + size;
+    uint64_t hash;
+    if (size >= 32){
+        uint64_t v[4];
+        nes_hash_lanes(v, seed);
+        p = nes_hash_stripes(v, p, end);
+        hash = nes_hash_converge(v);
+    }else{
+        hash = seed + NES_HASH_PRIME5;
+    }
+    return nes_hash_finalize(hash + (uint64_t)size, p, end);
+}
+
+void nes_hash_reset(nes_hash_state_t* state, uint64_t seed){
+    nes_hash_lanes(state->v, seed);
+    state->seed = seed;
+    state->total = 0;
+    state->buffered = 0;
+}
+
+void nes_hash_update(nes_hash_state_t* state, const void* data, size_t size){
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* const end = p + size;
+    state->total += size;
+    if (state->buffered + size < 32){
+        memcpy(state->buffer + state->buffered, p, size);
+        state->buffered += (uint32_t)size;
+        return;
+    }
+    if (state->buffered){
+        const size_t fill = 32 - state->buffered;
+        memcpy(state->buffer + state->buffered, p, fill);
+        nes_hash_stripes(state->v, state->buffer, state->buffer + 32);
+        p += fill;
+        state->buffered = 0;
+    }
+    p = nes_hash_stripes(state->v, p, end);
+    if (p < end){
+        memcpy(state->buffer, p, (size_t)(end - p));
+        state->buffered = (uint32_t)(end - p);
+    }
+}
+
+uint64_t nes_hash_digest(const nes_hash_state_t* state){
+    const uint64_t hash = state->total >= 32 ? nes_hash_converge(state->v) : state->seed + NES_HASH_PRIME5;
+    return nes_hash_finalize(hash + state->total, state->buffer, state->buffer + state->buffered);
+}
+
+uint64_t nes_rom_hash(nes_t* nes){
+    uint64_t hash = nes_hash64(nes->nes_rom.prg_rom, (size_t)nes->nes_rom.prg_rom_size * PRG_ROM_UNIT_SIZE, nes->nes_rom.mapper_number);
+    if (nes->nes_rom.chr_rom_size){
+        hash = nes_hash64(nes->nes_rom.chr_rom, (size_t)nes->nes_rom.chr_rom_size * CHR_ROM_UNIT_SIZE, hash);
+    }
+    return hash;
+}
+
+#if (NES_FRAME_HASH == 1)
+
+void nes_frame_hash_enable(nes_t* nes, uint8_t enable){
+    nes_frame_hash_t* frame_hash = &nes->nes_frame_hash;
+    frame_hash->enable = enable;
+    frame_hash->frame = 0;
+    frame_hash->lines = 0;
+    nes_hash_reset(&frame_hash->video_state, 0);
+}
+
+void nes_frame_hash_line(nes_t* nes, const nes_color_t* line){
+    nes_frame_hash_t* frame_hash = &nes->nes_frame_hash;
+    if (nes->scanline == 0){
+        nes_hash_reset(&frame_hash->video_state, 0);
+        frame_hash->lines = 0;
+    }
+    nes_hash_update(&frame_hash->video_state, line, NES_WIDTH * sizeof(nes_color_t));
+    frame_hash->lines++;
+}
+
+void nes_frame_hash_end(nes_t* nes){
+    nes_frame_hash_t* frame_hash = &nes->nes_frame_hash;
+    frame_hash->video = frame_hash->lines == NES_HEIGHT ? nes_hash_digest(&frame_hash->video_state) : 0;
+    frame_hash->lines = 0;
+    frame_hash->ram = nes_hash64(nes->nes_cpu.cpu_ram, NES_CPU_RAM_SIZE, 0);
+    frame_hash->vram = nes_hash64(nes->nes_ppu.ppu_vram, sizeof(nes->nes_ppu.ppu_vram), 0);
+#if (NES_USE_FS == 1)
+    if (frame_hash->log){
+        char line[80];
+        const int size = snprintf(line, sizeof(line), "%u %016llx %016llx %016llx\n", (unsigned)frame_hash->frame,
+                                  (unsigned long long)frame_hash->video, (unsigned long long)frame_hash->ram,
+                                  (unsigned long long)frame_hash->vram);
+        nes_fwrite(line, 1, (size_t)size, frame_hash->log);
+    }
+#endif
+    frame_hash->frame++;
+}
+
+#if (NES_USE_FS == 1)
+int nes_frame_hash_log(nes_t* nes, const char* file_path){
+    nes_frame_hash_t* frame_hash = &nes->nes_frame_hash;
+    if (frame_hash->log){
+        nes_fclose(frame_hash->log);
+        frame_hash->log = NULL;
+    }
+    if (file_path == NULL){
+        return NES_OK;
+    }
+    frame_hash->log = nes_fopen(file_path, "wb");
+    if (frame_hash->log == NULL){
+        NES_LOG_ERROR("nes_frame_hash_log: failed to open file %s\n", file_path);
+        return NES_ERROR;
+    }
+    return NES_OK;
+}
+#endif
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes.h"
+
+#if (NES_INPUT_QUEUE == 1)
+
+#include <stdatomic.h>
+
+#if (NES_INPUT_QUEUE_SIZE & (NES_INPUT_QUEUE_SIZE - 1)) != 0
+#error "NES_INPUT_QUEUE_SIZE must be a power of two"
+#endif
+
+/*
+    Single-producer single-consumer ring: the producer owns head, the core owns tail. The indices run
+    freely and are masked on access; each sits on its own cache line so the two threads do not
+    bounce one line between them.
+*/
+struct nes_input_queue{
+    _Atomic uint32_t head;                  /*  Next slot the producer writes */
+    uint8_t head_pad[64 - sizeof(uint32_t)];
+    _Atomic uint32_t tail;                  /*  Next event the core applies */
+    uint8_t tail_pad[64 - sizeof(uint32_t)];
+    _Atomic uint64_t frame_clock;           /*  Published by the core at every frame end */
+    nes_input_event_t events[NES_INPUT_QUEUE_SIZE];
+};
+
+int nes_input_init(nes_t* nes){
+    if (nes->nes_input_queue){
+        nes_input_clear(nes);
+        return NES_OK;
+    }
+    nes_input_queue_t* queue = (nes_input_queue_t*)nes_malloc(sizeof(nes_input_queue_t));
+    if (queue == NULL){
+        return NES_ERROR;
+    }
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->frame_clock, nes->nes_cpu.cycles_total + nes->nes_cpu.cycles);
+    nes->nes_input_queue = queue;
+    return NES_OK;
+}
+
+void nes_input_deinit(nes_t* nes){
+    if (nes->nes_input_queue){
+        nes_free(nes->nes_input_queue);
+        nes->nes_input_queue = NULL;
+    }
+}
+
+int nes_input_push(nes_t* nes, uint64_t cycle, uint16_t joypad){
+    nes_input_queue_t* queue = nes->nes_input_queue;
+    const uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&queue->tail, memory_order_acquire) >= NES_INPUT_QUEUE_SIZE){
+        return NES_ERROR;
+    }
+    nes_input_event_t* event = &queue->events[head & (NES_INPUT_QUEUE_SIZE - 1)];
+    event->cycle = cycle;
+    event->joypad = joypad;
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return NES_OK;
+}
+
+uint64_t nes_input_frame_clock(nes_t* nes){
+    return atomic_load_explicit(&nes->nes_input_queue->frame_clock, memory_order_relaxed);
+}
+
+void nes_input_clear(nes_t* nes){
+    nes_input_queue_t* queue = nes->nes_input_queue;
+    atomic_store_explicit(&queue->tail, atomic_load_explicit(&queue->head, memory_order_acquire), memory_order_release);
+}
+
+void nes_input_apply(nes_t* nes){
+    // Run-ahead frames are rolled back and the movie owns the input while it plays: the events wait
+    if ((nes->nes_hidden & NES_HIDDEN_SPECULATIVE) || (nes->nes_movie && nes->nes_movie->mode == NES_MOVIE_PLAY)){
+        return;
+    }
+    nes_input_queue_t* queue = nes->nes_input_queue;
+    const uint64_t clock = nes->nes_cpu.cycles_total + nes->nes_cpu.cycles;
+    const uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    while (tail != head){
+        const nes_input_event_t* event = &queue->events[tail & (NES_INPUT_QUEUE_SIZE - 1)];
+        if (event->cycle > clock){
+            break;
+        }
+        nes->nes_cpu.joypad.joypad = event->joypad;
+        tail++;
+    }
+    atomic_store_explicit(&queue->tail, tail, memory_order_release);
+}
+
+void nes_input_frame(nes_t* nes){
+    nes_input_apply(nes);
+    atomic_store_explicit(&nes->nes_input_queue->frame_clock, nes->nes_cpu.cycles_total + nes->nes_cpu.cycles, memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,220 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes.h"
+
+/*
+    Sequence: token | literal length+ | literals | offset (LE16) | match length+
+    token: high nibble literal length, low nibble match length - 4, 15 means more bytes follow (255 = continue).
+    The last sequence has literals only; matches end at least 5 bytes before the end of the block.
+*/
+
+#define NES_LZ_HASH_BITS        (10)
+#define NES_LZ_MIN_MATCH        (4)
+#define NES_LZ_LAST_LITERALS    (5)
+#define NES_LZ_MATCH_LIMIT      (12)        /*  No match starts in the last 12 bytes */
+#define NES_LZ_MAX_OFFSET       (0xFFFF)
+#define NES_LZ_SKIP_SHIFT       (5)
+
+// Unaligned loads: plain memcpy with a constant size compiles to a single load, the nes_memcpy hook would be a call
+static inline uint32_t nes_lz_read32(const uint8_t* p){
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t nes_lz_hash(uint32_t v){
+    return (v * 2654435761U) >> (32 - NES_LZ_HASH_BITS);
+}
+
+static inline uint64_t nes_lz_read64(const uint8_t* p){
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+// Length of the match at `p` against `ref`, 8 bytes per compare (snapshot deltas are long zero runs)
+static inline size_t nes_lz_match_length(const uint8_t* ref, const uint8_t* p, const uint8_t* end){
+    const uint8_t* const start = p;
+    p += NES_LZ_MIN_MATCH;
+    ref += NES_LZ_MIN_MATCH;
+    while (end - p >= 8){
+        const uint64_t diff = nes_lz_read64(p) ^ nes_lz_read64(ref);
+        if (diff){
+#if defined(__GNUC__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+            return (size_t)(p - start) + ((size_t)__builtin_ctzll(diff) >> 3);
+#else
+            break;
+#endif
+        }
+        p += 8;
+        ref += 8;
+    }
+    while (p < end && *p == *ref){
+        p++;
+        ref++;
+    }
+    return (size_t)(p - start);
+}
+
+static uint8_t* nes_lz_write_length(uint8_t* op, const uint8_t* end, size_t length){
+    for (; length >= 255; length -= 255){
+        if (op >= end){
+            return NULL;
+        }
+        *op++ = 255;
+    }
+    if (op >= end){
+        return NULL;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+static uint8_t* nes_lz_write_sequence(uint8_t* op, const uint8_t* end, const uint8_t* literals, size_t literal_length,
+                                      size_t offset, size_t match_length){
+    if (op >= end){
+        return NULL;
+    }
+    uint8_t* token = op++;
+    *token = (uint8_t)((literal_length < 15 ? literal_length : 15) << 4);
+    if (literal_length >= 15 && (op = nes_lz_write_length(op, end, literal_length - 15)) == NULL){
+        return NULL;
+    }
+    if ((size_t)(end - op) < literal_length){
+        return NULL;
+    }
+    nes_memcpy(op, literals, literal_length);
+    op += literal_length;
+    if (match_length == 0){                 // Last sequence
+        return op;
+    }
+    if (end - op < 2){
+        return NULL;
+    }
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    match_length -= NES_LZ_MIN_MATCH;
+    *token |= (uint8_t)(match_length < 15 ? match_length : 15);
+    if (match_length >= 15){
+        op = nes_lz_write_length(op, end, match_length - 15);
+    }
+    return op;
+}
+
+size_t nes_lz_compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity){
+    uint32_t table[1 << NES_LZ_HASH_BITS];
+    uint8_t* op = dst;
+    const uint8_t* end = dst + capacity;
+    size_t anchor = 0;
+    if (size > NES_LZ_MATCH_LIMIT){
+        nes_memset(table, 0, sizeof(table));
+        const size_t match_limit = size - NES_LZ_MATCH_LIMIT;
+        const size_t match_end = size - NES_LZ_LAST_LITERALS;
+        size_t i = 1;
+        uint32_t misses = 0;
+        while (i < match_limit){
+            const uint32_t sequence = nes_lz_read32(src + i);
+            const uint32_t hash = nes_lz_hash(sequence);
+            size_t ref = table[hash];
+            table[hash] = (uint32_t)i;
+            if (i - ref > NES_LZ_MAX_OFFSET || nes_lz_read32(src + ref) != sequence){
+                // Skip faster through data that does not compress
+                i += 1 + (misses++ >> NES_LZ_SKIP_SHIFT);
+                continue;
+            }
+            misses = 0;
+            while (i > anchor && ref > 0 && src[i - 1] == src[ref - 1]){
+                i--;
+                ref--;
+            }
+            const size_t length = nes_lz_match_length(src + ref, src + i, src + match_end);
+            op = nes_lz_write_sequence(op, end, src + anchor, i - anchor, i - ref, length);
+            if (op == NULL){
+                return 0;
+            }
+            i += length;
+            anchor = i;
+            if (i < match_limit){
+                table[nes_lz_hash(nes_lz_read32(src + i - 2))] = (uint32_t)(i - 2);
+            }
+        }
+    }
+    op = nes_lz_write_sequence(op, end, src + anchor, size - anchor, 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+int nes_lz_decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dst_size){
+    const uint8_t* ip = src;
+    const uint8_t* const ip_end = src + size;
+    uint8_t* op = dst;
+    uint8_t* const op_end = dst + dst_size;
+    while (ip < ip_end){
+        const uint8_t token = *ip++;
+        size_t length = token >> 4;
+        if (length == 15){
+            uint8_t byte;
+            do {
+                if (ip >= ip_end){
+                    return NES_ERROR;
+                }
+                byte = *ip++;
+                length += byte;
+            } while (byte == 255);
+        }
+        if ((size_t)(ip_end - ip) < length || (size_t)(op_end - op) < length){
+            return NES_ERROR;
+        }
+        nes_memcpy(op, ip, length);
+        ip += length;
+        op += length;
+        if (ip == ip_end){
+            break;
+        }
+        if (ip_end - ip < 2){
+            return NES_ERROR;
+        }
+        const size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)){
+            return NES_ERROR;
+        }
+        length = (token & 0x0F);
+        if (length == 15){
+            uint8_t byte;
+            do {
+                if (ip >= ip_end){
+                    return NES_ERROR;
+                }
+                byte = *ip++;
+                length += byte;
+            } while (byte == 255);
+        }
+        length += NES_LZ_MIN_MATCH;
+        if ((size_t)(op_end - op) < length){
+            return NES_ERROR;
+        }
+        // Overlapping match: the copied pattern doubles every round, each memcpy stays non-overlapping
+        const uint8_t* match = op - offset;
+        while (length){
+            const size_t n = length < (size_t)(op - match) ? length : (size_t)(op - match);
+            nes_memcpy(op, match, n);
+            op += n;
+            length -= n;
+        }
+    }
+    return op == op_end ? NES_OK : NES_ERROR;
+}
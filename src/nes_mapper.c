@@ -73,3 +73,11 @@ int nes_load_mapper(nes_t* nes){
             return NES_ERROR;
     }
 }
+
+/* Releases the per-instance mapper state */
+void nes_unload_mapper(nes_t* nes){
+    if (nes->nes_mapper.mapper_deinit){
+        nes->nes_mapper.mapper_deinit(nes);
+    }
+    nes_memset(&nes->nes_mapper, 0, sizeof(nes_mapper_t));
+}
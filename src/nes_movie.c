@@ -0,0 +1,362 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes.h"
+
+static nes_movie_t* nes_movie_alloc(nes_t* nes, uint32_t state_size){
+    nes_movie_deinit(nes);
+    nes_movie_t* movie = (nes_movie_t*)nes_malloc(sizeof(nes_movie_t));
+    if (movie == NULL){
+        return NULL;
+    }
+    nes_memset(movie, 0, sizeof(nes_movie_t));
+    movie->state_size = state_size;
+    movie->mismatch_frame = NES_MOVIE_NO_MISMATCH;
+    movie->joypad = NES_MOVIE_NO_INPUT;
+    movie->state = (uint8_t*)nes_malloc((int)state_size);
+    nes->nes_movie = movie;
+    if (movie->state == NULL){
+        nes_movie_deinit(nes);
+        return NULL;
+    }
+    return movie;
+}
+
+void nes_movie_deinit(nes_t* nes){
+    nes_movie_t* movie = nes->nes_movie;
+    if (movie == NULL){
+        return;
+    }
+    if (movie->state){
+        nes_free(movie->state);
+    }
+    if (movie->frames){
+        nes_free(movie->frames);
+    }
+    if (movie->inputs){
+        nes_free(movie->inputs);
+    }
+    nes_free(movie);
+    nes->nes_movie = NULL;
+}
+
+// Grows `*items` (item_size bytes each, `used` of them kept) to hold at least `count`
+static int nes_movie_grow(void** items, uint32_t* max, uint32_t used, uint32_t count, size_t item_size, uint32_t first){
+    if (count <= *max){
+        return NES_OK;
+    }
+    uint32_t new_max = *max ? *max * 2 : first;
+    while (new_max < count){
+        new_max *= 2;
+    }
+    void* grown = nes_malloc((int)(new_max * item_size));
+    if (grown == NULL){
+        return NES_ERROR;
+    }
+    if (*items){
+        nes_memcpy(grown, *items, used * item_size);
+        nes_free(*items);
+    }
+    *items = grown;
+    *max = new_max;
+    return NES_OK;
+}
+
+static int nes_movie_reserve(nes_movie_t* movie, uint32_t count){
+    return nes_movie_grow((void**)&movie->frames, &movie->frame_max, movie->frame_count, count, sizeof(nes_movie_frame_t), 3600);
+}
+
+static int nes_movie_reserve_inputs(nes_movie_t* movie, uint32_t count){
+    return nes_movie_grow((void**)&movie->inputs, &movie->input_max, movie->input_count, count, sizeof(nes_movie_input_t), 256);
+}
+
+static void nes_movie_hash(nes_t* nes, nes_movie_frame_t* frame){
+#if (NES_FRAME_HASH == 1)
+    // Already hashed line by line, same values as hashing the whole buffer
+    if (nes->nes_frame_hash.enable){
+        frame->video_hash = nes->nes_frame_hash.video;
+        frame->ram_hash = nes->nes_frame_hash.ram;
+        return;
+    }
+#endif
+#if (NES_DRAW_LINES == NES_HEIGHT) && (NES_FRAME_SKIP == 0)
+    if ((nes->nes_hidden & NES_HIDDEN_VIDEO) == 0){
+        // Line by line: the host frame may have a stride, the hash is the same as over a packed frame
+        nes_hash_state_t state;
+        nes_hash_reset(&state, 0);
+        for (uint16_t line = 0; line < NES_HEIGHT; line++){
+            nes_hash_update(&state, nes->nes_draw_data + line * nes->nes_draw_stride, NES_WIDTH * sizeof(nes_color_t));
+        }
+        frame->video_hash = nes_hash_digest(&state);
+    }
+#endif
+    frame->ram_hash = nes_hash64(nes->nes_cpu.cpu_ram, NES_CPU_RAM_SIZE, 0);
+}
+
+int nes_movie_record(nes_t* nes, uint8_t flags){
+    const size_t state_size = nes_state_size(nes);
+    if (state_size == 0){
+        NES_LOG_ERROR("nes_movie_record: state can not be captured\n");
+        return NES_ERROR;
+    }
+    nes_movie_t* movie = nes_movie_alloc(nes, (uint32_t)state_size);
+    if (movie == NULL){
+        return NES_ERROR;
+    }
+    movie->flags = flags;
+    movie->rom_hash = nes_rom_hash(nes);
+    nes_state_save(nes, movie->state, state_size);
+    movie->mode = NES_MOVIE_RECORD;
+#if (NES_FRAME_HASH == 1)
+    if (flags & NES_MOVIE_HASH){
+        nes_frame_hash_enable(nes, 1);
+    }
+#endif
+    return NES_OK;
+}
+
+int nes_movie_play(nes_t* nes){
+    nes_movie_t* movie = nes->nes_movie;
+    if (movie == NULL || nes_state_load(nes, movie->state, movie->state_size)){
+        return NES_ERROR;
+    }
+    movie->frame = 0;
+    movie->input = 0;
+    movie->joypad = NES_MOVIE_NO_INPUT;
+    movie->mismatch_frame = NES_MOVIE_NO_MISMATCH;
+    movie->mode = movie->frame_count ? NES_MOVIE_PLAY : NES_MOVIE_OFF;
+#if (NES_FRAME_HASH == 1)
+    if (movie->flags & NES_MOVIE_HASH){
+        nes_frame_hash_enable(nes, 1);
+    }
+#endif
+    return NES_OK;
+}
+
+void nes_movie_frame(nes_t* nes){
+    nes_movie_t* movie = nes->nes_movie;
+    if (movie->mode == NES_MOVIE_RECORD){
+        if (nes_movie_reserve(movie, movie->frame_count + 1)){
+            NES_LOG_ERROR("nes_movie: out of memory, recording stopped at frame %u\n", (unsigned)movie->frame_count);
+            movie->mode = NES_MOVIE_OFF;
+            return;
+        }
+        nes_movie_frame_t* frame = &movie->frames[movie->frame_count++];
+        nes_memset(frame, 0, sizeof(nes_movie_frame_t));
+        frame->joypad = nes->nes_cpu.joypad.joypad;
+        if (movie->flags & NES_MOVIE_HASH){
+            nes_movie_hash(nes, frame);
+        }
+        movie->frame = movie->frame_count;
+    }else if (movie->mode == NES_MOVIE_PLAY){
+        const nes_movie_frame_t* recorded = &movie->frames[movie->frame];
+        if ((movie->flags & NES_MOVIE_HASH) && movie->mismatch_frame == NES_MOVIE_NO_MISMATCH){
+            nes_movie_frame_t current = {0};
+            nes_movie_hash(nes, &current);
+            if (current.ram_hash != recorded->ram_hash
+                || (current.video_hash && recorded->video_hash && current.video_hash != recorded->video_hash)){
+                NES_LOG_ERROR("nes_movie: frame %u does not match the recording\n", (unsigned)movie->frame);
+                movie->mismatch_frame = movie->frame;
+            }
+        }
+        if (++movie->frame == movie->frame_count){
+            movie->mode = NES_MOVIE_OFF;
+        }
+    }
+}
+
+void nes_movie_input(nes_t* nes){
+    nes_movie_t* movie = nes->nes_movie;
+    // Run-ahead frames are rolled back, they neither record nor consume inputs
+    if (nes->nes_hidden & NES_HIDDEN_SPECULATIVE){
+        return;
+    }
+    const uint64_t clock = nes->nes_cpu.cycles_total + nes->nes_cpu.cycles;
+    if (movie->mode == NES_MOVIE_RECORD){
+        if (nes->nes_cpu.joypad.joypad == movie->joypad){
+            return;
+        }
+        if (nes_movie_reserve_inputs(movie, movie->input_count + 1)){
+            NES_LOG_ERROR("nes_movie: out of memory, recording stopped at frame %u\n", (unsigned)movie->frame_count);
+            movie->mode = NES_MOVIE_OFF;
+            return;
+        }
+        nes_movie_input_t* input = &movie->inputs[movie->input_count++];
+        nes_memset(input, 0, sizeof(nes_movie_input_t));
+        input->cycle = clock;
+        input->joypad = nes->nes_cpu.joypad.joypad;
+        movie->joypad = input->joypad;
+    }else if (movie->mode == NES_MOVIE_PLAY){
+        while (movie->input < movie->input_count && movie->inputs[movie->input].cycle <= clock){
+            movie->joypad = movie->inputs[movie->input++].joypad;
+        }
+        // Whatever the host wrote in between, the game sees what it saw while recording
+        if (movie->joypad != NES_MOVIE_NO_INPUT){
+            nes->nes_cpu.joypad.joypad = (uint16_t)movie->joypad;
+        }
+    }
+}
+
+#if (NES_USE_FS == 1)
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint64_t rom_hash;
+    uint32_t frame_count;
+    uint32_t state_size;
+    uint32_t state_stored;              /*  Stored size, equal to state_size when not compressed */
+    uint32_t frames_stored;
+    uint32_t input_count;
+    uint32_t inputs_stored;
+    uint64_t checksum;                  /*  nes_hash64 of the uncompressed snapshot, frames and inputs */
+} nes_movie_file_header_t;
+
+static uint64_t nes_movie_checksum(const nes_movie_t* movie){
+    uint64_t hash = nes_hash64(movie->state, movie->state_size, 0);
+    hash = nes_hash64(movie->frames, movie->frame_count * sizeof(nes_movie_frame_t), hash);
+    return nes_hash64(movie->inputs, movie->input_count * sizeof(nes_movie_input_t), hash);
+}
+
+// Compressed into `scratch` when that is smaller, returns the block to write
+static const uint8_t* nes_movie_pack(const uint8_t* data, uint32_t size, uint8_t* scratch, uint32_t* stored){
+    const size_t compressed = size ? nes_lz_compress(data, size, scratch, size - 1) : 0;
+    *stored = compressed ? (uint32_t)compressed : size;
+    return compressed ? scratch : data;
+}
+
+static int nes_movie_unpack(FILE* file, uint8_t* data, uint32_t size, uint32_t stored, uint8_t* scratch){
+    if (stored == size){
+        return nes_fread(data, 1, size, file) == size ? NES_OK : NES_ERROR;
+    }
+    if (nes_fread(scratch, 1, stored, file) != stored){
+        return NES_ERROR;
+    }
+    return nes_lz_decompress(scratch, stored, data, size);
+}
+
+int nes_movie_save_file(nes_t* nes, const char* file_path){
+    const nes_movie_t* movie = nes->nes_movie;
+    if (movie == NULL){
+        return NES_ERROR;
+    }
+    const uint32_t frames_size = movie->frame_count * (uint32_t)sizeof(nes_movie_frame_t);
+    const uint32_t inputs_size = movie->input_count * (uint32_t)sizeof(nes_movie_input_t);
+    uint8_t* scratch = (uint8_t*)nes_malloc((int)(NES_LZ_BOUND(movie->state_size) + NES_LZ_BOUND(frames_size) + NES_LZ_BOUND(inputs_size)));
+    if (scratch == NULL){
+        return NES_ERROR;
+    }
+    nes_movie_file_header_t header = {
+        .magic = NES_MOVIE_MAGIC,
+        .version = NES_MOVIE_VERSION,
+        .flags = movie->flags,
+        .rom_hash = movie->rom_hash,
+        .frame_count = movie->frame_count,
+        .state_size = movie->state_size,
+        .input_count = movie->input_count,
+        .checksum = nes_movie_checksum(movie),
+    };
+    const uint8_t* state = nes_movie_pack(movie->state, movie->state_size, scratch, &header.state_stored);
+    const uint8_t* frames = nes_movie_pack((const uint8_t*)movie->frames, frames_size,
+                                           scratch + NES_LZ_BOUND(movie->state_size), &header.frames_stored);
+    const uint8_t* inputs = nes_movie_pack((const uint8_t*)movie->inputs, inputs_size,
+                                           scratch + NES_LZ_BOUND(movie->state_size) + NES_LZ_BOUND(frames_size), &header.inputs_stored);
+    FILE* file = nes_fopen(file_path, "wb");
+    if (file == NULL){
+        NES_LOG_ERROR("nes_movie_save_file: failed to open file %s\n", file_path);
+        nes_free(scratch);
+        return NES_ERROR;
+    }
+    int ret = NES_OK;
+    if (nes_fwrite(&header, sizeof(header), 1, file) != 1
+        || nes_fwrite(state, 1, header.state_stored, file) != header.state_stored
+        || nes_fwrite(frames, 1, header.frames_stored, file) != header.frames_stored
+        || nes_fwrite(inputs, 1, header.inputs_stored, file) != header.inputs_stored){
+        ret = NES_ERROR;
+    }
+    if (nes_fclose(file)){
+        ret = NES_ERROR;
+    }
+    nes_free(scratch);
+    return ret;
+}
+
+int nes_movie_load_file(nes_t* nes, const char* file_path){
+    const size_t state_size = nes_state_size(nes);
+    if (state_size == 0){
+        return NES_ERROR;
+    }
+    FILE* file = nes_fopen(file_path, "rb");
+    if (file == NULL){
+        NES_LOG_ERROR("nes_movie_load_file: failed to open file %s\n", file_path);
+        return NES_ERROR;
+    }
+    nes_movie_file_header_t header;
+    if (nes_fread(&header, sizeof(header), 1, file) != 1
+        || header.magic != NES_MOVIE_MAGIC || header.version != NES_MOVIE_VERSION){
+        NES_LOG_ERROR("nes_movie_load_file: %s is not a movie of this version\n", file_path);
+        nes_fclose(file);
+        return NES_ERROR;
+    }
+    if (header.rom_hash != nes_rom_hash(nes)){
+        NES_LOG_ERROR("nes_movie_load_file: %s was recorded with another ROM\n", file_path);
+        nes_fclose(file);
+        return NES_ERROR;
+    }
+    if (header.state_size != state_size || header.state_stored > header.state_size
+        || header.frame_count > UINT32_MAX / sizeof(nes_movie_frame_t)
+        || header.frames_stored > header.frame_count * (uint64_t)sizeof(nes_movie_frame_t)
+        || header.input_count > UINT32_MAX / sizeof(nes_movie_input_t)
+        || header.inputs_stored > header.input_count * (uint64_t)sizeof(nes_movie_input_t)){
+        NES_LOG_ERROR("nes_movie_load_file: %s does not match this build\n", file_path);
+        nes_fclose(file);
+        return NES_ERROR;
+    }
+    const uint32_t frames_size = header.frame_count * (uint32_t)sizeof(nes_movie_frame_t);
+    const uint32_t inputs_size = header.input_count * (uint32_t)sizeof(nes_movie_input_t);
+    uint32_t scratch_size = header.state_stored > header.frames_stored ? header.state_stored : header.frames_stored;
+    if (header.inputs_stored > scratch_size){
+        scratch_size = header.inputs_stored;
+    }
+    nes_movie_t* movie = nes_movie_alloc(nes, header.state_size);
+    uint8_t* scratch = (uint8_t*)nes_malloc((int)scratch_size + 1);
+    int ret = (movie && scratch && nes_movie_reserve(movie, header.frame_count) == NES_OK
+               && nes_movie_reserve_inputs(movie, header.input_count) == NES_OK) ? NES_OK : NES_ERROR;
+    if (ret == NES_OK){
+        movie->flags = (uint8_t)header.flags;
+        movie->rom_hash = header.rom_hash;
+        movie->frame_count = header.frame_count;
+        movie->input_count = header.input_count;
+        if (nes_movie_unpack(file, movie->state, header.state_size, header.state_stored, scratch)
+            || nes_movie_unpack(file, (uint8_t*)movie->frames, frames_size, header.frames_stored, scratch)
+            || nes_movie_unpack(file, (uint8_t*)movie->inputs, inputs_size, header.inputs_stored, scratch)
+            || nes_movie_checksum(movie) != header.checksum){
+            NES_LOG_ERROR("nes_movie_load_file: %s is truncated or corrupted\n", file_path);
+            ret = NES_ERROR;
+        }
+    }
+    if (scratch){
+        nes_free(scratch);
+    }
+    nes_fclose(file);
+    if (ret){
+        nes_movie_deinit(nes);
+    }
+    return ret;
+}
+
+#endif
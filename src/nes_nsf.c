@@ -0,0 +1,402 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes.h"
+
+#if (NES_ENABLE_SOUND == 1)
+
+/*
+https://www.nesdev.org/wiki/NSF
+https://www.nesdev.org/wiki/NSFe
+
+There is no PPU in NSF mode: INIT and PLAY are called like subroutines and the
+CPU spins in a small driver loop at $5003 when they return. PLAY is called every
+play_speed microseconds of CPU time, not at VBlank.
+*/
+
+#define NES_NSF_DRIVER_IDLE     (0x5003)    /* JMP $5003, INIT/PLAY return here */
+#define NES_NSF_INIT_TIMEOUT    (NES_CPU_CLOCK_FREQ)
+#define NES_NSF_SLICE           (NES_PPU_CPU_CLOCKS * 16)
+
+static void nes_nsf_mapper_deinit(nes_t* nes);
+
+// The NSF being played, NULL when the instance runs a cartridge or nothing
+static inline nes_nsf_t* nes_nsf_get(nes_t* nes){
+    return nes->nes_mapper.mapper_deinit == nes_nsf_mapper_deinit ? (nes_nsf_t*)nes->nes_mapper.mapper_register : NULL;
+}
+
+static inline uint16_t nes_nsf_read16(const uint8_t* data){
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+static inline uint32_t nes_nsf_read32(const uint8_t* data){
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+// Copy 4K bank `bank` of the program data to CPU $8000 + slot * 4K
+static void nes_nsf_load_bank(nes_nsf_t* nsf, uint8_t slot, uint8_t bank){
+    uint8_t* dst = nsf->prg_window + slot * NES_NSF_BANK_SIZE;
+    // The data is padded in front to the 4K boundary of load_address
+    const int32_t offset = (int32_t)bank * NES_NSF_BANK_SIZE - (nsf->load_address & 0x0FFF);
+    for (int32_t i = 0; i < NES_NSF_BANK_SIZE; i++){
+        const int32_t src = offset + i;
+        dst[i] = (src >= 0 && src < (int32_t)nsf->data_size) ? nsf->data[src] : 0;
+    }
+}
+
+static void nes_nsf_load_banks(nes_t* nes){
+    nes_nsf_t* nsf = nes_nsf_get(nes);
+    if (nsf->bank_enable){
+        for (uint8_t i = 0; i < 8; i++){
+            nes_nsf_load_bank(nsf, i, nsf->bankswitch_init[i]);
+        }
+    }else{
+        nes_memset(nsf->prg_window, 0, sizeof(nsf->prg_window));
+        const uint32_t offset = nsf->load_address - 0x8000;
+        const uint32_t size = nsf->data_size < sizeof(nsf->prg_window) - offset ? nsf->data_size : (uint32_t)sizeof(nsf->prg_window) - offset;
+        nes_memcpy(nsf->prg_window + offset, nsf->data, size);
+    }
+}
+
+static void nes_nsf_mapper_init(nes_t* nes){
+    // CPU $8000-$FFFF: the 32K window, refilled by bank switching
+    nes_load_prgrom_8k(nes, 0, 0);
+    nes_load_prgrom_8k(nes, 1, 1);
+    nes_load_prgrom_8k(nes, 2, 2);
+    nes_load_prgrom_8k(nes, 3, 3);
+}
+
+static void nes_nsf_mapper_write(nes_t* nes, uint16_t write_addr, uint8_t data){
+    (void)nes;
+    (void)write_addr;
+    (void)data;
+}
+
+// $4018-$5FFF
+static void nes_nsf_mapper_apu(nes_t* nes, uint16_t write_addr, uint8_t data){
+    nes_nsf_t* nsf = nes_nsf_get(nes);
+    if (write_addr >= 0x5FF8 && nsf->bank_enable){
+        nes_nsf_load_bank(nsf, (uint8_t)(write_addr - 0x5FF8), data);
+    }
+}
+
+static uint8_t nes_nsf_mapper_read_apu(nes_t* nes, uint16_t read_addr){
+    (void)nes;
+    // Player driver: $5003 JMP $5003
+    switch (read_addr){
+        case NES_NSF_DRIVER_IDLE:       return 0x4C;
+        case NES_NSF_DRIVER_IDLE + 1:   return NES_NSF_DRIVER_IDLE & 0xFF;
+        case NES_NSF_DRIVER_IDLE + 2:   return NES_NSF_DRIVER_IDLE >> 8;
+        default:                        return read_addr >> 8;
+    }
+}
+
+static void nes_nsf_mapper_deinit(nes_t* nes){
+    nes_nsf_t* nsf = nes_nsf_get(nes);
+    if (nsf->file){
+        nes_free(nsf->file);
+    }
+    nes_free(nsf);
+    nes->nes_mapper.mapper_register = NULL;
+}
+
+// JSR to address from the driver loop, RTS lands back on NES_NSF_DRIVER_IDLE
+static inline void nes_nsf_call(nes_t* nes, uint16_t address){
+    const uint16_t ret = NES_NSF_DRIVER_IDLE - 1;
+    nes->nes_cpu.cpu_ram[0x100 + nes->nes_cpu.SP--] = (uint8_t)(ret >> 8);
+    nes->nes_cpu.cpu_ram[0x100 + nes->nes_cpu.SP--] = (uint8_t)(ret & 0xFF);
+    nes->nes_cpu.PC = address;
+}
+
+static inline void nes_nsf_run(nes_t* nes, uint32_t cycles){
+    while (cycles){
+        if (nes->nes_cpu.PC == NES_NSF_DRIVER_IDLE && nes->nes_cpu.I){
+            // Nothing but the APU can change until the next call: skip the idle loop
+            nes->nes_cpu.cycles_total += cycles;
+            nes_apu_sync(nes);
+            return;
+        }
+        const uint16_t ticks = cycles > NES_NSF_SLICE ? NES_NSF_SLICE : (uint16_t)cycles;
+        nes_opcode(nes, ticks);
+        nes_apu_hsync(nes);
+        cycles -= ticks;
+    }
+}
+
+static int nes_nsf_load_nsfe(nes_nsf_t* nsf, const uint8_t* data, size_t size){
+    size_t offset = 4;
+    uint8_t has_info = 0;
+    nsf->play_speed = NES_NSF_PLAY_SPEED;
+    while (offset + 8 <= size){
+        const uint32_t chunk_size = nes_nsf_read32(data + offset);
+        const uint8_t* id = data + offset + 4;
+        const uint8_t* chunk = data + offset + 8;
+        offset += 8;
+        if (chunk_size > size - offset){
+            NES_LOG_ERROR("NSFe chunk %.4s truncated\n", (const char*)id);
+            return NES_ERROR;
+        }
+        offset += chunk_size;
+        if (nes_memcmp(id, "INFO", 4) == 0 && chunk_size >= 8){
+            nsf->load_address = nes_nsf_read16(chunk);
+            nsf->init_address = nes_nsf_read16(chunk + 2);
+            nsf->play_address = nes_nsf_read16(chunk + 4);
+            if (chunk[7]){
+                NES_LOG_WARN("NSF expansion audio %02X is not supported\n", chunk[7]);
+            }
+            nsf->total_songs = chunk_size > 8 ? chunk[8] : 1;
+            nsf->starting_song = chunk_size > 9 ? chunk[9] : 0;
+            has_info = 1;
+        }else if (nes_memcmp(id, "DATA", 4) == 0){
+            nsf->data = chunk;
+            nsf->data_size = chunk_size;
+        }else if (nes_memcmp(id, "BANK", 4) == 0){
+            for (uint32_t i = 0; i < 8 && i < chunk_size; i++){
+                nsf->bankswitch_init[i] = chunk[i];
+                nsf->bank_enable = 1;
+            }
+        }else if (nes_memcmp(id, "RATE", 4) == 0 && chunk_size >= 2){
+            nsf->play_speed = nes_nsf_read16(chunk);
+        }else if (nes_memcmp(id, "auth", 4) == 0){
+            // game, artist, copyright, ripper: null terminated strings
+            char* fields[3] = {nsf->song_name, nsf->artist, nsf->copyright};
+            uint32_t pos = 0;
+            for (uint8_t f = 0; f < 3 && pos < chunk_size; f++){
+                uint32_t len = 0;
+                while (pos < chunk_size && chunk[pos]){
+                    if (len < NES_NSF_TEXT_SIZE){
+                        fields[f][len++] = (char)chunk[pos];
+                    }
+                    pos++;
+                }
+                fields[f][len] = '\0';
+                pos++;
+            }
+        }else if (nes_memcmp(id, "time", 4) == 0){
+            nsf->track_times = chunk;
+            nsf->track_times_count = (uint8_t)(chunk_size / 4 > 255 ? 255 : chunk_size / 4);
+        }else if (nes_memcmp(id, "NEND", 4) == 0){
+            break;
+        }else if (id[0] >= 'A' && id[0] <= 'Z'){
+            // Uppercase first letter: the chunk is required to play correctly
+            NES_LOG_ERROR("NSFe chunk %.4s is not supported\n", (const char*)id);
+            return NES_ERROR;
+        }
+    }
+    if (has_info == 0 || nsf->data == NULL){
+        NES_LOG_ERROR("NSFe without INFO or DATA chunk\n");
+        return NES_ERROR;
+    }
+    return NES_OK;
+}
+
+// Header fields are read byte by byte, little endian, whatever the host byte order and struct layout
+static int nes_nsf_load_nsf(nes_nsf_t* nsf, const uint8_t* data, size_t size){
+    if (size <= NES_NSF_HEADER_SIZE){
+        return NES_ERROR;
+    }
+    nsf->total_songs = data[0x06];
+    nsf->starting_song = data[0x07] ? data[0x07] - 1 : 0;
+    nsf->load_address = nes_nsf_read16(data + 0x08);
+    nsf->init_address = nes_nsf_read16(data + 0x0A);
+    nsf->play_address = nes_nsf_read16(data + 0x0C);
+    const uint16_t play_speed_ntsc = nes_nsf_read16(data + 0x6E);
+    nsf->play_speed = play_speed_ntsc ? play_speed_ntsc : NES_NSF_PLAY_SPEED;
+    // $7A PAL/NTSC bits, D0: PAL D1: dual PAL/NTSC
+    if ((data[0x7A] & 0x03) == 0x01){
+        NES_LOG_WARN("PAL only NSF, playing at NTSC CPU clock\n");
+    }
+    if (data[0x7B]){
+        NES_LOG_WARN("NSF expansion audio %02X is not supported\n", data[0x7B]);
+    }
+    for (uint8_t i = 0; i < 8; i++){
+        nsf->bankswitch_init[i] = data[0x70 + i];
+        nsf->bank_enable |= data[0x70 + i];
+    }
+    nsf->bank_enable = nsf->bank_enable ? 1 : 0;
+    nes_memcpy(nsf->song_name, data + 0x0E, NES_NSF_TEXT_SIZE);
+    nes_memcpy(nsf->artist, data + 0x2E, NES_NSF_TEXT_SIZE);
+    nes_memcpy(nsf->copyright, data + 0x4E, NES_NSF_TEXT_SIZE);
+    nsf->data = data + NES_NSF_HEADER_SIZE;
+    nsf->data_size = (uint32_t)(size - NES_NSF_HEADER_SIZE);
+    return NES_OK;
+}
+
+int nes_nsf_load(nes_t* nes, const uint8_t* data, size_t size){
+    // A cartridge is released by its own loader (nes_unload_file/nes_unload_rom), an NSF is replaced below
+    if (nes_nsf_get(nes) == NULL && nes->nes_rom.prg_rom){
+        NES_LOG_ERROR("nes_nsf_load: a ROM is loaded, unload it first\n");
+        return NES_ERROR;
+    }
+    nes_nsf_t* nsf = (nes_nsf_t*)nes_malloc(sizeof(nes_nsf_t));
+    if (nsf == NULL){
+        return NES_ERROR;
+    }
+    nes_memset(nsf, 0, sizeof(nes_nsf_t));
+    int ret = NES_ERROR;
+    if (size >= 5 && nes_memcmp(data, "NESM\x1a", 5) == 0){
+        ret = nes_nsf_load_nsf(nsf, data, size);
+    }else if (size >= 4 && nes_memcmp(data, "NSFE", 4) == 0){
+        ret = nes_nsf_load_nsfe(nsf, data, size);
+    }
+    if (ret || nsf->total_songs == 0 || nsf->load_address < 0x8000){
+        NES_LOG_ERROR("invalid NSF\n");
+        nes_free(nsf);
+        return NES_ERROR;
+    }
+    if (nsf->starting_song >= nsf->total_songs){
+        nsf->starting_song = 0;
+    }
+    nes_nsf_unload(nes);
+#if (NES_USE_SRAM == 1)
+    nes->nes_rom.sram = (uint8_t*)nes_malloc(SRAM_SIZE);
+    if (nes->nes_rom.sram == NULL){
+        nes_free(nsf);
+        return NES_ERROR;
+    }
+#else
+    NES_LOG_WARN("NES_USE_SRAM is 0, NSF RAM at $6000-$7FFF is not available\n");
+#endif
+    nes_memset(&nes->nes_mapper, 0, sizeof(nes_mapper_t));
+    nes->nes_mapper.mapper_register = nsf;
+    nes->nes_mapper.mapper_init = nes_nsf_mapper_init;
+    nes->nes_mapper.mapper_deinit = nes_nsf_mapper_deinit;
+    nes->nes_mapper.mapper_write = nes_nsf_mapper_write;
+    nes->nes_mapper.mapper_apu = nes_nsf_mapper_apu;
+    nes->nes_mapper.mapper_read_apu = nes_nsf_mapper_read_apu;
+    nes->nes_rom.prg_rom = nsf->prg_window;
+    nes->nes_rom.prg_rom_size = sizeof(nsf->prg_window) / PRG_ROM_UNIT_SIZE;
+    nes->nes_rom.mapper_number = 0;
+    nes_cpu_init(nes);
+    nes_apu_init(nes);
+    nes->nes_mapper.mapper_init(nes);
+    NES_LOG_INFO("NSF: %s - %s, %d songs\n", nsf->song_name, nsf->artist, nsf->total_songs);
+    return nes_nsf_init(nes, nsf->starting_song);
+}
+
+int nes_nsf_unload(nes_t* nes){
+    if (nes_nsf_get(nes) == NULL){
+        return NES_OK;
+    }
+    nes_unload_mapper(nes);
+    nes->nes_rom.prg_rom = NULL;
+    if (nes->nes_rom.sram){
+        nes_free(nes->nes_rom.sram);
+        nes->nes_rom.sram = NULL;
+    }
+    return NES_OK;
+}
+
+#if (NES_USE_FS == 1)
+int nes_nsf_load_file(nes_t* nes, const char* file_path){
+    void* nsf_file = nes_fopen(file_path, "rb");
+    if (nsf_file == NULL){
+        NES_LOG_ERROR("nes_nsf_load_file: failed to open file %s\n", file_path);
+        return NES_ERROR;
+    }
+    // No size query in the port layer: read in growing blocks
+    size_t capacity = 0x10000;
+    size_t size = 0;
+    uint8_t* buffer = (uint8_t*)nes_malloc((int)capacity);
+    while (buffer){
+        size += nes_fread(buffer + size, 1, capacity - size, nsf_file);
+        if (size < capacity){
+            break;
+        }
+        uint8_t* grow = (uint8_t*)nes_malloc((int)(capacity * 2));
+        if (grow){
+            nes_memcpy(grow, buffer, size);
+        }
+        nes_free(buffer);
+        buffer = grow;
+        capacity *= 2;
+    }
+    nes_fclose(nsf_file);
+    if (buffer == NULL){
+        return NES_ERROR;
+    }
+    if (nes_nsf_load(nes, buffer, size)){
+        nes_free(buffer);
+        return NES_ERROR;
+    }
+    nes_nsf_get(nes)->file = buffer;
+    return NES_OK;
+}
+#endif
+
+// https://www.nesdev.org/wiki/NSF#Initializing_a_tune
+int nes_nsf_init(nes_t* nes, uint8_t song){
+    nes_nsf_t* nsf = nes_nsf_get(nes);
+    if (nsf == NULL || song >= nsf->total_songs){
+        return NES_ERROR;
+    }
+    nsf->current_song = song;
+    nsf->play_phase = 0;
+    nes_memset(nes->nes_cpu.cpu_ram, 0, NES_CPU_RAM_SIZE);
+#if (NES_USE_SRAM == 1)
+    nes_memset(nes->nes_rom.sram, 0, SRAM_SIZE);
+#endif
+    nes_nsf_load_banks(nes);
+    nes_apu_init(nes);
+    for (uint16_t address = 0x4000; address < 0x4014; address++){
+        nes_write_apu_register(nes, address, 0x00);
+    }
+    nes_write_apu_register(nes, 0x4015, 0x00);
+    nes_write_apu_register(nes, 0x4015, 0x0F);
+    nes_write_apu_register(nes, 0x4017, 0x40);
+    nes->nes_cpu.A = song;
+    nes->nes_cpu.X = 0;                 // NTSC
+    nes->nes_cpu.Y = 0;
+    nes->nes_cpu.SP = 0xFD;
+    nes->nes_cpu.P = 0;
+    nes->nes_cpu.I = 1;
+    nes->nes_cpu.U = 1;
+    nes->nes_cpu.PC = NES_NSF_DRIVER_IDLE;
+    nes_nsf_call(nes, nsf->init_address);
+    uint32_t cycles = 0;
+    while (nes->nes_cpu.PC != NES_NSF_DRIVER_IDLE){
+        if (cycles >= NES_NSF_INIT_TIMEOUT){
+            NES_LOG_WARN("NSF INIT did not return, song %d\n", song);
+            break;
+        }
+        nes_nsf_run(nes, NES_NSF_SLICE);
+        cycles += NES_NSF_SLICE;
+    }
+    return NES_OK;
+}
+
+// One PLAY period. A PLAY that has not returned yet is left running, as on hardware players.
+void nes_nsf_frame(nes_t* nes){
+    nes_nsf_t* nsf = nes_nsf_get(nes);
+    const uint64_t period = (uint64_t)nsf->play_speed * NES_CPU_CLOCK_FREQ + nsf->play_phase;
+    if (nes->nes_cpu.PC == NES_NSF_DRIVER_IDLE){
+        nes_nsf_call(nes, nsf->play_address);
+    }
+    nes_nsf_run(nes, (uint32_t)(period / 1000000));
+    nsf->play_phase = (uint32_t)(period % 1000000);
+    nes_apu_sync(nes);
+}
+
+// NSFe track length in milliseconds, -1 if unknown
+int32_t nes_nsf_track_time(nes_t* nes, uint8_t song){
+    nes_nsf_t* nsf = nes_nsf_get(nes);
+    if (nsf == NULL || nsf->track_times == NULL || song >= nsf->track_times_count){
+        return -1;
+    }
+    return (int32_t)nes_nsf_read32(nsf->track_times + song * 4);
+}
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes.h"
+
+// BT.601 luma in 1/256 steps
+#define NES_OBS_LUMA_R          (77)
+#define NES_OBS_LUMA_G          (150)
+#define NES_OBS_LUMA_B          (29)
+#define NES_OBS_LUMA_SHIFT      (8)
+
+#define NES_OBS_RECIPROCAL_SHIFT (56)
+
+int nes_obs_init(nes_t* nes, uint16_t width, uint16_t height, uint8_t channels){
+    if (width == 0 || width > NES_WIDTH || height == 0 || height > NES_HEIGHT
+        || (channels != NES_OBS_GRAY && channels != NES_OBS_RGB)){
+        NES_LOG_ERROR("nes_obs_init: unsupported observation %ux%ux%u\n", width, height, channels);
+        return NES_ERROR;
+    }
+    nes_obs_deinit(nes);
+    nes_obs_t* obs = (nes_obs_t*)nes_malloc(sizeof(nes_obs_t));
+    if (obs == NULL){
+        return NES_ERROR;
+    }
+    const size_t sums_size = 2 * NES_WIDTH * sizeof(uint32_t);
+    const size_t tables_size = ((size_t)width + NES_HEIGHT) * sizeof(uint16_t);
+    const size_t data_size = (size_t)width * height * channels;
+    // sums | column_pixels | row | data
+    obs->sums = (uint32_t*)nes_malloc((int)(sums_size + tables_size + data_size));
+    if (obs->sums == NULL){
+        nes_free(obs);
+        return NES_ERROR;
+    }
+    nes_memset(obs->sums, 0, sums_size + tables_size + data_size);
+    obs->width = width;
+    obs->height = height;
+    obs->channels = channels;
+    obs->lines = 0;
+    obs->column_pixels = (uint16_t*)((uint8_t*)obs->sums + sums_size);
+    obs->row = obs->column_pixels + width;
+    obs->data = (uint8_t*)(obs->row + NES_HEIGHT);
+    for (uint16_t x = 0; x < NES_WIDTH; x++){
+        obs->column_pixels[x * width / NES_WIDTH]++;
+    }
+    for (uint16_t y = 0; y < NES_HEIGHT; y++){
+        obs->row[y] = (uint16_t)(y * height / NES_HEIGHT);
+    }
+    // Columns are NES_WIDTH / width pixels wide or one more, rows NES_HEIGHT / height lines high or one more
+    obs->column_pixels_min = NES_WIDTH / width;
+    obs->lines_min = NES_HEIGHT / height;
+    for (uint8_t i = 0; i < 2; i++){
+        for (uint8_t j = 0; j < 2; j++){
+            uint64_t divisor = (uint64_t)(obs->lines_min + i) * (obs->column_pixels_min + j);
+            if (channels == NES_OBS_GRAY){
+                divisor <<= NES_OBS_LUMA_SHIFT;
+            }
+            obs->reciprocals[i][j] = ((1ULL << NES_OBS_RECIPROCAL_SHIFT) + divisor - 1) / divisor;
+        }
+    }
+    nes->nes_obs = obs;
+    return NES_OK;
+}
+
+void nes_obs_deinit(nes_t* nes){
+    nes_obs_t* obs = nes->nes_obs;
+    if (obs == NULL){
+        return;
+    }
+    nes_free(obs->sums);
+    nes_free(obs);
+    nes->nes_obs = NULL;
+}
+
+/*
+    Lines are added up per source pixel first, R and B side by side in one word (16 bits each, 240
+    lines of 255 fit) and G in a second one: a fixed 256-pixel loop the compiler vectorizes. The
+    output columns are reduced once per output row.
+*/
+static inline void nes_obs_add_line(uint32_t* restrict rb, uint32_t* restrict g, const nes_color_t* restrict line){
+    for (uint16_t x = 0; x < NES_WIDTH; x++){
+#if (NES_COLOR_DEPTH == 32)     // ARGB8888
+        rb[x] += line[x] & 0x00FF00FF;
+        g[x] += (line[x] >> 8) & 0xFF;
+#else                           // RGB565, widened to 8 bits
+        uint32_t color = line[x];
+#if (NES_COLOR_SWAP == 1)
+        color = ((color >> 8) | (color << 8)) & 0xFFFF;
+#endif
+        const uint32_t r5 = (color >> 11) & 0x1F, g6 = (color >> 5) & 0x3F, b5 = color & 0x1F;
+        rb[x] += (((r5 << 3) | (r5 >> 2)) << 16) | (b5 << 3) | (b5 >> 2);
+        g[x] += (g6 << 2) | (g6 >> 4);
+#endif
+    }
+}
+
+// Rounded sum / divisor as a multiply: exact for divisors below 2^24 and averages up to 255
+static inline uint8_t nes_obs_average(uint32_t sum, uint32_t divisor, uint64_t reciprocal){
+    return (uint8_t)(((uint64_t)(sum + divisor / 2) * reciprocal) >> NES_OBS_RECIPROCAL_SHIFT);
+}
+
+// Averages the accumulated lines into output row `out_row` and clears the sums
+static void nes_obs_flush(nes_obs_t* obs, uint16_t out_row){
+    uint8_t* out = obs->data + (size_t)out_row * obs->width * obs->channels;
+    const uint32_t* rb = obs->sums;
+    const uint32_t* gs = obs->sums + NES_WIDTH;
+    const uint64_t* reciprocals = obs->reciprocals[obs->lines - obs->lines_min];
+    uint16_t x = 0;
+    for (uint16_t column = 0; column < obs->width; column++){
+        uint32_t r = 0, g = 0, b = 0;
+        for (const uint16_t end = x + obs->column_pixels[column]; x < end; x++){
+            r += rb[x] >> 16;
+            g += gs[x];
+            b += rb[x] & 0xFFFF;
+        }
+        const uint32_t divisor = (uint32_t)obs->column_pixels[column] * obs->lines;
+        const uint64_t reciprocal = reciprocals[obs->column_pixels[column] - obs->column_pixels_min];
+        if (obs->channels == NES_OBS_GRAY){
+            const uint32_t luma = NES_OBS_LUMA_R * r + NES_OBS_LUMA_G * g + NES_OBS_LUMA_B * b;
+            *out++ = nes_obs_average(luma, divisor << NES_OBS_LUMA_SHIFT, reciprocal);
+        }else{
+            *out++ = nes_obs_average(r, divisor, reciprocal);
+            *out++ = nes_obs_average(g, divisor, reciprocal);
+            *out++ = nes_obs_average(b, divisor, reciprocal);
+        }
+    }
+    nes_memset(obs->sums, 0, 2 * NES_WIDTH * sizeof(uint32_t));
+    obs->lines = 0;
+}
+
+void nes_obs_line(nes_t* nes, const nes_color_t* line){
+    nes_obs_t* obs = nes->nes_obs;
+    const uint16_t y = nes->scanline;
+    if (y == 0 || obs->row[y - 1] != obs->row[y]){
+        // First line of an output row, sums left by an interrupted row are dropped
+        if (obs->lines){
+            nes_memset(obs->sums, 0, 2 * NES_WIDTH * sizeof(uint32_t));
+            obs->lines = 0;
+        }
+    }else if (obs->lines == 0 || obs->line_next != y || obs->frame != nes->nes_frame_count){
+        // Attached, or shown again (NES_HIDDEN_VIDEO), in the middle of an output row: skip the rest
+        // of it, a row is only flushed when all of its lines were added in this frame
+        if (obs->lines){
+            nes_memset(obs->sums, 0, 2 * NES_WIDTH * sizeof(uint32_t));
+            obs->lines = 0;
+        }
+        return;
+    }
+    nes_obs_add_line(obs->sums, obs->sums + NES_WIDTH, line);
+    obs->lines++;
+    obs->line_next = y + 1;
+    obs->frame = nes->nes_frame_count;
+    if (y == NES_HEIGHT - 1 || obs->row[y + 1] != obs->row[y]){
+        nes_obs_flush(obs, obs->row[y]);
+    }
+}
@@ -32,7 +32,11 @@ static inline uint8_t nes_read_ppu_memory(nes_t* nes){
 
 static inline void nes_write_ppu_memory(nes_t* nes,uint8_t data){
     const uint16_t address = nes->nes_ppu.v_reg & (uint16_t)0x3FFF;
-    if (address < (uint16_t)0x3F00) {// BANK
+    if (address < (uint16_t)0x2000) {// CHR: ROM can not be written, it may be shared by other instances
+        if (nes->nes_rom.chr_rom_size == 0){
+            nes->nes_ppu.chr_banks[(uint8_t)(address >> 10)][(uint16_t)(address & (uint16_t)0x3FF)] = data;
+        }
+    } else if (address < (uint16_t)0x3F00) {// BANK
         nes->nes_ppu.chr_banks[(uint8_t)(address >> 10)][(uint16_t)(address & (uint16_t)0x3FF)] = data;
     } else {// 调色板
         if ((uint8_t)address & 0x03) {
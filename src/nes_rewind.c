@@ -0,0 +1,228 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes.h"
+
+#define NES_REWIND_BLOCK        (64)        /* Delta granularity, only blocks that changed are stored */
+
+/*
+    Entries are written in order into the byte ring. An entry never wraps: when it does not fit before
+    the end, writing restarts at offset 0 and everything still stored past the write offset (the oldest
+    lap) is dropped. Then the oldest entries are dropped while they overlap the new one.
+*/
+
+int nes_rewind_init(nes_t* nes, size_t size, uint16_t interval){
+    const size_t state_size = nes_state_size(nes);
+    if (state_size == 0 || size < 1024){
+        NES_LOG_ERROR("nes_rewind_init: state can not be captured\n");
+        return NES_ERROR;
+    }
+    nes_rewind_deinit(nes);
+    nes_rewind_t* rewind = (nes_rewind_t*)nes_malloc(sizeof(nes_rewind_t));
+    if (rewind == NULL){
+        return NES_ERROR;
+    }
+    nes_memset(rewind, 0, sizeof(nes_rewind_t));
+    rewind->data_size = (uint32_t)size;
+    rewind->entry_max = (uint32_t)(size / 32);
+    rewind->state_size = (uint32_t)state_size;
+    rewind->interval = interval ? interval : 1;
+    // Every block changed: a 2 byte index in front of each
+    const size_t delta_max = state_size + (state_size + NES_REWIND_BLOCK - 1) / NES_REWIND_BLOCK * 2;
+    rewind->data = (uint8_t*)nes_malloc((int)size);
+    rewind->entries = (nes_rewind_entry_t*)nes_malloc((int)(rewind->entry_max * sizeof(nes_rewind_entry_t)));
+    // state | next snapshot | delta | compressed delta
+    rewind->state = (uint8_t*)nes_malloc((int)(state_size * 2 + delta_max + NES_LZ_BOUND(delta_max)));
+    nes->nes_rewind = rewind;
+    if (rewind->data == NULL || rewind->entries == NULL || rewind->state == NULL){
+        nes_rewind_deinit(nes);
+        return NES_ERROR;
+    }
+    rewind->scratch = rewind->state + state_size;
+    rewind->delta = rewind->scratch + state_size;
+    rewind->delta_max = (uint32_t)delta_max;
+    return NES_OK;
+}
+
+void nes_rewind_deinit(nes_t* nes){
+    nes_rewind_t* rewind = nes->nes_rewind;
+    if (rewind == NULL){
+        return;
+    }
+    if (rewind->data){
+        nes_free(rewind->data);
+    }
+    if (rewind->entries){
+        nes_free(rewind->entries);
+    }
+    if (rewind->state){
+        nes_free(rewind->state);
+    }
+    nes_free(rewind);
+    nes->nes_rewind = NULL;
+}
+
+static inline nes_rewind_entry_t* nes_rewind_oldest(nes_rewind_t* rewind){
+    return &rewind->entries[rewind->entry_first];
+}
+
+static inline void nes_rewind_drop_oldest(nes_rewind_t* rewind){
+    rewind->entry_first = (rewind->entry_first + 1) % rewind->entry_max;
+    rewind->entry_count--;
+}
+
+static void nes_rewind_push(nes_rewind_t* rewind, const uint8_t* data, uint32_t size, uint32_t delta_size){
+    if (size > rewind->data_size){
+        rewind->entry_count = 0;
+        rewind->write_offset = 0;
+        return;
+    }
+    if (rewind->write_offset + size > rewind->data_size){
+        while (rewind->entry_count && nes_rewind_oldest(rewind)->offset >= rewind->write_offset){
+            nes_rewind_drop_oldest(rewind);
+        }
+        rewind->write_offset = 0;
+    }
+    while (rewind->entry_count){
+        const nes_rewind_entry_t* oldest = nes_rewind_oldest(rewind);
+        if (rewind->entry_count < rewind->entry_max
+            && (oldest->offset >= rewind->write_offset + size || oldest->offset + oldest->size <= rewind->write_offset)){
+            break;
+        }
+        nes_rewind_drop_oldest(rewind);
+    }
+    nes_rewind_entry_t* entry = &rewind->entries[(rewind->entry_first + rewind->entry_count) % rewind->entry_max];
+    entry->offset = rewind->write_offset;
+    entry->size = size;
+    entry->delta_size = delta_size;
+    nes_memcpy(rewind->data + entry->offset, data, size);
+    rewind->write_offset += size;
+    rewind->entry_count++;
+}
+
+static inline uint32_t nes_rewind_block_size(const nes_rewind_t* rewind, uint32_t offset){
+    return rewind->state_size - offset < NES_REWIND_BLOCK ? rewind->state_size - offset : NES_REWIND_BLOCK;
+}
+
+static inline void nes_rewind_xor(uint8_t* dst, const uint8_t* a, const uint8_t* b, uint32_t size){
+    uint32_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)){
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(x));       // Unaligned 8-byte access, inlined
+        memcpy(&y, b + i, sizeof(y));
+        x ^= y;
+        memcpy(dst + i, &x, sizeof(x));
+    }
+    for (; i < size; i++){
+        dst[i] = a[i] ^ b[i];
+    }
+}
+
+/*
+    Delta: index (LE16) | XOR of old and new content, for each NES_REWIND_BLOCK block that changed.
+    Most of a snapshot does not change between frames, so one compare pass skips it and only the
+    few changed blocks are XORed, copied into `state` and compressed.
+*/
+int nes_rewind_capture(nes_t* nes){
+    nes_rewind_t* rewind = nes->nes_rewind;
+    if (rewind == NULL){
+        return NES_ERROR;
+    }
+    uint8_t* next = rewind->scratch;
+    if (nes_state_save(nes, next, rewind->state_size)){
+        return NES_ERROR;
+    }
+    rewind->frame = 0;
+    rewind->state_loaded = 0;
+    if (rewind->has_state == 0){
+        nes_memcpy(rewind->state, next, rewind->state_size);
+        rewind->has_state = 1;
+        return NES_OK;
+    }
+    uint8_t* delta = rewind->delta;
+    uint32_t delta_size = 0;
+    for (uint32_t offset = 0; offset < rewind->state_size; offset += NES_REWIND_BLOCK){
+        const uint32_t size = nes_rewind_block_size(rewind, offset);
+        if (nes_memcmp(next + offset, rewind->state + offset, size) == 0){
+            continue;
+        }
+        const uint16_t index = (uint16_t)(offset / NES_REWIND_BLOCK);
+        delta[delta_size++] = (uint8_t)(index & 0xFF);
+        delta[delta_size++] = (uint8_t)(index >> 8);
+        nes_rewind_xor(delta + delta_size, next + offset, rewind->state + offset, size);
+        nes_memcpy(rewind->state + offset, next + offset, size);
+        delta_size += size;
+    }
+    uint8_t* compressed = delta + rewind->delta_max;
+    const size_t size = delta_size ? nes_lz_compress(delta, delta_size, compressed, NES_LZ_BOUND(rewind->delta_max)) : 0;
+    nes_rewind_push(rewind, compressed, (uint32_t)size, delta_size);
+    return NES_OK;
+}
+
+void nes_rewind_frame(nes_t* nes){
+    nes_rewind_t* rewind = nes->nes_rewind;
+    if (rewind->paused == 0 && ++rewind->frame >= rewind->interval){
+        nes_rewind_capture(nes);
+    }
+}
+
+void nes_rewind_pause(nes_t* nes, uint8_t paused){
+    if (nes->nes_rewind && nes->nes_rewind->paused != paused){
+        nes->nes_rewind->paused = paused;
+        nes->nes_rewind->frame = 0;
+    }
+}
+
+int nes_rewind_step(nes_t* nes){
+    nes_rewind_t* rewind = nes->nes_rewind;
+    if (rewind == NULL || rewind->has_state == 0){
+        return NES_ERROR;
+    }
+    if (rewind->state_loaded){
+        if (rewind->entry_count == 0){
+            return NES_ERROR;
+        }
+        const nes_rewind_entry_t* newest = &rewind->entries[(rewind->entry_first + rewind->entry_count - 1) % rewind->entry_max];
+        uint8_t* delta = rewind->delta;
+        if (newest->delta_size > rewind->delta_max
+            || (newest->delta_size && nes_lz_decompress(rewind->data + newest->offset, newest->size, delta, newest->delta_size))){
+            return NES_ERROR;
+        }
+        for (uint32_t position = 0; position + 2 <= newest->delta_size;){
+            const uint32_t offset = (uint32_t)(delta[position] | (delta[position + 1] << 8)) * NES_REWIND_BLOCK;
+            position += 2;
+            if (offset >= rewind->state_size || position + nes_rewind_block_size(rewind, offset) > newest->delta_size){
+                return NES_ERROR;
+            }
+            const uint32_t size = nes_rewind_block_size(rewind, offset);
+            nes_rewind_xor(rewind->state + offset, rewind->state + offset, delta + position, size);
+            position += size;
+        }
+        rewind->write_offset = newest->offset;
+        rewind->entry_count--;
+    }
+    rewind->state_loaded = 1;
+    rewind->frame = 0;
+    return nes_state_load(nes, rewind->state, rewind->state_size);
+}
+
+uint32_t nes_rewind_count(nes_t* nes){
+    const nes_rewind_t* rewind = nes->nes_rewind;
+    if (rewind == NULL || rewind->has_state == 0){
+        return 0;
+    }
+    return rewind->entry_count + (rewind->state_loaded ? 0 : 1);
+}
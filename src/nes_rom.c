@@ -16,7 +16,271 @@
 
 #include "nes.h"
 
-#if (NES_USE_FS == 1)
+// Sizes, mapper and mirroring from an iNES or NES 2.0 header
+static void nes_rom_header(nes_rom_info_t* rom, const nes_header_ines_t* header){
+    if (header->identifier==2){ //NES 2.0
+        const nes_header_nes2_t* nes2_header_info = (const nes_header_nes2_t*)header;
+        rom->prg_rom_size = ((nes2_header_info->prg_rom_size_m << 8) & 0xF00) | nes2_header_info->prg_rom_size_l;
+        rom->chr_rom_size = ((nes2_header_info->chr_rom_size_m << 8) & 0xF00) | nes2_header_info->chr_rom_size_l;
+        rom->mapper_number = ((nes2_header_info->mapper_number_h << 8) & 0xF00) | ((nes2_header_info->mapper_number_m << 4) & 0xF0) | (nes2_header_info->mapper_number_l & 0x0F);
+    }else{  //INES
+        rom->prg_rom_size = header->prg_rom_size;
+        rom->chr_rom_size = header->chr_rom_size;
+        rom->mapper_number = header->mapper_number_l | header->mapper_number_h << 4;
+    }
+    rom->mirroring_type = header->mirroring;
+    rom->four_screen = header->four_screen;
+    rom->save_ram = header->save;
+}
+
+// Power on with the ROM in place
+static int nes_rom_start(nes_t* nes){
+    nes_cpu_init(nes);
+#if (NES_ENABLE_SOUND==1)
+    nes_apu_init(nes);
+#endif
+    nes_ppu_init(nes);
+    if(nes_load_mapper(nes)){
+        return NES_ERROR;
+    }
+    nes->nes_mapper.mapper_init(nes);
+    nes_reset(nes);
+    return NES_OK;
+}
+
+#if (NES_USE_FS == 1) && (NES_ROM_CACHE == 1)
+#include <stdatomic.h>
+
+/* One ROM file in memory, shared read-only by every instance that loaded the same content */
+struct nes_rom_image{
+    struct nes_rom_image* next;
+    uint64_t hash;                      /*  nes_hash64 of data */
+    nes_file_id_t id;                   /*  File it was loaded from, when id_valid */
+    uint8_t id_valid;
+    uint8_t* data;
+    size_t size;                        /*  Header, trainer, PRG and CHR ROM */
+    size_t map_size;                    /*  nes_file_map() size, 0 when data was read into nes_malloc() memory */
+    uint32_t refs;                      /*  Instances using it */
+};
+
+static nes_rom_image_t* nes_rom_images = NULL;
+static atomic_flag nes_rom_images_lock = ATOMIC_FLAG_INIT;
+
+// Held for a list walk only, no allocation, I/O or access to image data inside
+static void nes_rom_cache_lock(void){
+    while (atomic_flag_test_and_set_explicit(&nes_rom_images_lock, memory_order_acquire)){
+    }
+}
+
+static void nes_rom_cache_unlock(void){
+    atomic_flag_clear_explicit(&nes_rom_images_lock, memory_order_release);
+}
+
+static size_t nes_rom_file_size(const nes_header_ines_t* header){
+    nes_rom_info_t rom = {0};
+    nes_rom_header(&rom, header);
+    return sizeof(nes_header_ines_t) + (header->trainer ? TRAINER_SIZE : 0)
+           + (size_t)PRG_ROM_UNIT_SIZE * rom.prg_rom_size + (size_t)CHR_ROM_UNIT_SIZE * rom.chr_rom_size;
+}
+
+static void nes_rom_image_free_data(uint8_t* data, size_t map_size){
+    if (map_size){
+        nes_file_unmap(data, map_size);
+    }else if (data){
+        nes_free(data);
+    }
+}
+
+// The file mapped by the port, or read when it can not map
+static uint8_t* nes_rom_image_read(const char* file_path, size_t* size, size_t* map_size){
+    *map_size = 0;
+    uint8_t* data = (uint8_t*)nes_file_map(file_path, map_size);
+    if (data){
+        if (*map_size < sizeof(nes_header_ines_t) || nes_memcmp(data, "NES\x1a", 4)
+            || (*size = nes_rom_file_size((const nes_header_ines_t*)data)) > *map_size){
+            nes_file_unmap(data, *map_size);
+            return NULL;
+        }
+        return data;
+    }
+    *map_size = 0;
+    nes_header_ines_t header;
+    FILE* nes_file = nes_fopen(file_path, "rb");
+    if (nes_file == NULL){
+        return NULL;
+    }
+    if (nes_fread(&header, sizeof(header), 1, nes_file) == 0 || nes_memcmp(header.identification, "NES\x1a", 4)){
+        nes_fclose(nes_file);
+        return NULL;
+    }
+    *size = nes_rom_file_size(&header);
+    data = (uint8_t*)nes_malloc((int)*size);
+    if (data){
+        nes_memcpy(data, &header, sizeof(header));
+        if (*size > sizeof(header) && nes_fread(data + sizeof(header), *size - sizeof(header), 1, nes_file) == 0){
+            nes_free(data);
+            data = NULL;
+        }
+    }
+    nes_fclose(nes_file);
+    return data;
+}
+
+static void nes_rom_image_release(nes_rom_image_t* image){
+    nes_rom_cache_lock();
+    if (--image->refs){
+        nes_rom_cache_unlock();
+        return;
+    }
+    for (nes_rom_image_t** link = &nes_rom_images; *link; link = &(*link)->next){
+        if (*link == image){
+            *link = image->next;
+            break;
+        }
+    }
+    nes_rom_cache_unlock();
+    nes_rom_image_free_data(image->data, image->map_size);
+    nes_free(image);
+}
+
+/*
+    The shared image with the content of the file, a new one when no instance has it yet. A file
+    already loaded (same nes_file_id()) is found without reading it. Otherwise the file is mapped
+    and hashed, and images with the same hash are compared byte by byte outside the lock: the
+    candidate is pinned with a reference, so it stays valid while the lock is free.
+*/
+static nes_rom_image_t* nes_rom_image_open(const char* file_path){
+    nes_file_id_t id;
+    const uint8_t id_valid = nes_file_id(file_path, &id) == NES_OK;
+    if (id_valid){
+        nes_rom_cache_lock();
+        for (nes_rom_image_t* shared = nes_rom_images; shared; shared = shared->next){
+            if (shared->id_valid && nes_memcmp(&shared->id, &id, sizeof(id)) == 0){
+                shared->refs++;
+                nes_rom_cache_unlock();
+                return shared;
+            }
+        }
+        nes_rom_cache_unlock();
+    }
+    size_t size = 0, map_size = 0;
+    uint8_t* data = nes_rom_image_read(file_path, &size, &map_size);
+    if (data == NULL){
+        return NULL;
+    }
+    const uint64_t hash = nes_hash64(data, size, 0);
+    nes_rom_image_t* image = (nes_rom_image_t*)nes_malloc(sizeof(nes_rom_image_t));
+    if (image == NULL){
+        nes_rom_image_free_data(data, map_size);
+        return NULL;
+    }
+    nes_memset(image, 0, sizeof(nes_rom_image_t));
+    image->hash = hash;
+    image->data = data;
+    image->size = size;
+    image->map_size = map_size;
+    image->refs = 1;
+    if (id_valid){
+        image->id = id;
+        image->id_valid = 1;
+    }
+    nes_rom_image_t* candidate = NULL;  /*  Pinned image with the same hash, compared outside the lock */
+    nes_rom_cache_lock();
+    for (;;){
+        nes_rom_image_t* shared = candidate ? candidate->next : nes_rom_images;
+        while (shared && (shared->hash != hash || shared->size != size)){
+            shared = shared->next;
+        }
+        if (shared == NULL){
+            // Inserted under the same lock as the last lookup: no other loader added it in between
+            image->next = nes_rom_images;
+            nes_rom_images = image;
+            break;
+        }
+        shared->refs++;
+        nes_rom_cache_unlock();
+        if (candidate){
+            nes_rom_image_release(candidate);
+        }
+        candidate = shared;
+        if (nes_memcmp(candidate->data, data, size) == 0){
+            nes_rom_cache_lock();
+            if (id_valid && candidate->id_valid == 0){
+                candidate->id = id;
+                candidate->id_valid = 1;
+            }
+            nes_rom_cache_unlock();
+            nes_rom_image_free_data(data, map_size);
+            nes_free(image);
+            return candidate;
+        }
+        nes_rom_cache_lock();
+    }
+    nes_rom_cache_unlock();
+    if (candidate){
+        nes_rom_image_release(candidate);
+    }
+    return image;
+}
+
+uint32_t nes_rom_cache_images(void){
+    uint32_t count = 0;
+    nes_rom_cache_lock();
+    for (const nes_rom_image_t* image = nes_rom_images; image; image = image->next){
+        count++;
+    }
+    nes_rom_cache_unlock();
+    return count;
+}
+
+/*
+    PRG and CHR ROM point into the shared image and are never written (the PPU drops writes to
+    CHR ROM), CHR-RAM and SRAM are this instance's own.
+*/
+int nes_load_file(nes_t* nes, const char* file_path){
+    nes_rom_image_t* image = nes_rom_image_open(file_path);
+    if (image == NULL){
+        NES_LOG_ERROR("nes_load_file: failed to load file %s\n", file_path);
+        return NES_ERROR;
+    }
+    nes->nes_rom.image = image;
+    const nes_header_ines_t* header = (const nes_header_ines_t*)image->data;
+    nes_rom_header(&nes->nes_rom, header);
+    uint8_t* nes_bin = image->data + sizeof(nes_header_ines_t);
+#if (NES_USE_SRAM == 1)
+    nes->nes_rom.sram = (uint8_t*)nes_malloc(SRAM_SIZE);
+    if (nes->nes_rom.sram == NULL) {
+        goto error;
+    }
+    nes_memset(nes->nes_rom.sram, 0x00, SRAM_SIZE);
+    if (header->trainer){
+        nes_memcpy(nes->nes_rom.sram, nes_bin, TRAINER_SIZE);
+    }
+#endif
+    if (header->trainer){
+        nes_bin += TRAINER_SIZE;
+    }
+    nes->nes_rom.prg_rom = nes_bin;
+    nes_bin += PRG_ROM_UNIT_SIZE * nes->nes_rom.prg_rom_size;
+    if (nes->nes_rom.chr_rom_size){
+        nes->nes_rom.chr_rom = nes_bin;
+    }else{
+        nes->nes_rom.chr_rom = (uint8_t*)nes_malloc(CHR_ROM_UNIT_SIZE);
+        if (nes->nes_rom.chr_rom == NULL) {
+            goto error;
+        }
+        nes_memset(nes->nes_rom.chr_rom, 0x00, CHR_ROM_UNIT_SIZE);
+    }
+    if (nes_rom_start(nes)){
+        goto error;
+    }
+    return NES_OK;
+error:
+    nes_unload_file(nes);
+    return NES_ERROR;
+}
+
+#elif (NES_USE_FS == 1)
 int nes_load_file(nes_t* nes, const char* file_path ){
     nes_header_ines_t nes_header_info = {0};
 
@@ -45,21 +309,7 @@ int nes_load_file(nes_t* nes, const char* file_path ){
             nes_fseek(nes_file, TRAINER_SIZE, SEEK_CUR);
 #endif
         }
-        if (nes_header_info.identifier==2){ //NES 2.0
-            nes_header_nes2_t* nes2_header_info = (nes_header_nes2_t*)&nes_header_info;
-            nes->nes_rom.prg_rom_size = ((nes2_header_info->prg_rom_size_m << 8) & 0xF00) | nes2_header_info->prg_rom_size_l;
-            nes->nes_rom.chr_rom_size = ((nes2_header_info->chr_rom_size_m << 8) & 0xF00) | nes2_header_info->chr_rom_size_l;
-            nes->nes_rom.mapper_number = ((nes2_header_info->mapper_number_h << 8) & 0xF00) | ((nes2_header_info->mapper_number_m << 4) & 0xF0) | (nes2_header_info->mapper_number_l & 0x0F);
-
-        }else{  //INES
-            nes_header_ines_t* ines_header_info = (nes_header_ines_t*)&nes_header_info;
-            nes->nes_rom.prg_rom_size = ines_header_info->prg_rom_size;
-            nes->nes_rom.chr_rom_size = ines_header_info->chr_rom_size;
-            nes->nes_rom.mapper_number = ines_header_info->mapper_number_l | ines_header_info->mapper_number_h << 4;
-        }
-        nes->nes_rom.mirroring_type = nes_header_info.mirroring;
-        nes->nes_rom.four_screen = nes_header_info.four_screen;
-        nes->nes_rom.save_ram = nes_header_info.save;
+        nes_rom_header(&nes->nes_rom, &nes_header_info);
         nes->nes_rom.prg_rom = (uint8_t*)nes_malloc(PRG_ROM_UNIT_SIZE * nes->nes_rom.prg_rom_size);
         if (nes->nes_rom.prg_rom == NULL) {
             goto error;
@@ -80,15 +330,10 @@ int nes_load_file(nes_t* nes, const char* file_path ){
         goto error;
     }
     nes_fclose(nes_file);
-    nes_cpu_init(nes);
-#if (NES_ENABLE_SOUND==1)
-    nes_apu_init(nes);
-#endif
-    nes_ppu_init(nes);
-    if(nes_load_mapper(nes)){
+    nes_file = NULL;
+    if (nes_rom_start(nes)){
         goto error;
     }
-    nes->nes_mapper.mapper_init(nes);
     return NES_OK;
 error:
     if (nes_file){
@@ -101,16 +346,34 @@ error:
 
 }
 
+#endif
 
+#if (NES_USE_FS == 1)
 int nes_unload_file(nes_t* nes){
+    nes_unload_mapper(nes);
+#if (NES_ROM_CACHE == 1)
+    if (nes->nes_rom.image){
+        // PRG and CHR ROM belong to the shared image, CHR-RAM to this instance
+        if (nes->nes_rom.chr_rom_size == 0 && nes->nes_rom.chr_rom){
+            nes_free(nes->nes_rom.chr_rom);
+        }
+        nes->nes_rom.prg_rom = NULL;
+        nes->nes_rom.chr_rom = NULL;
+        nes_rom_image_release(nes->nes_rom.image);
+        nes->nes_rom.image = NULL;
+    }
+#endif
     if (nes->nes_rom.prg_rom){
         nes_free(nes->nes_rom.prg_rom);
+        nes->nes_rom.prg_rom = NULL;
     }
     if (nes->nes_rom.chr_rom){
         nes_free(nes->nes_rom.chr_rom);
+        nes->nes_rom.chr_rom = NULL;
     }
     if (nes->nes_rom.sram){
         nes_free(nes->nes_rom.sram);
+        nes->nes_rom.sram = NULL;
     }
     return NES_OK;
 }
@@ -133,22 +396,7 @@ int nes_load_rom(nes_t* nes, const uint8_t* nes_rom){
         nes_bin += TRAINER_SIZE;
     }
 
-    if (nes_header_info->identifier==2){ //NES 2.0
-        nes_header_nes2_t* nes2_header_info = (nes_header_nes2_t*)nes_header_info;
-        nes->nes_rom.prg_rom_size = ((nes2_header_info->prg_rom_size_m << 8) & 0xF00) | nes2_header_info->prg_rom_size_l;
-        nes->nes_rom.chr_rom_size = ((nes2_header_info->chr_rom_size_m << 8) & 0xF00) | nes2_header_info->chr_rom_size_l;
-        nes->nes_rom.mapper_number = ((nes2_header_info->mapper_number_h << 8) & 0xF00) | ((nes2_header_info->mapper_number_m << 4) & 0xF0) | (nes2_header_info->mapper_number_l & 0x0F);
-
-    }else{  //INES
-        nes_header_ines_t* ines_header_info = (nes_header_ines_t*)nes_header_info;
-        nes->nes_rom.prg_rom_size = ines_header_info->prg_rom_size;
-        nes->nes_rom.chr_rom_size = ines_header_info->chr_rom_size;
-        nes->nes_rom.mapper_number = ines_header_info->mapper_number_l | ines_header_info->mapper_number_h << 4;
-    }
-
-    nes->nes_rom.mirroring_type = (nes_header_info->mirroring);
-    nes->nes_rom.four_screen = (nes_header_info->four_screen);
-    nes->nes_rom.save_ram = (nes_header_info->save);
+    nes_rom_header(&nes->nes_rom, nes_header_info);
 
     nes->nes_rom.prg_rom = nes_bin;
     nes_bin += PRG_ROM_UNIT_SIZE * nes->nes_rom.prg_rom_size;
@@ -156,15 +404,9 @@ int nes_load_rom(nes_t* nes, const uint8_t* nes_rom){
     if (nes->nes_rom.chr_rom_size){
         nes->nes_rom.chr_rom = nes_bin;
     }
-    nes_cpu_init(nes);
-#if (NES_ENABLE_SOUND==1)
-    nes_apu_init(nes);
-#endif
-    nes_ppu_init(nes);
-    if(nes_load_mapper(nes)){
+    if (nes_rom_start(nes)){
         return NES_ERROR;
     }
-    nes->nes_mapper.mapper_init(nes);
     return NES_OK;
 error:
     if (nes){
@@ -174,6 +416,10 @@ error:
 }
 
 int nes_unload_rom(nes_t* nes){
-    (void)nes;
+    nes_unload_mapper(nes);
+    if (nes->nes_rom.sram){
+        nes_free(nes->nes_rom.sram);
+        nes->nes_rom.sram = NULL;
+    }
     return NES_OK;
 }
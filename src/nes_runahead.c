@@ -0,0 +1,79 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes.h"
+
+int nes_runahead_init(nes_t* nes, uint8_t frames){
+    nes_runahead_deinit(nes);
+    if (frames == 0){
+        return NES_OK;
+    }
+    const size_t state_size = nes_state_size(nes);
+    if (state_size == 0){
+        NES_LOG_ERROR("nes_runahead_init: state can not be captured\n");
+        return NES_ERROR;
+    }
+    nes_runahead_t* runahead = (nes_runahead_t*)nes_malloc(sizeof(nes_runahead_t));
+    if (runahead == NULL){
+        return NES_ERROR;
+    }
+    runahead->frames = frames;
+    runahead->state_size = (uint32_t)state_size;
+    runahead->state = (uint8_t*)nes_malloc((int)state_size);
+    nes->nes_runahead = runahead;
+    if (runahead->state == NULL){
+        nes_runahead_deinit(nes);
+        return NES_ERROR;
+    }
+    return NES_OK;
+}
+
+void nes_runahead_deinit(nes_t* nes){
+    nes_runahead_t* runahead = nes->nes_runahead;
+    if (runahead == NULL){
+        return;
+    }
+    if (runahead->state){
+        nes_free(runahead->state);
+    }
+    nes_free(runahead);
+    nes->nes_runahead = NULL;
+}
+
+int nes_runahead_frame(nes_t* nes){
+    const nes_runahead_t* runahead = nes->nes_runahead;
+    if (runahead == NULL){
+        return nes_step_frame(nes);
+    }
+    const uint8_t hidden = nes->nes_hidden;
+    // Real frame: its sound is played, its picture is already late
+    nes->nes_hidden = hidden | NES_HIDDEN_VIDEO;
+    int status = nes_step_frame(nes);
+    if (nes_state_save(nes, runahead->state, runahead->state_size)){
+        // ROM changed since nes_runahead_init(): show this frame as is
+        nes->nes_hidden = hidden;
+        return status;
+    }
+    nes->nes_hidden = hidden | NES_HIDDEN_VIDEO | NES_HIDDEN_AUDIO | NES_HIDDEN_SPECULATIVE;
+    for (uint8_t i = 1; i < runahead->frames; i++){
+        nes_step_frame(nes);
+    }
+    nes->nes_hidden = hidden | NES_HIDDEN_AUDIO | NES_HIDDEN_SPECULATIVE;
+    status |= nes_step_frame(nes) & NES_STEP_FRAME_READY;
+    nes->nes_hidden = hidden;
+    nes_state_load(nes, runahead->state, runahead->state_size);
+    return status;
+}
@@ -0,0 +1,517 @@
+/*
+ * Copyright PeakRacing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nes.h"
+
+/*
+    Snapshot layout, every section copied with one memcpy (and written as one chunk by nes_state_save_file()):
+    nes_state_header_t | nes_cpu_t | nes_ppu_t | nes_apu_t | mapper_register | SRAM | CHR-RAM
+    The raw pointers inside the structs are ignored on load and rebuilt from the offsets in the header.
+*/
+
+/* Bank pointer offset: region in the top 4 bits, byte offset below */
+#define NES_STATE_REGION_SHIFT  (28)
+#define NES_STATE_OFFSET_MASK   ((1UL << NES_STATE_REGION_SHIFT) - 1)
+
+enum {
+    NES_STATE_REGION_NULL,
+    NES_STATE_REGION_PRG,
+    NES_STATE_REGION_CHR,
+    NES_STATE_REGION_VRAM,
+};
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t size;                      /*  Whole snapshot */
+    uint16_t mapper_number;
+    uint16_t mapper_register_size;
+    uint16_t prg_rom_size;
+    uint16_t chr_rom_size;
+    uint16_t sram_size;
+    uint16_t scanline;
+    int32_t run_cycles_carry;
+    uint32_t frame_count;
+    uint32_t lag_count;
+    uint8_t lag;
+    uint8_t frame_skip_count;
+    uint32_t prg_banks[4];
+    uint32_t chr_banks[16];
+} nes_state_header_t;
+
+#define NES_STATE_ID(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define NES_STATE_SECTION_MAX   (7)
+
+typedef struct {
+    uint32_t id;
+    void* data;
+    uint32_t size;
+} nes_state_section_t;
+
+static inline uint32_t nes_state_chr_bytes(const nes_t* nes){
+    return (uint32_t)CHR_ROM_UNIT_SIZE * (nes->nes_rom.chr_rom_size ? nes->nes_rom.chr_rom_size : 1);
+}
+
+static inline uint32_t nes_state_chr_ram_size(const nes_t* nes){
+    return nes->nes_rom.chr_rom_size == 0 && nes->nes_rom.chr_rom ? CHR_ROM_UNIT_SIZE : 0;
+}
+
+static inline uint32_t nes_state_sram_size(const nes_t* nes){
+    return nes->nes_rom.sram ? SRAM_SIZE : 0;
+}
+
+// Mapper state that is not described by mapper_register_size (e.g. NSF) can not be copied
+static inline int nes_state_supported(const nes_t* nes){
+    return nes->nes_rom.prg_rom && (nes->nes_mapper.mapper_register == NULL || nes->nes_mapper.mapper_register_size);
+}
+
+static uint32_t nes_state_offset(const nes_t* nes, const uint8_t* p){
+    const uintptr_t address = (uintptr_t)p;
+    const uintptr_t prg = (uintptr_t)nes->nes_rom.prg_rom;
+    const uintptr_t chr = (uintptr_t)nes->nes_rom.chr_rom;
+    const uintptr_t vram = (uintptr_t)nes->nes_ppu.ppu_vram;
+    if (p == NULL){
+        return NES_STATE_REGION_NULL;
+    }else if (address >= vram && address - vram < NES_PPU_VRAM_SIZE){
+        return ((uint32_t)NES_STATE_REGION_VRAM << NES_STATE_REGION_SHIFT) | (uint32_t)(address - vram);
+    }else if (chr && address >= chr && address - chr < nes_state_chr_bytes(nes)){
+        return ((uint32_t)NES_STATE_REGION_CHR << NES_STATE_REGION_SHIFT) | (uint32_t)(address - chr);
+    }
+    return ((uint32_t)NES_STATE_REGION_PRG << NES_STATE_REGION_SHIFT) | (uint32_t)(address - prg);
+}
+
+static uint8_t* nes_state_pointer(nes_t* nes, uint32_t offset){
+    switch (offset >> NES_STATE_REGION_SHIFT){
+        case NES_STATE_REGION_PRG:
+            return nes->nes_rom.prg_rom + (offset & NES_STATE_OFFSET_MASK);
+        case NES_STATE_REGION_CHR:
+            return nes->nes_rom.chr_rom + (offset & NES_STATE_OFFSET_MASK);
+        case NES_STATE_REGION_VRAM:
+            return (uint8_t*)nes->nes_ppu.ppu_vram + (offset & NES_STATE_OFFSET_MASK);
+        default:
+            return NULL;
+    }
+}
+
+static void nes_state_get_banks(const nes_t* nes, uint32_t prg_banks[4], uint32_t chr_banks[16]){
+    for (uint8_t i = 0; i < 4; i++){
+        prg_banks[i] = nes_state_offset(nes, nes->nes_cpu.prg_banks[i]);
+    }
+    for (uint8_t i = 0; i < 16; i++){
+        chr_banks[i] = nes_state_offset(nes, nes->nes_ppu.chr_banks[i]);
+    }
+}
+
+static void nes_state_set_banks(nes_t* nes, const uint32_t prg_banks[4], const uint32_t chr_banks[16]){
+    for (uint8_t i = 0; i < 4; i++){
+        nes->nes_cpu.prg_banks[i] = nes_state_pointer(nes, prg_banks[i]);
+    }
+    for (uint8_t i = 0; i < 16; i++){
+        nes->nes_ppu.chr_banks[i] = nes_state_pointer(nes, chr_banks[i]);
+    }
+}
+
+/* Sections of the snapshot, in order. Also the chunks of the savestate file */
+static uint8_t nes_state_sections(nes_t* nes, nes_state_header_t* header, nes_state_section_t sections[NES_STATE_SECTION_MAX]){
+    uint8_t count = 0;
+#define NES_STATE_SECTION(section_id, section_data, section_size)       \
+    if ((section_size) > 0){                                            \
+        sections[count].id = (section_id);                              \
+        sections[count].data = (void*)(section_data);                   \
+        sections[count].size = (uint32_t)(section_size);                \
+        count++;                                                        \
+    }
+    NES_STATE_SECTION(NES_STATE_ID('C','O','R','E'), header, sizeof(nes_state_header_t));
+    NES_STATE_SECTION(NES_STATE_ID('C','P','U',' '), &nes->nes_cpu, sizeof(nes_cpu_t));
+    NES_STATE_SECTION(NES_STATE_ID('P','P','U',' '), &nes->nes_ppu, sizeof(nes_ppu_t));
+#if (NES_ENABLE_SOUND==1)
+    NES_STATE_SECTION(NES_STATE_ID('A','P','U',' '), &nes->nes_apu, sizeof(nes_apu_t));
+#endif
+    NES_STATE_SECTION(NES_STATE_ID('M','A','P','R'), nes->nes_mapper.mapper_register, nes->nes_mapper.mapper_register_size);
+    NES_STATE_SECTION(NES_STATE_ID('S','R','A','M'), nes->nes_rom.sram, nes_state_sram_size(nes));
+    NES_STATE_SECTION(NES_STATE_ID('C','H','R','R'), nes->nes_rom.chr_rom, nes_state_chr_ram_size(nes));
+#undef NES_STATE_SECTION
+    return count;
+}
+
+size_t nes_state_size(nes_t* nes){
+    if (!nes_state_supported(nes)){
+        return 0;
+    }
+    nes_state_section_t sections[NES_STATE_SECTION_MAX];
+    const uint8_t count = nes_state_sections(nes, NULL, sections);
+    size_t size = 0;
+    for (uint8_t i = 0; i < count; i++){
+        size += sections[i].size;
+    }
+    return size;
+}
+
+int nes_state_save(nes_t* nes, void* buffer, size_t size){
+    const size_t state_size = nes_state_size(nes);
+    if (state_size == 0 || size < state_size){
+        NES_LOG_ERROR("nes_state_save: need %u bytes\n", (unsigned)state_size);
+        return NES_ERROR;
+    }
+    nes_state_header_t header = {
+        .magic = NES_STATE_MAGIC,
+        .version = NES_STATE_VERSION,
+        .header_size = sizeof(nes_state_header_t),
+        .size = (uint32_t)state_size,
+        .mapper_number = nes->nes_rom.mapper_number,
+        .mapper_register_size = nes->nes_mapper.mapper_register_size,
+        .prg_rom_size = nes->nes_rom.prg_rom_size,
+        .chr_rom_size = nes->nes_rom.chr_rom_size,
+        .sram_size = (uint16_t)nes_state_sram_size(nes),
+        .scanline = nes->scanline,
+        .run_cycles_carry = nes->run_cycles_carry,
+        .frame_count = nes->nes_frame_count,
+        .lag_count = nes->nes_lag_count,
+        .lag = nes->nes_lag,
+#if (NES_FRAME_SKIP != 0)
+        .frame_skip_count = nes->nes_frame_skip_count,
+#endif
+    };
+    nes_state_get_banks(nes, header.prg_banks, header.chr_banks);
+
+    nes_state_section_t sections[NES_STATE_SECTION_MAX];
+    const uint8_t count = nes_state_sections(nes, &header, sections);
+    uint8_t* p = (uint8_t*)buffer;
+    for (uint8_t i = 0; i < count; i++){
+        nes_memcpy(p, sections[i].data, sections[i].size);
+        p += sections[i].size;
+    }
+    return NES_OK;
+}
+
+int nes_state_load(nes_t* nes, const void* buffer, size_t size){
+    nes_state_header_t header;
+    const uint8_t* p = (const uint8_t*)buffer;
+    if (size < sizeof(header)){
+        return NES_ERROR;
+    }
+    nes_memcpy(&header, p, sizeof(header));
+    if (header.magic != NES_STATE_MAGIC || header.version != NES_STATE_VERSION || header.header_size != sizeof(header)
+        || header.size != nes_state_size(nes) || header.size > size
+        || header.mapper_number != nes->nes_rom.mapper_number
+        || header.mapper_register_size != nes->nes_mapper.mapper_register_size
+        || header.prg_rom_size != nes->nes_rom.prg_rom_size || header.chr_rom_size != nes->nes_rom.chr_rom_size
+        || header.sram_size != nes_state_sram_size(nes)){
+        NES_LOG_ERROR("nes_state_load: snapshot does not match the loaded ROM\n");
+        return NES_ERROR;
+    }
+#if (NES_ENABLE_SOUND==1)
+    // Keep the host side of the audio output
+    const nes_apu_t apu = nes->nes_apu;
+#endif
+    nes_state_section_t sections[NES_STATE_SECTION_MAX];
+    const uint8_t count = nes_state_sections(nes, &header, sections);
+    p += sizeof(header);
+    for (uint8_t i = 1; i < count; i++){
+        nes_memcpy(sections[i].data, p, sections[i].size);
+        p += sections[i].size;
+    }
+    nes->scanline = header.scanline;
+    nes->run_cycles_carry = header.run_cycles_carry;
+    nes->nes_frame_count = header.frame_count;
+    nes->nes_lag_count = header.lag_count;
+    nes->nes_lag = header.lag;
+#if (NES_FRAME_SKIP != 0)
+    nes->nes_frame_skip_count = header.frame_skip_count;
+#endif
+    nes_state_set_banks(nes, header.prg_banks, header.chr_banks);
+#if (NES_ENABLE_SOUND==1)
+    nes->nes_apu.config = apu.config;
+    nes->nes_apu.sample_bytes = apu.sample_bytes;
+    nes->nes_apu.highpass_coef = apu.highpass_coef;
+    nes->nes_apu.sample_buffer = apu.sample_buffer;
+#if (NES_APU_STEMS == 1)
+    nes->nes_apu.stem_buffer = apu.stem_buffer;
+#endif
+    nes->nes_apu.sample_index = apu.sample_index;
+    nes->nes_apu.block_ready = 0;
+#endif
+    return NES_OK;
+}
+
+#if (NES_USE_FS == 1)
+
+/*
+    Savestate file, every section of the snapshot is one chunk:
+    file header:  "NSAV" | uint16 version | uint16 chunk count
+    chunk:        id[4] | uint16 version | uint16 flags | uint32 size | uint32 stored size | uint32 adler32 | data
+    Chunks are written and read one at a time through nes_fwrite()/nes_fread(), unknown chunks are skipped.
+    With NES_STATE_FILE_LZ a chunk is stored compressed (nes_lz) when that makes it smaller.
+*/
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t chunk_count;
+} nes_state_file_header_t;
+
+typedef struct {
+    uint32_t id;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t size;
+    uint32_t stored_size;
+    uint32_t checksum;                  /*  Adler-32 of the uncompressed data */
+} nes_state_chunk_t;
+
+// https://en.wikipedia.org/wiki/Adler-32
+static uint32_t nes_state_adler32(const uint8_t* data, size_t size){
+    uint32_t a = 1, b = 0;
+    while (size){
+        size_t n = size < 5552 ? size : 5552;   // Largest run without overflowing b
+        size -= n;
+        while (n--){
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+int nes_state_save_file(nes_t* nes, const char* file_path, uint8_t flags){
+    const size_t state_size = nes_state_size(nes);
+    if (state_size == 0){
+        return NES_ERROR;
+    }
+    // Snapshot first, the file is written from it chunk by chunk
+    uint8_t* state = (uint8_t*)nes_malloc((int)(state_size + NES_LZ_BOUND(state_size)));
+    if (state == NULL){
+        return NES_ERROR;
+    }
+    uint8_t* scratch = state + state_size;
+    nes_state_save(nes, state, state_size);
+    FILE* file = nes_fopen(file_path, "wb");
+    if (file == NULL){
+        NES_LOG_ERROR("nes_state_save_file: failed to open file %s\n", file_path);
+        nes_free(state);
+        return NES_ERROR;
+    }
+    nes_state_section_t sections[NES_STATE_SECTION_MAX];
+    const uint8_t count = nes_state_sections(nes, NULL, sections);
+    const nes_state_file_header_t file_header = {
+        .magic = NES_STATE_FILE_MAGIC,
+        .version = NES_STATE_VERSION,
+        .chunk_count = count,
+    };
+    int ret = nes_fwrite(&file_header, sizeof(file_header), 1, file) == 1 ? NES_OK : NES_ERROR;
+    const uint8_t* data = state;
+    for (uint8_t i = 0; i < count && ret == NES_OK; i++){
+        nes_state_chunk_t chunk = {
+            .id = sections[i].id,
+            .version = NES_STATE_VERSION,
+            .size = sections[i].size,
+            .stored_size = sections[i].size,
+            .checksum = nes_state_adler32(data, sections[i].size),
+        };
+        const uint8_t* stored = data;
+        if (flags & NES_STATE_FILE_LZ){
+            const size_t compressed = nes_lz_compress(data, chunk.size, scratch, chunk.size - 1);
+            if (compressed){
+                chunk.flags = NES_STATE_FILE_LZ;
+                chunk.stored_size = (uint32_t)compressed;
+                stored = scratch;
+            }
+        }
+        if (nes_fwrite(&chunk, sizeof(chunk), 1, file) != 1 || nes_fwrite(stored, 1, chunk.stored_size, file) != chunk.stored_size){
+            ret = NES_ERROR;
+        }
+        data += chunk.size;
+    }
+    if (nes_fclose(file)){
+        ret = NES_ERROR;
+    }
+    nes_free(state);
+    return ret;
+}
+
+int nes_state_load_file(nes_t* nes, const char* file_path){
+    const size_t state_size = nes_state_size(nes);
+    if (state_size == 0){
+        return NES_ERROR;
+    }
+    uint8_t* state = (uint8_t*)nes_malloc((int)(state_size * 2));
+    if (state == NULL){
+        return NES_ERROR;
+    }
+    uint8_t* scratch = state + state_size;
+    FILE* file = nes_fopen(file_path, "rb");
+    if (file == NULL){
+        NES_LOG_ERROR("nes_state_load_file: failed to open file %s\n", file_path);
+        nes_free(state);
+        return NES_ERROR;
+    }
+    nes_state_section_t sections[NES_STATE_SECTION_MAX];
+    const uint8_t count = nes_state_sections(nes, NULL, sections);
+    uint32_t offsets[NES_STATE_SECTION_MAX];
+    uint8_t loaded = 0;
+    uint32_t offset = 0;
+    for (uint8_t i = 0; i < count; i++){
+        offsets[i] = offset;
+        offset += sections[i].size;
+    }
+    nes_state_file_header_t file_header;
+    int ret = NES_OK;
+    if (nes_fread(&file_header, sizeof(file_header), 1, file) != 1
+        || file_header.magic != NES_STATE_FILE_MAGIC || file_header.version != NES_STATE_VERSION){
+        NES_LOG_ERROR("nes_state_load_file: %s is not a savestate of this version\n", file_path);
+        ret = NES_ERROR;
+    }
+    for (uint16_t c = 0; c < file_header.chunk_count && ret == NES_OK; c++){
+        nes_state_chunk_t chunk;
+        if (nes_fread(&chunk, sizeof(chunk), 1, file) != 1){
+            ret = NES_ERROR;
+            break;
+        }
+        uint8_t i = 0;
+        while (i < count && sections[i].id != chunk.id){
+            i++;
+        }
+        if (i == count){
+            nes_fseek(file, (long)chunk.stored_size, SEEK_CUR);
+            continue;
+        }
+        // No chunk migrations exist yet: version and size have to match this build
+        if (chunk.version != NES_STATE_VERSION || chunk.size != sections[i].size || chunk.stored_size > chunk.size){
+            NES_LOG_ERROR("nes_state_load_file: chunk %.4s does not match\n", (const char*)&chunk.id);
+            ret = NES_ERROR;
+            break;
+        }
+        uint8_t* data = state + offsets[i];
+        if (chunk.flags & NES_STATE_FILE_LZ){
+            if (nes_fread(scratch, 1, chunk.stored_size, file) != chunk.stored_size
+                || nes_lz_decompress(scratch, chunk.stored_size, data, chunk.size)){
+                ret = NES_ERROR;
+            }
+        }else if (nes_fread(data, 1, chunk.size, file) != chunk.size){
+            ret = NES_ERROR;
+        }
+        if (ret == NES_OK && nes_state_adler32(data, chunk.size) != chunk.checksum){
+            NES_LOG_ERROR("nes_state_load_file: chunk %.4s is corrupted\n", (const char*)&chunk.id);
+            ret = NES_ERROR;
+        }
+        loaded++;
+    }
+    nes_fclose(file);
+    if (ret == NES_OK && loaded == count){
+        ret = nes_state_load(nes, state, state_size);
+    }else{
+        ret = NES_ERROR;
+    }
+    nes_free(state);
+    return ret;
+}
+
+#endif
+
+nes_t* nes_clone(nes_t* nes){
+    if (!nes_state_supported(nes)){
+        NES_LOG_ERROR("nes_clone: mapper state can not be copied\n");
+        return NULL;
+    }
+    nes_t* clone = (nes_t*)nes_malloc(sizeof(nes_t));
+    if (clone == NULL){
+        return NULL;
+    }
+    nes_memcpy(clone, nes, sizeof(nes_t));
+    clone->nes_rom.sram = NULL;
+    clone->nes_mapper.mapper_register = NULL;
+    clone->nes_rewind = NULL;
+    clone->nes_runahead = NULL;
+    clone->nes_movie = NULL;
+    clone->nes_obs = NULL;
+    clone->nes_draw_buffer = NULL;
+#if (NES_INPUT_QUEUE == 1)
+    clone->nes_input_queue = NULL;
+#endif
+#if (NES_FRAME_HASH == 1) && (NES_USE_FS == 1)
+    clone->nes_frame_hash.log = NULL;
+#endif
+#if (NES_ENABLE_SOUND==1)
+    clone->nes_apu.sample_buffer = NULL;
+#if (NES_APU_STEMS == 1)
+    clone->nes_apu.stem_buffer = NULL;
+#endif
+#endif
+    const uint32_t chr_ram_size = nes_state_chr_ram_size(nes);
+    if (chr_ram_size){
+        clone->nes_rom.chr_rom = NULL;
+    }
+
+#define NES_CLONE_BUFFER(field, bytes)                                  \
+    if (nes->field){                                                    \
+        clone->field = nes_malloc((int)(bytes));                        \
+        if (clone->field == NULL){                                      \
+            goto error;                                                 \
+        }                                                               \
+        nes_memcpy(clone->field, nes->field, (bytes));                  \
+    }
+    NES_CLONE_BUFFER(nes_rom.sram, SRAM_SIZE);
+    NES_CLONE_BUFFER(nes_mapper.mapper_register, nes->nes_mapper.mapper_register_size);
+#if (NES_ENABLE_SOUND==1)
+    NES_CLONE_BUFFER(nes_apu.sample_buffer, nes->nes_apu.config.block_size * nes->nes_apu.sample_bytes);
+#if (NES_APU_STEMS == 1)
+    NES_CLONE_BUFFER(nes_apu.stem_buffer, nes->nes_apu.config.block_size * 5);
+#endif
+#endif
+    if (chr_ram_size){
+        NES_CLONE_BUFFER(nes_rom.chr_rom, chr_ram_size);
+    }
+#undef NES_CLONE_BUFFER
+    // Own copy of the picture, also when the source renders into a host frame
+    if (nes_set_framebuffer(clone, NULL, 0)){
+        goto error;
+    }
+    for (uint32_t line = 0; line < NES_DRAW_SIZE / NES_WIDTH; line++){
+        nes_memcpy(clone->nes_draw_data + line * NES_WIDTH, nes->nes_draw_data + line * nes->nes_draw_stride, NES_WIDTH * sizeof(nes_color_t));
+    }
+
+    // Point the banks at the clone's own VRAM and CHR-RAM
+    uint32_t prg_banks[4], chr_banks[16];
+    nes_state_get_banks(nes, prg_banks, chr_banks);
+    nes_state_set_banks(clone, prg_banks, chr_banks);
+    return clone;
+error:
+    nes_clone_free(clone);
+    return NULL;
+}
+
+void nes_clone_free(nes_t* clone){
+    if (clone == NULL){
+        return;
+    }
+    nes_unload_mapper(clone);
+    if (clone->nes_rom.sram){
+        nes_free(clone->nes_rom.sram);
+    }
+    if (clone->nes_rom.chr_rom_size == 0 && clone->nes_rom.chr_rom){
+        nes_free(clone->nes_rom.chr_rom);
+    }
+#if (NES_ENABLE_SOUND==1)
+    nes_apu_deinit(clone);
+#endif
+    if (clone->nes_draw_buffer){
+        nes_free(clone->nes_draw_buffer);
+    }
+    nes_free(clone);
+}